@@ -0,0 +1,147 @@
+// When rcopy sends its RRs and SREJs
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ack.h"
+#include "networks.h"
+
+void initAckPolicy(struct ackPolicy * ack, int every, int64_t delay, int64_t srejGap,
+   int windowSize)
+{
+   memset(ack, 0, sizeof(struct ackPolicy));
+   ack->every = every;
+   ack->delay = delay;
+   ack->srejGap = srejGap;
+   ack->size = windowSize;
+
+   if ((ack->holes = calloc(windowSize, sizeof(struct hole))) == NULL)
+   {
+      perror("initAckPolicy: calloc");
+      exit(-1);
+   }
+}
+
+void freeAckPolicy(struct ackPolicy * ack)
+{
+   free(ack->holes);
+   ack->holes = NULL;
+   ack->size = 0;
+}
+
+// A data packet was taken that the next RR will acknowledge
+void ackPacket(struct ackPolicy * ack, uint64_t now)
+{
+   if (ack->pending++ == 0)
+      ack->pendingSince = now;
+}
+
+void ackSent(struct ackPolicy * ack, uint8_t flag)
+{
+   if (flag == RR) {
+      ack->rrs++;
+      ack->pending = 0;
+   } else if (flag == SREJ) {
+      ack->srejs++;
+   }
+}
+
+// Returns 1 if enough packets, or enough time, is waiting on a RR
+int ackDue(struct ackPolicy * ack, uint64_t now)
+{
+   if (ack->pending == 0)
+      return 0;
+
+   return ack->pending >= ack->every || now >= ack->pendingSince + ack->delay;
+}
+
+// Microseconds until the delayed RR is due, -1 if nothing is waiting on one
+int64_t ackWait(struct ackPolicy * ack, uint64_t now)
+{
+   if (ack->pending == 0)
+      return -1;
+   if (now >= ack->pendingSince + ack->delay)
+      return 0;
+
+   return ack->pendingSince + ack->delay - now;
+}
+
+// Least time between SREJs for a hole, doubled each time it is SREJ'd again
+static int64_t srejInterval(struct ackPolicy * ack, struct hole * hole)
+{
+   int64_t gap = ack->srtt > ack->srejGap ? ack->srtt : ack->srejGap;
+   int shift = hole->srejs - 1;
+
+   if (shift > SREJ_BACKOFF_MAX)
+      shift = SREJ_BACKOFF_MAX;
+
+   return shift > 0 ? gap << shift : gap;
+}
+
+/*****
+ * Returns 1 and records the SREJ if seq_num may be SREJ'd now: it has not
+ * been, or not within the last round trip (srejInterval()). Returns 0 and
+ * counts it as suppressed otherwise.
+ ****/
+int srejAllowed(struct ackPolicy * ack, int32_t seq_num, uint64_t now)
+{
+   struct hole * hole = &ack->holes[seq_num % ack->size];
+
+   if (hole->seq_num == seq_num && now < hole->at + srejInterval(ack, hole)) {
+      ack->suppressed++;
+      return 0;
+   }
+
+   if (hole->seq_num != seq_num) {
+      hole->seq_num = seq_num;
+      hole->srejs = 0;
+   }
+   hole->srejs++;
+   hole->at = now;
+
+   return 1;
+}
+
+/*****
+ * Microseconds until seq_num may be SREJ'd again, 0 if it may be now, and
+ * -1 if it has not been SREJ'd at all. Lets rcopy SREJ the packet holding
+ * everything up again when nothing else arrives to prompt it.
+ ****/
+int64_t srejWait(struct ackPolicy * ack, int32_t seq_num, uint64_t now)
+{
+   struct hole * hole = &ack->holes[seq_num % ack->size];
+   uint64_t due;
+
+   if (hole->seq_num != seq_num)
+      return -1;
+
+   due = hole->at + srejInterval(ack, hole);
+   return now >= due ? 0 : due - now;
+}
+
+// seq_num arrived, time its SREJ if it was SREJ'd exactly once (Karn)
+void holeFilled(struct ackPolicy * ack, int32_t seq_num, uint64_t now)
+{
+   struct hole * hole = &ack->holes[seq_num % ack->size];
+   int64_t sample;
+
+   if (hole->seq_num != seq_num)
+      return;
+
+   if (hole->srejs == 1) {
+      sample = now - hole->at;
+      ack->srtt = ack->srtt == 0 ? sample : ack->srtt + (sample - ack->srtt) / 8;
+   }
+
+   hole->seq_num = 0;
+}
+
+void printAckStats(struct ackPolicy * ack)
+{
+   printf("Acked %llu packets with %llu RRs and %llu SREJs (%.2f acks per packet),"
+      " %llu SREJs held back\n", (unsigned long long)ack->packets,
+      (unsigned long long)ack->rrs, (unsigned long long)ack->srejs,
+      ack->packets ? (double)(ack->rrs + ack->srejs) / ack->packets : 0.0,
+      (unsigned long long)ack->suppressed);
+}
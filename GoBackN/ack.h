@@ -0,0 +1,58 @@
+// When rcopy sends its RRs and SREJs
+
+#ifndef __ACK_H__
+#define __ACK_H__
+
+#include <stdint.h>
+
+#define ACK_EVERY_DEFAULT 2    // RR once this many packets are waiting on one
+#define ACK_DELAY_DEFAULT 500  // or this many microseconds after the first
+#define SREJ_GAP_DEFAULT 1000  // least microseconds between SREJs for a hole
+#define SREJ_BACKOFF_MAX 6     // a hole SREJ'd again waits up to 64 times that
+
+// A hole rcopy has SREJ'd
+struct hole {
+   int32_t seq_num; // 0 if the slot holds none
+   int32_t srejs;   // times SREJ'd, only a hole SREJ'd once is timed
+   uint64_t at;     // when it was last SREJ'd
+};
+
+/*****
+ * Delayed and coalesced acknowledgements. A RR goes out once every packets
+ * have arrived since the last one, or delay microseconds after the first of
+ * them (0: at the end of each batch read off the socket), whichever comes
+ * first; rcopy sends one straight away when something is out of order.
+ * A hole is SREJ'd at most once per round trip: the time from a SREJ to
+ * the resend arriving is smoothed into srtt, and a hole is only SREJ'd
+ * again once max(srtt, srejGap) has passed, doubled for every SREJ it has
+ * already had. The hole slots are indexed by seq_num % size like the
+ * reorder buffer.
+ ****/
+struct ackPolicy {
+   int every;
+   int64_t delay;
+   int64_t srejGap;
+   int pending;           // packets taken since the last RR
+   uint64_t pendingSince; // when the first of them arrived
+   int64_t srtt;          // SREJ to resend, microseconds, 0 until timed
+   int32_t size;
+   struct hole * holes;
+   uint64_t packets;      // data packets that passed the checksum (rcopy counts)
+   uint64_t rrs;
+   uint64_t srejs;
+   uint64_t suppressed;   // SREJs held back, the hole was SREJ'd recently
+};
+
+void initAckPolicy(struct ackPolicy * ack, int every, int64_t delay, int64_t srejGap,
+   int windowSize);
+void freeAckPolicy(struct ackPolicy * ack);
+void ackPacket(struct ackPolicy * ack, uint64_t now);
+void ackSent(struct ackPolicy * ack, uint8_t flag);
+int ackDue(struct ackPolicy * ack, uint64_t now);
+int64_t ackWait(struct ackPolicy * ack, uint64_t now);
+int srejAllowed(struct ackPolicy * ack, int32_t seq_num, uint64_t now);
+int64_t srejWait(struct ackPolicy * ack, int32_t seq_num, uint64_t now);
+void holeFilled(struct ackPolicy * ack, int32_t seq_num, uint64_t now);
+void printAckStats(struct ackPolicy * ack);
+
+#endif
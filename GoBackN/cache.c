@@ -0,0 +1,408 @@
+// Server-wide cache of file chunks already cut into summed packet payloads
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "networks.h"
+#include "crc32c.h"
+#include "libcpe464/networks/checksum.h"
+
+#define CACHE_ALIGN 64
+
+static size_t alignUp(size_t len)
+{
+   return (len + CACHE_ALIGN - 1) & ~(size_t)(CACHE_ALIGN - 1);
+}
+
+// The pieces of the mapping, after the struct packetCache at its start
+
+static int32_t * buckets(struct packetCache * cache)
+{
+   return (int32_t *)((u_char *)cache + alignUp(sizeof(struct packetCache)));
+}
+
+static struct cacheEntry * entries(struct packetCache * cache)
+{
+   return (struct cacheEntry *)((u_char *)buckets(cache)
+      + alignUp(sizeof(int32_t) << cache->bits));
+}
+
+static uint32_t * slotSums(struct packetCache * cache, int32_t slot)
+{
+   return (uint32_t *)((u_char *)entries(cache)
+      + alignUp(sizeof(struct cacheEntry) * cache->slots)) + (size_t)slot * CACHE_PACKETS_MAX;
+}
+
+static u_char * slotData(struct packetCache * cache, int32_t slot)
+{
+   return (u_char *)slotSums(cache, cache->slots) + (size_t)slot * CACHE_CHUNK;
+}
+
+static size_t cacheLen(int32_t slots, int bits)
+{
+   return alignUp(sizeof(struct packetCache)) + alignUp(sizeof(int32_t) << bits)
+      + alignUp(sizeof(struct cacheEntry) * slots)
+      + (size_t)slots * (CACHE_PACKETS_MAX * sizeof(uint32_t) + CACHE_CHUNK);
+}
+
+// FNV-1a over the key, which has no padding
+static uint32_t hashKey(struct cacheKey * key)
+{
+   const u_char * p = (const u_char *)key;
+   uint32_t hash = 2166136261U;
+   size_t i;
+
+   for (i = 0; i < sizeof(struct cacheKey); i++)
+      hash = (hash ^ p[i]) * 16777619U;
+
+   return hash;
+}
+
+static void resetCache(struct packetCache * cache)
+{
+   memset(buckets(cache), 0xff, sizeof(int32_t) << cache->bits);
+   cache->newest = -1;
+   cache->oldest = -1;
+   cache->free = 0;
+   cache->used = 0;
+}
+
+/*****
+ * Makes a cache that uses at most budget bytes, or returns NULL if that is
+ * not enough for one slot or the mapping cannot be made. Every slot costs
+ * CACHE_CHUNK bytes of data plus its sums and bookkeeping.
+ ****/
+struct packetCache * newPacketCache(size_t budget)
+{
+   struct packetCache * cache;
+   pthread_mutexattr_t attr;
+   int32_t slots;
+   int bits;
+   size_t len = 0;
+
+   slots = budget / (CACHE_CHUNK + CACHE_PACKETS_MAX * sizeof(uint32_t)
+      + sizeof(struct cacheEntry) + 2 * sizeof(int32_t));
+   for (bits = 1; (1 << bits) < 2 * slots; bits++)
+      ;
+   // the rounding up may push it over the budget by a slot or two
+   while (slots > 0 && (len = cacheLen(slots, bits)) > budget)
+      slots--;
+   if (slots == 0)
+      return NULL;
+
+   cache = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+   if (cache == MAP_FAILED)
+   {
+      perror("newPacketCache: mmap");
+      return NULL;
+   }
+
+   cache->mapLen = len;
+   cache->slots = slots;
+   cache->bits = bits;
+   resetCache(cache);
+
+   pthread_mutexattr_init(&attr);
+   pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+   pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+   if (pthread_mutex_init(&cache->lock, &attr) != 0)
+   {
+      fprintf(stderr, "newPacketCache: could not make a shared mutex\n");
+      munmap(cache, len);
+      cache = NULL;
+   }
+   pthread_mutexattr_destroy(&attr);
+
+   return cache;
+}
+
+// A holder that died may have left the lists half changed, so start over
+static void lockCache(struct packetCache * cache)
+{
+   if (pthread_mutex_lock(&cache->lock) == EOWNERDEAD)
+   {
+      resetCache(cache);
+      pthread_mutex_consistent(&cache->lock);
+   }
+}
+
+static int32_t findSlot(struct packetCache * cache, struct cacheKey * key)
+{
+   struct cacheEntry * entry = entries(cache);
+   int32_t slot = buckets(cache)[hashKey(key) & ((1U << cache->bits) - 1)];
+
+   while (slot >= 0 && memcmp(&entry[slot].key, key, sizeof(struct cacheKey)) != 0)
+      slot = entry[slot].hashNext;
+
+   return slot;
+}
+
+static void unlinkLru(struct packetCache * cache, int32_t slot)
+{
+   struct cacheEntry * entry = entries(cache);
+
+   if (entry[slot].newer >= 0)
+      entry[entry[slot].newer].older = entry[slot].older;
+   else
+      cache->newest = entry[slot].older;
+
+   if (entry[slot].older >= 0)
+      entry[entry[slot].older].newer = entry[slot].newer;
+   else
+      cache->oldest = entry[slot].newer;
+}
+
+static void pushNewest(struct packetCache * cache, int32_t slot)
+{
+   struct cacheEntry * entry = entries(cache);
+
+   entry[slot].newer = -1;
+   entry[slot].older = cache->newest;
+   if (cache->newest >= 0)
+      entry[cache->newest].newer = slot;
+   else
+      cache->oldest = slot;
+   cache->newest = slot;
+}
+
+static void unhash(struct packetCache * cache, int32_t slot)
+{
+   struct cacheEntry * entry = entries(cache);
+   int32_t * link = &buckets(cache)[hashKey(&entry[slot].key) & ((1U << cache->bits) - 1)];
+
+   while (*link != slot)
+      link = &entry[*link].hashNext;
+   *link = entry[slot].hashNext;
+}
+
+/*****
+ * A slot for a new chunk: one never used while there are any, otherwise
+ * the least recently used one, taken out of its bucket.
+ ****/
+static int32_t takeSlot(struct packetCache * cache)
+{
+   int32_t slot;
+
+   if (cache->free < cache->slots)
+   {
+      cache->used++;
+      return cache->free++;
+   }
+
+   slot = cache->oldest;
+   unlinkLru(cache, slot);
+   unhash(cache, slot);
+   cache->evictions++;
+   return slot;
+}
+
+/*****
+ * The session can use the cache if it has one, its payload leaves room
+ * for a slot's sums and the file is a regular file. check is CACHE_CKSUM
+ * or CACHE_CRC32C, whichever the session's packets carry. Returns 0 if
+ * it can, -1 if it sends without the cache.
+ ****/
+int initCacheReader(struct cacheReader * reader, struct packetCache * cache, int fd,
+   int payload, int check)
+{
+   struct stat st;
+
+   memset(reader, 0, sizeof(struct cacheReader));
+
+   if (cache == NULL || payload < CACHE_PAYLOAD_MIN || payload > CACHE_CHUNK
+      || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+      return -1;
+
+   if ((reader->data = malloc(CACHE_CHUNK)) == NULL)
+   {
+      perror("initCacheReader: malloc");
+      exit(-1);
+   }
+
+   reader->cache = cache;
+   reader->key.dev = st.st_dev;
+   reader->key.ino = st.st_ino;
+   reader->key.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+   reader->key.size = st.st_size;
+   reader->key.payload = payload;
+   reader->key.check = check;
+   reader->perChunk = CACHE_CHUNK / payload;
+   if (check == CACHE_CRC32C)
+      reader->shift = crc32cShift(payload);
+
+   return 0;
+}
+
+/*****
+ * Reads want bytes at offset and sums every payload in them. A short read
+ * (the file shrank since it was opened) is sent as it is but not cached.
+ ****/
+static int readChunk(struct cacheReader * reader, int fd, off_t offset, int want)
+{
+   struct cacheKey * key = &reader->key;
+   u_char * p;
+   int got = 0;
+   int len;
+   int i;
+
+   while (got < want)
+   {
+      if ((len = pread(fd, reader->data + got, want - got, offset + got)) < 0)
+         return -1;
+      if (len == 0)
+         break;
+      got += len;
+   }
+
+   for (i = 0; i * key->payload < got; i++)
+   {
+      p = reader->data + i * key->payload;
+      len = got - i * key->payload < key->payload ? got - i * key->payload : key->payload;
+      if (key->check == CACHE_CRC32C)
+         reader->sums[i] = crc32c(0, p, len);
+      else
+         reader->sums[i] = in_cksum_add(0, p, len, HDR_LEN);
+   }
+
+   return got;
+}
+
+/*****
+ * Fills the reader with the chunk of want bytes at offset: copied out of
+ * its slot if the cache has it, otherwise read and summed and then copied
+ * into a slot for the next session. Returns the bytes in it, -1 if
+ * pread() failed.
+ ****/
+static int loadChunk(struct cacheReader * reader, int fd, off_t offset, int want)
+{
+   struct packetCache * cache = reader->cache;
+   struct cacheEntry * entry;
+   int packets = (want + reader->key.payload - 1) / reader->key.payload;
+   int32_t slot;
+   int got;
+
+   reader->key.offset = offset;
+   reader->key.len = want;
+   reader->lookups++;
+
+   lockCache(cache);
+   cache->lookups++;
+   if ((slot = findSlot(cache, &reader->key)) >= 0)
+   {
+      memcpy(reader->data, slotData(cache, slot), want);
+      memcpy(reader->sums, slotSums(cache, slot), packets * sizeof(uint32_t));
+      unlinkLru(cache, slot);
+      pushNewest(cache, slot);
+      cache->hits++;
+      cache->saved += want;
+      pthread_mutex_unlock(&cache->lock);
+
+      reader->hits++;
+      reader->saved += want;
+      return want;
+   }
+   pthread_mutex_unlock(&cache->lock);
+
+   if ((got = readChunk(reader, fd, offset, want)) != want)
+      return got;
+
+   // another session may have put it in while this one was reading
+   lockCache(cache);
+   if (findSlot(cache, &reader->key) < 0)
+   {
+      slot = takeSlot(cache);
+      entry = &entries(cache)[slot];
+      memcpy(&entry->key, &reader->key, sizeof(struct cacheKey));
+      memcpy(slotData(cache, slot), reader->data, want);
+      memcpy(slotSums(cache, slot), reader->sums, packets * sizeof(uint32_t));
+      entry->hashNext = buckets(cache)[hashKey(&entry->key) & ((1U << cache->bits) - 1)];
+      buckets(cache)[hashKey(&entry->key) & ((1U << cache->bits) - 1)] = slot;
+      pushNewest(cache, slot);
+   }
+   pthread_mutex_unlock(&cache->lock);
+
+   return got;
+}
+
+/*****
+ * Points payload at the next packet's bytes at *offset, up to end (-1 for
+ * the file's end), sets sum to their cached sum and moves *offset past
+ * them. Chunks start wherever the session does, so sessions that start at
+ * the same place (the start of the file, or of a stripe) share them.
+ * Returns the bytes, 0 at the end and -1 if pread() failed.
+ ****/
+int nextCached(struct cacheReader * reader, int fd, off_t * offset, off_t end,
+   u_char ** payload, uint32_t * sum)
+{
+   int payloadLen = reader->key.payload;
+   off_t stop = reader->key.size;
+   off_t want;
+   int len;
+
+   if (reader->pos == reader->len)
+   {
+      if (end >= 0 && end < stop)
+         stop = end;
+      want = (off_t)reader->perChunk * payloadLen;
+      if (stop - *offset < want)
+         want = stop - *offset;
+      if (want <= 0)
+         return 0;
+
+      if ((len = loadChunk(reader, fd, *offset, want)) <= 0)
+         return len;
+      reader->len = len;
+      reader->pos = 0;
+   }
+
+   len = reader->len - reader->pos < payloadLen ? reader->len - reader->pos : payloadLen;
+   *payload = reader->data + reader->pos;
+   *sum = reader->sums[reader->pos / payloadLen];
+   reader->pos += len;
+   *offset += len;
+
+   return len;
+}
+
+// crc32cShift() for a payload of len bytes, worked out once for full ones
+uint32_t cachedShift(struct cacheReader * reader, int len)
+{
+   return len == reader->key.payload ? reader->shift : crc32cShift(len);
+}
+
+void printCacheStats(struct cacheReader * reader)
+{
+   struct packetCache * cache = reader->cache;
+   uint64_t lookups;
+   uint64_t hits;
+   uint64_t saved;
+   uint64_t evictions;
+   int32_t used;
+
+   lockCache(cache);
+   lookups = cache->lookups;
+   hits = cache->hits;
+   saved = cache->saved;
+   evictions = cache->evictions;
+   used = cache->used;
+   pthread_mutex_unlock(&cache->lock);
+
+   printf("Cache %llu of %llu chunks hit, %llu bytes not read (server: %.1f%% of %llu hit, "
+      "%llu MB not read, %d of %d slots used, %llu evicted)\n",
+      (unsigned long long)reader->hits, (unsigned long long)reader->lookups,
+      (unsigned long long)reader->saved, lookups > 0 ? 100.0 * hits / lookups : 0.0,
+      (unsigned long long)lookups, (unsigned long long)(saved >> 20), used,
+      cache->slots, (unsigned long long)evictions);
+}
+
+void freeCacheReader(struct cacheReader * reader)
+{
+   free(reader->data);
+   reader->data = NULL;
+}
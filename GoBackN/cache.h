@@ -0,0 +1,95 @@
+// Server-wide cache of file chunks already cut into summed packet payloads
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define CACHE_CHUNK (64 * 1024)   // file bytes a cache slot holds, at most
+#define CACHE_PACKETS_MAX 128     // payloads a slot holds, so...
+#define CACHE_PAYLOAD_MIN (CACHE_CHUNK / CACHE_PACKETS_MAX) // ...the smallest payload cached
+
+// How the sums in a slot were made
+#define CACHE_CKSUM 0   // in_cksum_add() of the payload at its packet offset, unfolded
+#define CACHE_CRC32C 1  // crc32c() of the payload alone
+
+/*****
+ * What a slot holds: len bytes of one file, starting at offset, cut into
+ * payload byte packets. The file is told apart by device, inode, mtime
+ * and size, so a file that has changed misses and its old chunks age out.
+ ****/
+struct cacheKey {
+   uint64_t dev;
+   uint64_t ino;
+   int64_t mtime; // nanoseconds
+   int64_t size;
+   int64_t offset;
+   int32_t len;
+   uint16_t payload;
+   uint16_t check; // CACHE_CKSUM or CACHE_CRC32C
+};
+
+struct cacheEntry {
+   struct cacheKey key;
+   int32_t hashNext; // next slot in the same bucket, -1 at the end
+   int32_t newer;    // LRU list, -1 at either end
+   int32_t older;
+   int32_t used;
+};
+
+/*****
+ * One per server, in a shared anonymous mapping made before any child is
+ * forked or thread started, so every mode shares the same slots: forked
+ * children through the mapping, threads and the event loop as ordinary
+ * memory. Everything inside is found by index from the mapping's start.
+ * The mutex is process shared and robust: a child that dies holding it
+ * leaves the cache emptied rather than locked. Slots are recycled least
+ * recently used first once all of them are in use.
+ ****/
+struct packetCache {
+   pthread_mutex_t lock;
+   size_t mapLen;
+   int32_t slots;
+   int32_t bits;     // log2 of the buckets
+   int32_t newest;
+   int32_t oldest;
+   int32_t free;     // slots never used yet start here
+   int32_t used;
+   uint64_t lookups; // server-wide, over every session so far
+   uint64_t hits;
+   uint64_t saved;   // file bytes served without a read or a sum
+   uint64_t evictions;
+};
+
+/*****
+ * A session's view of the cache: the chunk it is sending from, copied out
+ * of the shared slot (or read from the file on a miss) so packets can be
+ * cut from it without holding the lock. shift is crc32cShift() of a full
+ * payload, for joining a cached CRC to the header's.
+ ****/
+struct cacheReader {
+   struct packetCache * cache;
+   struct cacheKey key;
+   int perChunk;   // packets in a full chunk
+   u_char * data;  // CACHE_CHUNK bytes, NULL when the session does not use the cache
+   uint32_t sums[CACHE_PACKETS_MAX];
+   int len;        // bytes of the chunk
+   int pos;        // of them already cut into packets
+   uint32_t shift;
+   uint64_t lookups;
+   uint64_t hits;
+   uint64_t saved;
+};
+
+struct packetCache * newPacketCache(size_t budget);
+int initCacheReader(struct cacheReader * reader, struct packetCache * cache, int fd,
+   int payload, int check);
+int nextCached(struct cacheReader * reader, int fd, off_t * offset, off_t end,
+   u_char ** payload, uint32_t * sum);
+uint32_t cachedShift(struct cacheReader * reader, int len);
+void printCacheStats(struct cacheReader * reader);
+void freeCacheReader(struct cacheReader * reader);
+
+#endif
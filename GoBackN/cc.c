@@ -0,0 +1,313 @@
+// Congestion control for the server's send window
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cc.h"
+
+#define BBR_STARTUP 0
+#define BBR_PROBE_BW 1
+#define BBR_PROBE_RTT 2
+
+#define BBR_CWND_GAIN 2.0
+#define BBR_PROBE_RTT_TIME 200000 // microseconds spent at the minimum window
+#define BBR_MIN_WINDOW 4
+#define BBR_HIGH_GAIN 2.885 // 2/ln(2), startup doubles the rate every round
+
+#define PACE_SS_GAIN 2.0  // window controllers pace at this times cwnd/srtt
+#define PACE_CA_GAIN 1.2  // in slow start and after it (as Linux TCP does)
+
+// PROBE_BW paces each round at the next of these times the bandwidth:
+// a round above it to look for more, one below to drain what that queued
+static const double bbrGains[] = { 1.25, 0.75, 1, 1, 1, 1, 1, 1 };
+
+static void clampWindow(struct cc * cc)
+{
+   if (cc->cwnd > cc->max)
+      cc->cwnd = cc->max;
+   if (cc->cwnd < 1)
+      cc->cwnd = 1;
+}
+
+/*****
+ * fixed: always the whole window, which is how the server behaved before
+ * it had congestion control.
+ ****/
+static void fixedInit(struct cc * cc)
+{
+   cc->cwnd = cc->max;
+}
+
+static void fixedAck(struct cc * cc, int acked, int64_t rtt, double rate, int newRound, uint64_t now)
+{
+}
+
+static void fixedLoss(struct cc * cc)
+{
+}
+
+// A window's worth every round trip, a bit more so pacing never holds the
+// window back, and twice that in slow start so it can keep doubling
+static double windowRate(struct cc * cc, int64_t srtt)
+{
+   if (srtt <= 0)
+      return 0;
+
+   return (cc->cwnd < cc->ssthresh ? PACE_SS_GAIN : PACE_CA_GAIN) * cc->cwnd / srtt;
+}
+
+/*****
+ * reno: slow start to ssthresh, then one packet more per round trip. A
+ * loss halves the window, a timeout drops it to one packet and starts
+ * over with slow start (RFC 5681).
+ ****/
+static void renoInit(struct cc * cc)
+{
+   cc->cwnd = CC_INIT_WINDOW;
+   cc->ssthresh = cc->max;
+}
+
+static void renoAck(struct cc * cc, int acked, int64_t rtt, double rate, int newRound, uint64_t now)
+{
+   if (cc->cwnd < cc->ssthresh)
+      cc->cwnd += acked;
+   else
+      cc->cwnd += (double)acked / cc->cwnd;
+}
+
+static void renoLoss(struct cc * cc)
+{
+   cc->ssthresh = cc->cwnd / 2;
+   if (cc->ssthresh < CC_MIN_WINDOW)
+      cc->ssthresh = CC_MIN_WINDOW;
+   cc->cwnd = cc->ssthresh;
+}
+
+static void renoTimeout(struct cc * cc)
+{
+   renoLoss(cc);
+   cc->cwnd = 1;
+}
+
+/*****
+ * bbr: models the path as a bottleneck bandwidth (the best delivery rate
+ * of the last BBR_BW_ROUNDS rounds) and a propagation delay (the smallest
+ * RTT of the last BBR_RTT_WINDOW), and keeps BBR_CWND_GAIN times their
+ * product in flight. Random loss does not shrink the window, only the
+ * model and a timeout do. In startup the window grows like slow start
+ * until the bandwidth stops growing by a quarter for three rounds. Every
+ * BBR_RTT_WINDOW without a lower RTT it drops to the minimum window for a
+ * moment to let queues drain and measure the RTT again. Paced (-p cc), it
+ * sends at the bandwidth times a gain: BBR_HIGH_GAIN in startup, then a
+ * cycle of bbrGains one round each.
+ ****/
+static double bbrBdp(struct cc * cc)
+{
+   return cc->btlBw * cc->minRtt;
+}
+
+static void bbrInit(struct cc * cc)
+{
+   cc->cwnd = CC_INIT_WINDOW;
+   cc->state = BBR_STARTUP;
+   cc->minRtt = 0;
+}
+
+static void bbrAck(struct cc * cc, int acked, int64_t rtt, double rate, int newRound, uint64_t now)
+{
+   double target;
+   int i;
+
+   if (newRound)
+      cc->bw[cc->rounds % BBR_BW_ROUNDS] = 0;
+   if (rate > cc->bw[cc->rounds % BBR_BW_ROUNDS])
+      cc->bw[cc->rounds % BBR_BW_ROUNDS] = rate;
+
+   cc->btlBw = 0;
+   for (i = 0; i < BBR_BW_ROUNDS; i++)
+   {
+      if (cc->bw[i] > cc->btlBw)
+         cc->btlBw = cc->bw[i];
+   }
+
+   if (rtt > 0 && (cc->minRtt == 0 || rtt <= cc->minRtt))
+   {
+      cc->minRtt = rtt;
+      cc->minRttStamp = now;
+   }
+
+   if (cc->state == BBR_STARTUP)
+   {
+      if (newRound)
+      {
+         if (cc->btlBw >= cc->fullBw * 1.25)
+         {
+            cc->fullBw = cc->btlBw;
+            cc->fullBwRounds = 0;
+         }
+         else if (++cc->fullBwRounds >= 3)
+         {
+            cc->state = BBR_PROBE_BW;
+         }
+      }
+
+      cc->cwnd += acked;
+   }
+   else if (cc->state == BBR_PROBE_BW)
+   {
+      // no model yet (every packet so far was resent): keep growing
+      target = BBR_CWND_GAIN * bbrBdp(cc);
+      if (target == 0 || cc->cwnd < target)
+         cc->cwnd += acked;
+      if (target > 0 && cc->cwnd > target)
+         cc->cwnd = target;
+
+      if (cc->minRtt > 0 && now - cc->minRttStamp > BBR_RTT_WINDOW)
+      {
+         cc->state = BBR_PROBE_RTT;
+         cc->probeRttEnd = now + BBR_PROBE_RTT_TIME;
+         cc->minRtt = 0;
+      }
+   }
+   else if (now >= cc->probeRttEnd) // BBR_PROBE_RTT
+   {
+      cc->state = BBR_PROBE_BW;
+   }
+   else
+   {
+      cc->cwnd = BBR_MIN_WINDOW;
+   }
+
+   if (cc->cwnd < BBR_MIN_WINDOW)
+      cc->cwnd = BBR_MIN_WINDOW;
+}
+
+static void bbrTimeout(struct cc * cc)
+{
+   cc->cwnd = BBR_MIN_WINDOW;
+}
+
+static double bbrRate(struct cc * cc, int64_t srtt)
+{
+   if (cc->btlBw == 0)
+      return windowRate(cc, srtt);
+   if (cc->state == BBR_STARTUP)
+      return BBR_HIGH_GAIN * cc->btlBw;
+   if (cc->state == BBR_PROBE_RTT)
+      return cc->btlBw;
+
+   return bbrGains[cc->rounds % (sizeof(bbrGains) / sizeof(bbrGains[0]))] * cc->btlBw;
+}
+
+static struct ccOps ccAlgos[] = {
+   { "fixed", fixedInit, fixedAck, fixedLoss, fixedLoss, windowRate },
+   { "reno", renoInit, renoAck, renoLoss, renoTimeout, windowRate },
+   { "bbr", bbrInit, bbrAck, fixedLoss, bbrTimeout, bbrRate },
+};
+
+// Returns the controller called name, or NULL if there is none
+struct ccOps * findCc(char * name)
+{
+   int i;
+
+   for (i = 0; i < (int)(sizeof(ccAlgos) / sizeof(ccAlgos[0])); i++)
+   {
+      if (strcmp(ccAlgos[i].name, name) == 0)
+         return &ccAlgos[i];
+   }
+
+   return NULL;
+}
+
+void printCcNames(void)
+{
+   int i;
+
+   for (i = 0; i < (int)(sizeof(ccAlgos) / sizeof(ccAlgos[0])); i++)
+      fprintf(stderr, "%s%s", i ? "|" : "", ccAlgos[i].name);
+}
+
+void initCc(struct cc * cc, struct ccOps * ops, int max)
+{
+   memset(cc, 0, sizeof(struct cc));
+   cc->ops = ops != NULL ? ops : &ccAlgos[0];
+   cc->max = max;
+   cc->ops->init(cc);
+   clampWindow(cc);
+}
+
+// Packets that may be outstanding right now
+int ccWindow(struct cc * cc)
+{
+   return (int)cc->cwnd;
+}
+
+/*****
+ * An RR covered acked more packets. rtt is the round trip of the newest
+ * of them, or 0 if it was resent (Karn's rule). sentAt and deliveredAtSend
+ * are what that packet was stamped with when it was last sent, from which
+ * the delivery rate over its flight is worked out. A round ends once a
+ * packet sent after the previous round ended is acked.
+ ****/
+void ccAck(struct cc * cc, int acked, int64_t rtt, uint64_t sentAt, uint64_t deliveredAtSend, uint64_t now)
+{
+   double rate = 0;
+   int newRound = 0;
+
+   cc->delivered += acked;
+
+   if (now > sentAt && sentAt != 0)
+      rate = (double)(cc->delivered - deliveredAtSend) / (now - sentAt);
+
+   if (deliveredAtSend >= cc->roundEnd)
+   {
+      cc->roundEnd = cc->delivered;
+      cc->rounds++;
+      newRound = 1;
+   }
+
+   cc->ops->ack(cc, acked, rtt, rate, newRound, now);
+   clampWindow(cc);
+}
+
+/*****
+ * seq was lost. Only the first loss out of each window sent counts: next
+ * is one past the newest packet sent, and losses below it were already
+ * answered by the cut this one makes.
+ ****/
+void ccLoss(struct cc * cc, int32_t seq, int32_t next)
+{
+   cc->losses++;
+
+   if (seq < cc->recover)
+      return;
+
+   cc->recover = next;
+   cc->ops->loss(cc);
+   clampWindow(cc);
+}
+
+void ccTimeout(struct cc * cc, int32_t next)
+{
+   cc->timeouts++;
+   cc->recover = next;
+   cc->ops->timeout(cc);
+   clampWindow(cc);
+}
+
+// Packets per microsecond the connection should be paced at, 0 for no pacing
+double ccRate(struct cc * cc, int64_t srtt)
+{
+   return cc->ops->rate(cc, srtt);
+}
+
+void printCcStats(struct cc * cc)
+{
+   printf("CC %s cwnd %d of %d, %llu delivered in %u rounds (%u losses, %u timeouts)",
+      cc->ops->name, ccWindow(cc), cc->max, (unsigned long long)cc->delivered,
+      cc->rounds, cc->losses, cc->timeouts);
+   if (cc->btlBw > 0)
+      printf(", btlbw %.0f pkt/s min rtt %lld us", cc->btlBw * 1000000,
+         (long long)cc->minRtt);
+   printf("\n");
+}
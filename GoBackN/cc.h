@@ -0,0 +1,71 @@
+// Congestion control for the server's send window
+
+#ifndef __CC_H__
+#define __CC_H__
+
+#include <stdint.h>
+
+#define CC_MIN_WINDOW 2      // packets, never less than this after a loss
+#define CC_INIT_WINDOW 10    // packets, RFC 6928's initial window
+#define BBR_BW_ROUNDS 10     // rounds the bottleneck bandwidth is the max over
+#define BBR_RTT_WINDOW 10000000 // microseconds a min RTT stays good for
+
+struct cc;
+
+/*****
+ * One congestion controller. The server calls ack for every RR that covers
+ * new data, loss at most once per window of data (see ccLoss()) and
+ * timeout when the retransmit timer fires; each may move cwnd. rate is
+ * what the connection should be paced at, in packets per microsecond,
+ * given the smoothed RTT (0 if there is none yet).
+ ****/
+struct ccOps {
+   char * name;
+   void (*init)(struct cc * cc);
+   void (*ack)(struct cc * cc, int acked, int64_t rtt, double rate, int newRound, uint64_t now);
+   void (*loss)(struct cc * cc);
+   void (*timeout)(struct cc * cc);
+   double (*rate)(struct cc * cc, int64_t srtt);
+};
+
+/*****
+ * Per connection state. cwnd is in packets and is what the server may have
+ * outstanding, never more than max (the window the client asked for).
+ * delivered counts packets RR'd so far; each sent packet remembers it so
+ * the RR for that packet gives a delivery rate, which is what the BBR-like
+ * controller models the path with.
+ ****/
+struct cc {
+   struct ccOps * ops;
+   double cwnd;
+   double ssthresh;
+   int max;
+   int32_t recover;      // losses below this were in an already cut window
+   uint64_t delivered;
+   uint64_t roundEnd;    // delivered count that ends the current round
+   uint32_t rounds;
+   uint32_t losses;
+   uint32_t timeouts;
+
+   // BBR-like model
+   int state;
+   double bw[BBR_BW_ROUNDS]; // max delivery rate per round, packets/usec
+   double btlBw;
+   int64_t minRtt;
+   uint64_t minRttStamp;
+   uint64_t probeRttEnd;
+   double fullBw;
+   int fullBwRounds;
+};
+
+struct ccOps * findCc(char * name);
+void printCcNames(void);
+void initCc(struct cc * cc, struct ccOps * ops, int max);
+int ccWindow(struct cc * cc);
+void ccAck(struct cc * cc, int acked, int64_t rtt, uint64_t sentAt, uint64_t deliveredAtSend, uint64_t now);
+void ccLoss(struct cc * cc, int32_t seq, int32_t next);
+void ccTimeout(struct cc * cc, int32_t next);
+double ccRate(struct cc * cc, int64_t srtt);
+void printCcStats(struct cc * cc);
+
+#endif
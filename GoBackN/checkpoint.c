@@ -0,0 +1,117 @@
+// rcopy's restart checkpoints, so an aborted transfer can resume
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "checkpoint.h"
+
+void initCheckpoint(struct checkpoint * ckpt, char * local, char * remote, int stripe, int jobs)
+{
+   memset(ckpt, 0, sizeof(struct checkpoint));
+   ckpt->local = local;
+   ckpt->remote = remote;
+   ckpt->stripe = stripe;
+   ckpt->jobs = jobs;
+   ckpt->size = -1;
+
+   // each stripe keeps its own
+   if (jobs > 1)
+      snprintf(ckpt->path, CHECKPOINT_PATH, "%s.%d.ckpt", local, stripe);
+   else
+      snprintf(ckpt->path, CHECKPOINT_PATH, "%s.ckpt", local);
+}
+
+/*****
+ * Reads the checkpoint left by an earlier run. Returns 0 and sets offset
+ * and size if there is one for the same remote file and stripe, -1 (and
+ * leaves them at 0 and -1) if not. A checkpoint is no good once the output
+ * file it vouches for is gone or shorter than its offset: resuming would
+ * leave holes of zeros where that data was.
+ ****/
+int loadCheckpoint(struct checkpoint * ckpt)
+{
+   char remote[CHECKPOINT_PATH];
+   struct stat st;
+   long long offset;
+   long long size;
+   int stripe;
+   int jobs;
+   FILE * file;
+   int found;
+
+   if ((file = fopen(ckpt->path, "r")) == NULL)
+      return -1;
+
+   found = fscanf(file, "%lld %lld %d %d %127[^\n]", &offset, &size, &stripe, &jobs, remote);
+   fclose(file);
+
+   if (found != 5 || offset < 0 || stripe != ckpt->stripe || jobs != ckpt->jobs
+      || strcmp(remote, ckpt->remote) != 0)
+   {
+      return -1;
+   }
+
+   if (stat(ckpt->local, &st) < 0 || st.st_size < offset)
+   {
+      printf("Checkpoint %s ignored, %s does not hold its first %lld bytes\n", ckpt->path,
+         ckpt->local, offset);
+      return -1;
+   }
+
+   ckpt->offset = offset;
+   ckpt->size = size;
+   return 0;
+}
+
+/*****
+ * Records that everything before offset is in the output file fd. The
+ * data is synced first, and the checkpoint written to a temporary file and
+ * renamed over the old one, so a crash at any point leaves a checkpoint
+ * that is never ahead of the data. Returns 0, or -1 if it could not.
+ ****/
+int saveCheckpoint(struct checkpoint * ckpt, int fd, int64_t offset)
+{
+   char tmp[CHECKPOINT_PATH + 4];
+   FILE * file;
+   int failed;
+
+   if (fdatasync(fd) < 0)
+   {
+      perror("saveCheckpoint: fdatasync");
+      return -1;
+   }
+
+   snprintf(tmp, sizeof(tmp), "%s.tmp", ckpt->path);
+   if ((file = fopen(tmp, "w")) == NULL)
+   {
+      perror("saveCheckpoint: fopen");
+      return -1;
+   }
+
+   fprintf(file, "%lld %lld %d %d %s\n", (long long)offset, (long long)ckpt->size,
+      ckpt->stripe, ckpt->jobs, ckpt->remote);
+
+   failed = fflush(file) != 0 || fsync(fileno(file)) < 0;
+   if (fclose(file) != 0)
+      failed = 1;
+
+   if (failed || rename(tmp, ckpt->path) < 0)
+   {
+      perror("saveCheckpoint");
+      unlink(tmp);
+      return -1;
+   }
+
+   ckpt->offset = offset;
+   ckpt->saves++;
+   return 0;
+}
+
+// The transfer is complete, nothing is left to resume
+void removeCheckpoint(struct checkpoint * ckpt)
+{
+   unlink(ckpt->path);
+}
@@ -0,0 +1,36 @@
+// rcopy's restart checkpoints, so an aborted transfer can resume
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <stdint.h>
+
+#define CHECKPOINT_EVERY (16 * 1024 * 1024) // bytes written between saves
+#define CHECKPOINT_PATH 128
+
+/*****
+ * How much of one transfer (or of one stripe of it) is safely on disk.
+ * The checkpoint lives next to the output file, in path, as one line:
+ * the offset everything before which has been written and synced, the
+ * remote file's size, the stripe and stripe count, and the remote name.
+ * A later rcopy -c for the same remote file, stripe and size picks up at
+ * offset, as long as the output file, local, is still there and at least
+ * that long; anything else starts again from the beginning.
+ ****/
+struct checkpoint {
+   char path[CHECKPOINT_PATH];
+   char * local;
+   char * remote;
+   int stripe;
+   int jobs;
+   int64_t offset; // as of the last save (or load)
+   int64_t size;   // remote file size, -1 if the server did not say
+   uint64_t saves;
+};
+
+void initCheckpoint(struct checkpoint * ckpt, char * local, char * remote, int stripe, int jobs);
+int loadCheckpoint(struct checkpoint * ckpt);
+int saveCheckpoint(struct checkpoint * ckpt, int fd, int64_t offset);
+void removeCheckpoint(struct checkpoint * ckpt);
+
+#endif
@@ -0,0 +1,223 @@
+// Block framing for compressed transfers, with a bypass for data that will not compress
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "compress.h"
+#include "lz.h"
+
+static void putHeader(u_char * frame, uint32_t rawLen, uint32_t bodyLen)
+{
+   rawLen = htonl(rawLen);
+   bodyLen = htonl(bodyLen);
+   memcpy(frame, &rawLen, 4);
+   memcpy(frame + 4, &bodyLen, 4);
+}
+
+void initCompressor(struct compressor * zip)
+{
+   memset(zip, 0, sizeof(struct compressor));
+   zip->backoff = 1;
+
+   if ((zip->raw = malloc(COMPRESS_BLOCK)) == NULL
+      || (zip->frame = malloc(FRAME_HDR + COMPRESS_BLOCK)) == NULL)
+   {
+      perror("initCompressor: malloc");
+      exit(-1);
+   }
+}
+
+void freeCompressor(struct compressor * zip)
+{
+   free(zip->raw);
+   free(zip->frame);
+   zip->raw = NULL;
+   zip->frame = NULL;
+}
+
+// Where the next block (up to COMPRESS_BLOCK bytes) should be read to
+u_char * blockBuffer(struct compressor * zip)
+{
+   return zip->skip > 0 ? zip->frame + FRAME_HDR : zip->raw;
+}
+
+/*****
+ * Turns the rawLen bytes just read into blockBuffer() into the next frame,
+ * compressed if that saves enough and stored otherwise.
+ ****/
+void compressBlock(struct compressor * zip, int rawLen)
+{
+   int body = 0;
+
+   zip->blocks++;
+   zip->rawBytes += rawLen;
+
+   if (zip->skip > 0) {
+      zip->skip--;
+      zip->untried++;
+   } else if ((body = lzCompress(zip->raw, rawLen, zip->frame + FRAME_HDR,
+      rawLen - rawLen / COMPRESS_SAVING)) > 0)
+   {
+      zip->backoff = 1;
+   } else {
+      memcpy(zip->frame + FRAME_HDR, zip->raw, rawLen);
+      zip->skip = zip->backoff;
+      if (zip->backoff < COMPRESS_SKIP_MAX)
+         zip->backoff *= 2;
+   }
+
+   if (body > 0) {
+      putHeader(zip->frame, rawLen, body);
+   } else {
+      zip->stored++;
+      body = rawLen;
+      putHeader(zip->frame, rawLen, body | FRAME_STORED);
+   }
+
+   zip->len = FRAME_HDR + body;
+   zip->pos = 0;
+   zip->frameBytes += zip->len;
+}
+
+void printCompressStats(struct compressor * zip)
+{
+   printf("Compressed %llu bytes to %llu (%.2fx), %llu of %llu blocks stored,"
+      " %llu of them untried\n", (unsigned long long)zip->rawBytes,
+      (unsigned long long)zip->frameBytes,
+      zip->frameBytes ? (double)zip->rawBytes / zip->frameBytes : 0.0,
+      (unsigned long long)zip->stored, (unsigned long long)zip->blocks,
+      (unsigned long long)zip->untried);
+}
+
+void initDecompressor(struct decompressor * unzip)
+{
+   memset(unzip, 0, sizeof(struct decompressor));
+   unzip->need = FRAME_HDR;
+
+   if ((unzip->frame = malloc(FRAME_HDR + COMPRESS_BLOCK)) == NULL)
+   {
+      perror("initDecompressor: malloc");
+      exit(-1);
+   }
+}
+
+void freeDecompressor(struct decompressor * unzip)
+{
+   free(unzip->frame);
+   unzip->frame = NULL;
+}
+
+/*****
+ * The header of the frame being collected is in: checks it and works out
+ * how long the frame is. Returns 0, or -1 if it makes no sense.
+ ****/
+static int readHeader(struct decompressor * unzip)
+{
+   uint32_t rawLen;
+   uint32_t body;
+
+   memcpy(&rawLen, unzip->frame, 4);
+   memcpy(&body, unzip->frame + 4, 4);
+   rawLen = ntohl(rawLen);
+   body = ntohl(body);
+
+   if (rawLen == 0 || rawLen > COMPRESS_BLOCK)
+      return -1;
+
+   unzip->blocks++;
+   unzip->rawBytes += rawLen;
+   unzip->frameBytes += FRAME_HDR;
+
+   if (body & FRAME_STORED) {
+      if ((body & ~FRAME_STORED) != rawLen)
+         return -1;
+      unzip->stored++;
+      unzip->storedLeft = rawLen;
+      return 0;
+   }
+
+   if (body == 0 || body >= rawLen)
+      return -1;
+   unzip->need = FRAME_HDR + body;
+   return 0;
+}
+
+/*****
+ * Takes the next len bytes of frames, writing out each block as it
+ * completes. Returns 0, or -1 if a frame is malformed or a write failed.
+ ****/
+int takeFrames(struct decompressor * unzip, u_char * data, int len, struct writer * out)
+{
+   u_char * dst;
+   uint32_t rawLen;
+   int chunk;
+
+   while (len > 0)
+   {
+      if (unzip->storedLeft > 0) {
+         chunk = len < unzip->storedLeft ? len : unzip->storedLeft;
+         if (writeData(out, data, chunk) < 0)
+            return -1;
+         unzip->storedLeft -= chunk;
+         unzip->frameBytes += chunk;
+         data += chunk;
+         len -= chunk;
+         continue;
+      }
+
+      chunk = unzip->need - unzip->len;
+      if (chunk > len)
+         chunk = len;
+      memcpy(unzip->frame + unzip->len, data, chunk);
+      unzip->len += chunk;
+      data += chunk;
+      len -= chunk;
+
+      if (unzip->len < unzip->need)
+         break;
+
+      // a stored body passes straight through, a compressed one is
+      // collected after its header
+      if (unzip->need == FRAME_HDR) {
+         if (readHeader(unzip) < 0)
+            return -1;
+         if (unzip->storedLeft > 0)
+            unzip->len = 0;
+         continue;
+      }
+
+      // a whole compressed frame
+      memcpy(&rawLen, unzip->frame, 4);
+      rawLen = ntohl(rawLen);
+      if ((dst = reserveData(out, rawLen)) == NULL)
+         return -1;
+      if (lzDecompress(unzip->frame + FRAME_HDR, unzip->need - FRAME_HDR, dst, rawLen)
+         != (int)rawLen)
+      {
+         return -1;
+      }
+      commitData(out, rawLen);
+
+      unzip->frameBytes += unzip->need - FRAME_HDR;
+      unzip->len = 0;
+      unzip->need = FRAME_HDR;
+   }
+
+   return 0;
+}
+
+// No frame is part way through, as it should be at the EOF
+int framesDone(struct decompressor * unzip)
+{
+   return unzip->len == 0 && unzip->storedLeft == 0;
+}
+
+void printDecompressStats(struct decompressor * unzip)
+{
+   printf("Decompressed %llu bytes from %llu (%.2fx), %llu of %llu blocks stored\n",
+      (unsigned long long)unzip->rawBytes, (unsigned long long)unzip->frameBytes,
+      unzip->frameBytes ? (double)unzip->rawBytes / unzip->frameBytes : 0.0,
+      (unsigned long long)unzip->stored, (unsigned long long)unzip->blocks);
+}
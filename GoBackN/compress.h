@@ -0,0 +1,69 @@
+// Block framing for compressed transfers, with a bypass for data that will not compress
+
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "writer.h"
+
+#define COMPRESS_BLOCK (64 * 1024) // file bytes compressed at a time
+#define FRAME_HDR 8                // raw length, then body length
+#define FRAME_STORED 0x80000000U   // body length bit: the block is sent as it is
+#define COMPRESS_SAVING 8          // a block must shrink by 1/8th to be sent compressed
+#define COMPRESS_SKIP_MAX 32       // most blocks stored without trying, after misses
+
+/*****
+ * Server side. Each block of the file becomes a frame, a FRAME_HDR header
+ * and its body, and the frames are cut into packets in order. A block that
+ * does not shrink by 1/COMPRESS_SAVING is stored instead, and the block
+ * after a miss is stored without trying, then the next two, four and so on
+ * up to COMPRESS_SKIP_MAX, so a file that is already compressed costs one
+ * try every COMPRESS_SKIP_MAX blocks. A block that does compress starts the
+ * count again. blockBuffer() says where to read the next block: straight
+ * into the frame when it will be stored untried.
+ ****/
+struct compressor {
+   u_char * raw;
+   u_char * frame;
+   int len;     // bytes of frame
+   int pos;     // of them already cut into packets
+   int backoff; // blocks to store untried after the next miss
+   int skip;    // blocks still to store untried
+   uint64_t rawBytes;
+   uint64_t frameBytes;
+   uint64_t blocks;
+   uint64_t stored;
+   uint64_t untried;
+};
+
+/*****
+ * rcopy side. Packets are taken in order and their bytes collected into
+ * frames; each whole frame is decompressed straight into the writer's
+ * buffer. A stored body is copied to the writer as it arrives.
+ ****/
+struct decompressor {
+   u_char * frame;
+   int len;        // bytes of the frame collected so far
+   int need;       // bytes the frame takes, FRAME_HDR until its header is in
+   int storedLeft; // bytes of a stored body still to pass through
+   uint64_t rawBytes;
+   uint64_t frameBytes;
+   uint64_t blocks;
+   uint64_t stored;
+};
+
+void initCompressor(struct compressor * zip);
+void freeCompressor(struct compressor * zip);
+u_char * blockBuffer(struct compressor * zip);
+void compressBlock(struct compressor * zip, int rawLen);
+void printCompressStats(struct compressor * zip);
+
+void initDecompressor(struct decompressor * unzip);
+void freeDecompressor(struct decompressor * unzip);
+int takeFrames(struct decompressor * unzip, u_char * data, int len, struct writer * out);
+int framesDone(struct decompressor * unzip);
+void printDecompressStats(struct decompressor * unzip);
+
+#endif
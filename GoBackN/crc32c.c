@@ -0,0 +1,194 @@
+// CRC32C (Castagnoli), the optional per-packet integrity check
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC32C_X86 1
+#include <nmmintrin.h>
+#endif
+
+#include "crc32c.h"
+
+#define POLY 0x82f63b78 // reflected Castagnoli polynomial
+
+typedef uint32_t (*crcFn)(uint32_t crc, void * dst, const void * src, int len);
+
+static uint32_t table[8][256];
+
+static void initTable(void)
+{
+   uint32_t crc;
+   int i;
+   int j;
+
+   for (i = 0; i < 256; i++)
+   {
+      crc = i;
+      for (j = 0; j < 8; j++)
+         crc = (crc >> 1) ^ (crc & 1 ? POLY : 0);
+      table[0][i] = crc;
+   }
+
+   for (i = 0; i < 256; i++)
+   {
+      for (j = 1; j < 8; j++)
+         table[j][i] = (table[j - 1][i] >> 8) ^ table[0][table[j - 1][i] & 0xff];
+   }
+}
+
+/*****
+ * Slicing-by-8: one lookup in each of eight tables per 8 bytes. crc is
+ * the raw register (already inverted). dst may be NULL to only check.
+ ****/
+static uint32_t crcTable(uint32_t crc, void * dst, const void * src, int len)
+{
+   const u_char * p = src;
+   u_char * d = dst;
+   uint64_t w;
+
+   while (len >= 8)
+   {
+      memcpy(&w, p, 8);
+      if (d != NULL)
+      {
+         memcpy(d, &w, 8);
+         d += 8;
+      }
+      w ^= crc;
+      crc = table[7][w & 0xff] ^ table[6][(w >> 8) & 0xff]
+         ^ table[5][(w >> 16) & 0xff] ^ table[4][(w >> 24) & 0xff]
+         ^ table[3][(w >> 32) & 0xff] ^ table[2][(w >> 40) & 0xff]
+         ^ table[1][(w >> 48) & 0xff] ^ table[0][w >> 56];
+      p += 8;
+      len -= 8;
+   }
+
+   while (len-- > 0)
+   {
+      if (d != NULL)
+         *d++ = *p;
+      crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+   }
+
+   return crc;
+}
+
+#ifdef CRC32C_X86
+
+__attribute__((target("sse4.2")))
+static uint32_t crcSse42(uint32_t crc, void * dst, const void * src, int len)
+{
+   const u_char * p = src;
+   u_char * d = dst;
+   uint64_t c = crc;
+   uint64_t w;
+
+   while (len >= 8)
+   {
+      memcpy(&w, p, 8);
+      if (d != NULL)
+      {
+         memcpy(d, &w, 8);
+         d += 8;
+      }
+      c = _mm_crc32_u64(c, w);
+      p += 8;
+      len -= 8;
+   }
+
+   crc = (uint32_t)c;
+   while (len-- > 0)
+   {
+      if (d != NULL)
+         *d++ = *p;
+      crc = _mm_crc32_u8(crc, *p++);
+   }
+
+   return crc;
+}
+
+#endif
+
+static crcFn crcRun;
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+/*****
+ * Fills the tables and picks the version to use. Runs once, on the first
+ * CRC, through pthread_once() so server -t threads can all start with one.
+ ****/
+static void crcPick(void)
+{
+   char * force = getenv("CRC32C");
+   crcFn fn = crcTable;
+
+   initTable();
+
+#ifdef CRC32C_X86
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("sse4.2") && (force == NULL || strcmp(force, "table") != 0))
+      fn = crcSse42;
+#endif
+
+   crcRun = fn;
+}
+
+uint32_t crc32c(uint32_t crc, const void * buf, int len)
+{
+   pthread_once(&crcOnce, crcPick);
+   return ~crcRun(~crc, NULL, buf, len);
+}
+
+uint32_t crc32cCopy(uint32_t crc, void * dst, const void * src, int len)
+{
+   pthread_once(&crcOnce, crcPick);
+   return ~crcRun(~crc, dst, src, len);
+}
+
+/*****
+ * a * b modulo the polynomial, both reflected (the high bit is x^0), as in
+ * zlib's crc32_combine
+ ****/
+static uint32_t multModP(uint32_t a, uint32_t b)
+{
+   uint32_t m = 1U << 31;
+   uint32_t p = 0;
+
+   while (m != 0 && a != 0)
+   {
+      if (a & m)
+      {
+         p ^= b;
+         a ^= m;
+      }
+      m >>= 1;
+      b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+   }
+
+   return p;
+}
+
+// x^(8 * len) modulo the polynomial, by squaring: x^1, x^2, x^4 ...
+uint32_t crc32cShift(int len)
+{
+   uint32_t power = 1U << 30; // x^1
+   uint32_t p = 1U << 31;     // x^0
+   uint64_t n = (uint64_t)len * 8;
+
+   while (n != 0)
+   {
+      if (n & 1)
+         p = multModP(power, p);
+      power = multModP(power, power);
+      n >>= 1;
+   }
+
+   return p;
+}
+
+uint32_t crc32cCombine(uint32_t crcA, uint32_t crcB, uint32_t shift)
+{
+   return multModP(shift, crcA) ^ crcB;
+}
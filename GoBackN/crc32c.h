@@ -0,0 +1,26 @@
+// CRC32C (Castagnoli), the optional per-packet integrity check
+
+#ifndef __CRC32C_H__
+#define __CRC32C_H__
+
+#include <stdint.h>
+
+/*****
+ * Both take the CRC so far (0 to start) and return it updated, so a
+ * packet in several pieces can be checked by chaining calls. crc32cCopy()
+ * also copies the bytes from src to dst, which must not overlap, in the
+ * same pass. The SSE4.2 crc32 instruction is used when the CPU has it,
+ * otherwise a slicing-by-8 table; CRC32C=table forces the table.
+ ****/
+uint32_t crc32c(uint32_t crc, const void * buf, int len);
+uint32_t crc32cCopy(uint32_t crc, void * dst, const void * src, int len);
+
+/*****
+ * The CRC of A followed by B from crcA, crcB and shift = crc32cShift(the
+ * length of B), so a CRC kept for a payload can be joined to a header's
+ * without reading the payload again. Work out shift once per length.
+ ****/
+uint32_t crc32cShift(int len);
+uint32_t crc32cCombine(uint32_t crcA, uint32_t crcB, uint32_t shift);
+
+#endif
@@ -0,0 +1,711 @@
+// Block signatures and delta encoding, so an old copy only needs what changed
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "delta.h"
+
+#define PRIME1 11400714785074694791ULL
+#define PRIME2 14029467366897019727ULL
+#define PRIME3 1609587929392839161ULL
+#define PRIME4 9650029242287828579ULL
+#define PRIME5 2870177450012600261ULL
+
+#define FILTER_SHIFT 3 // the filter has 2^FILTER_SHIFT bits a bucket
+
+/*****
+ * rsync's rolling sum of a block x[0..len): a is the sum of its bytes and
+ * b the sum of each byte times how far it is from the end, so a and b for
+ * the window one byte on follow from the byte leaving and the one coming
+ * in (see makeDelta()). Both are kept mod 2^16 and packed as a | b << 16.
+ ****/
+static void rollingSums(const u_char * data, int len, uint32_t * a, uint32_t * b)
+{
+   int i;
+
+   *a = 0;
+   *b = 0;
+   for (i = 0; i < len; i++) {
+      *a += data[i];
+      *b += (uint32_t)(len - i) * data[i];
+   }
+}
+
+uint32_t weakSum(const u_char * data, int len)
+{
+   uint32_t a;
+   uint32_t b;
+
+   rollingSums(data, len, &a, &b);
+   return (a & 0xffff) | (b << 16);
+}
+
+static uint64_t rotl64(uint64_t v, int bits)
+{
+   return (v << bits) | (v >> (64 - bits));
+}
+
+static uint64_t read64le(const u_char * p)
+{
+   uint64_t v;
+
+   memcpy(&v, p, 8);
+   return le64toh(v);
+}
+
+static uint32_t read32le(const u_char * p)
+{
+   uint32_t v;
+
+   memcpy(&v, p, 4);
+   return le32toh(v);
+}
+
+static uint64_t xxRound(uint64_t acc, uint64_t in)
+{
+   return rotl64(acc + in * PRIME2, 31) * PRIME1;
+}
+
+static uint64_t xxMerge(uint64_t acc, uint64_t v)
+{
+   return (acc ^ xxRound(0, v)) * PRIME1 + PRIME4;
+}
+
+/*****
+ * XXH64 with seed 0, read little endian so both ends agree whatever the
+ * machine. Only a candidate the weak sum already matched is hashed.
+ ****/
+uint64_t strongSum(const u_char * data, int len)
+{
+   const u_char * p = data;
+   const u_char * end = data + len;
+   uint64_t v1 = PRIME1 + PRIME2;
+   uint64_t v2 = PRIME2;
+   uint64_t v3 = 0;
+   uint64_t v4 = -PRIME1;
+   uint64_t h;
+
+   if (len >= 32) {
+      for (; p + 32 <= end; p += 32) {
+         v1 = xxRound(v1, read64le(p));
+         v2 = xxRound(v2, read64le(p + 8));
+         v3 = xxRound(v3, read64le(p + 16));
+         v4 = xxRound(v4, read64le(p + 24));
+      }
+      h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+      h = xxMerge(h, v1);
+      h = xxMerge(h, v2);
+      h = xxMerge(h, v3);
+      h = xxMerge(h, v4);
+   } else {
+      h = PRIME5;
+   }
+
+   h += len;
+   for (; p + 8 <= end; p += 8)
+      h = rotl64(h ^ xxRound(0, read64le(p)), 27) * PRIME1 + PRIME4;
+   if (p + 4 <= end) {
+      h = rotl64(h ^ (uint64_t)read32le(p) * PRIME1, 23) * PRIME2 + PRIME3;
+      p += 4;
+   }
+   for (; p < end; p++)
+      h = rotl64(h ^ *p * PRIME5, 11) * PRIME1;
+
+   h ^= h >> 33;
+   h *= PRIME2;
+   h ^= h >> 29;
+   h *= PRIME3;
+   h ^= h >> 32;
+
+   return h;
+}
+
+// pread()s until len bytes are in or the file ends; returns how many, -1 on error
+static int readAll(int fd, u_char * buf, int len, off_t offset)
+{
+   int done = 0;
+   ssize_t ret;
+
+   while (done < len)
+   {
+      if ((ret = pread(fd, buf + done, len - done, offset + done)) < 0)
+         return -1;
+      if (ret == 0)
+         break;
+      done += ret;
+   }
+
+   return done;
+}
+
+/*****
+ * Sums every whole block of the file open on fd. The block size is the
+ * smallest power of two from DELTA_BLOCK_MIN whose square is at least the
+ * file's size (rsync's rule of thumb) and that keeps the blocks under
+ * DELTA_BLOCKS_MAX. Returns 0, or -1 if the file is too small or too big
+ * to be worth it, or cannot be read.
+ ****/
+int buildSignature(struct signature * sig, int fd)
+{
+   struct stat st;
+   u_char * buf;
+   int bufLen;
+   int want;
+   int i = 0;
+   int j;
+   off_t offset = 0;
+
+   memset(sig, 0, sizeof(struct signature));
+
+   if (fstat(fd, &st) < 0)
+      return -1;
+
+   sig->blockSize = DELTA_BLOCK_MIN;
+   while (sig->blockSize < DELTA_BLOCK_MAX && ((int64_t)sig->blockSize * sig->blockSize
+      < st.st_size || st.st_size / sig->blockSize > DELTA_BLOCKS_MAX))
+   {
+      sig->blockSize *= 2;
+   }
+   if (st.st_size < sig->blockSize || st.st_size / sig->blockSize > DELTA_BLOCKS_MAX)
+      return -1;
+   sig->blocks = st.st_size / sig->blockSize;
+
+   bufLen = sig->blockSize > DELTA_READ ? sig->blockSize : DELTA_READ;
+   if ((sig->sums = malloc(sig->blocks * sizeof(struct blockSum))) == NULL
+      || (buf = malloc(bufLen)) == NULL)
+   {
+      perror("buildSignature: malloc");
+      exit(-1);
+   }
+
+   while (i < sig->blocks)
+   {
+      want = bufLen;
+      if ((int64_t)(sig->blocks - i) * sig->blockSize < want)
+         want = (sig->blocks - i) * sig->blockSize;
+
+      if (readAll(fd, buf, want, offset) != want)
+      {
+         perror("buildSignature: pread");
+         free(buf);
+         freeSignature(sig);
+         return -1;
+      }
+
+      for (j = 0; j < want; j += sig->blockSize, i++) {
+         sig->sums[i].weak = weakSum(buf + j, sig->blockSize);
+         sig->sums[i].strong = strongSum(buf + j, sig->blockSize);
+      }
+      offset += want;
+   }
+
+   free(buf);
+   return 0;
+}
+
+int signaturePages(struct signature * sig, int perPage)
+{
+   return (sig->blocks + perPage - 1) / perPage;
+}
+
+// Writes page's sums, perPage to a page, to out and returns how many bytes
+int signaturePage(struct signature * sig, int page, int perPage, u_char * out)
+{
+   int first = page * perPage;
+   int n = sig->blocks - first < perPage ? sig->blocks - first : perPage;
+   uint32_t weak;
+   uint64_t strong;
+   int i;
+
+   for (i = 0; i < n; i++) {
+      weak = htonl(sig->sums[first + i].weak);
+      strong = htobe64(sig->sums[first + i].strong);
+      memcpy(out + i * DELTA_SUM_LEN, &weak, 4);
+      memcpy(out + i * DELTA_SUM_LEN + 4, &strong, 8);
+   }
+
+   return n * DELTA_SUM_LEN;
+}
+
+void freeSignature(struct signature * sig)
+{
+   free(sig->sums);
+   sig->sums = NULL;
+}
+
+/*****
+ * Sets up for a signature of blocks sums of blockSize byte blocks, sent in
+ * pages of as many sums as fit in payload bytes. Returns 0, or -1 (with
+ * nothing allocated) if the client asked for something out of bounds.
+ ****/
+int initDeltaSender(struct deltaSender * delta, int blockSize, int blocks, int payload)
+{
+   memset(delta, 0, sizeof(struct deltaSender));
+
+   if (blockSize < DELTA_BLOCK_MIN || blockSize > DELTA_BLOCK_MAX
+      || (blockSize & (blockSize - 1)) != 0 || blocks < 1 || blocks > DELTA_BLOCKS_MAX
+      || payload < DELTA_SUM_LEN)
+   {
+      return -1;
+   }
+
+   delta->blockSize = blockSize;
+   delta->blocks = blocks;
+   delta->perPage = payload / DELTA_SUM_LEN;
+   delta->pages = (blocks + delta->perPage - 1) / delta->perPage;
+   delta->last = -1;
+   for (delta->bits = 4; (1 << delta->bits) < 2 * blocks; delta->bits++)
+      ;
+
+   delta->cap = DELTA_LITERAL_MAX + blockSize + DELTA_READ;
+   // a packet's worth, and room for the op that takes it past that
+   delta->outCap = payload + 2 * DELTA_OP_LEN + DELTA_LITERAL_MAX;
+
+   if ((delta->sums = malloc(blocks * sizeof(struct blockSum))) == NULL
+      || (delta->heads = malloc((1 << delta->bits) * sizeof(int32_t))) == NULL
+      || (delta->chain = malloc(blocks * sizeof(int32_t))) == NULL
+      || (delta->filter = calloc(1 << (delta->bits + FILTER_SHIFT - 3), 1)) == NULL
+      || (delta->got = calloc(delta->pages, 1)) == NULL
+      || (delta->buf = malloc(delta->cap)) == NULL
+      || (delta->out = malloc(delta->outCap)) == NULL)
+   {
+      perror("initDeltaSender: malloc");
+      exit(-1);
+   }
+
+   return 0;
+}
+
+static uint32_t bucket(struct deltaSender * delta, uint32_t weak)
+{
+   return (weak * 2654435761U) >> (32 - delta->bits);
+}
+
+// Which of the filter's bits a weak sum sets
+static uint32_t filterBit(struct deltaSender * delta, uint32_t weak)
+{
+   return (weak * 2654435761U) >> (32 - FILTER_SHIFT - delta->bits);
+}
+
+/*****
+ * Chains every block into its weak sum's bucket, lowest index first, and
+ * sets its bit in the filter.
+ ****/
+static void indexSums(struct deltaSender * delta)
+{
+   uint32_t h;
+   int32_t i;
+
+   memset(delta->heads, 0xff, (1 << delta->bits) * sizeof(int32_t));
+   for (i = delta->blocks - 1; i >= 0; i--) {
+      h = bucket(delta, delta->sums[i].weak);
+      delta->chain[i] = delta->heads[h];
+      delta->heads[h] = i;
+
+      h = filterBit(delta, delta->sums[i].weak);
+      delta->filter[h >> 3] |= 1 << (h & 7);
+   }
+}
+
+/*****
+ * Stores one page of the signature. Returns 0, or -1 if there is no such
+ * page or it is the wrong length. The sums are indexed once the last one
+ * is in (missing == pages).
+ ****/
+int takePage(struct deltaSender * delta, int page, u_char * data, int len)
+{
+   int first = page * delta->perPage;
+   int n;
+   int i;
+   uint32_t weak;
+   uint64_t strong;
+
+   if (page < 0 || page >= delta->pages)
+      return -1;
+   n = delta->blocks - first < delta->perPage ? delta->blocks - first : delta->perPage;
+   if (len != n * DELTA_SUM_LEN)
+      return -1;
+   if (delta->got[page])
+      return 0;
+
+   for (i = 0; i < n; i++) {
+      memcpy(&weak, data + i * DELTA_SUM_LEN, 4);
+      memcpy(&strong, data + i * DELTA_SUM_LEN + 4, 8);
+      delta->sums[first + i].weak = ntohl(weak);
+      delta->sums[first + i].strong = be64toh(strong);
+   }
+
+   delta->got[page] = 1;
+   delta->have++;
+   while (delta->missing < delta->pages && delta->got[delta->missing])
+      delta->missing++;
+
+   if (delta->have == delta->pages)
+      indexSums(delta);
+
+   return 0;
+}
+
+/*****
+ * Where the next bytes of the file go and how many (*want) fit: the pending
+ * literal and the window are moved to the front of buf first.
+ ****/
+u_char * deltaSpace(struct deltaSender * delta, int * want)
+{
+   int keep = delta->len - delta->lit;
+
+   memmove(delta->buf, delta->buf + delta->lit, keep);
+   delta->pos -= delta->lit;
+   delta->len = keep;
+   delta->lit = 0;
+
+   *want = delta->cap - delta->len;
+   return delta->buf + delta->len;
+}
+
+// len bytes were read into deltaSpace(), 0 at the end of the file
+void deltaRead(struct deltaSender * delta, int len)
+{
+   if (len <= 0)
+      delta->eof = 1;
+   else
+      delta->len += len;
+}
+
+// Writes out the pending COPY run, if there is one
+static void putCopy(struct deltaSender * delta)
+{
+   u_char * op = delta->out + delta->outLen;
+   uint32_t field;
+
+   if (delta->runLen == 0)
+      return;
+
+   op[0] = DELTA_COPY;
+   field = htonl(delta->runStart);
+   memcpy(op + 1, &field, 4);
+   field = htonl(delta->runLen);
+   memcpy(op + 5, &field, 4);
+   delta->outLen += DELTA_OP_LEN;
+
+   delta->copies++;
+   delta->copied += (uint64_t)delta->runLen * delta->blockSize;
+   delta->runLen = 0;
+}
+
+// Writes [lit, end) as a LITERAL, at most DELTA_LITERAL_MAX bytes of it
+static void putLiteral(struct deltaSender * delta, int end)
+{
+   u_char * op;
+   uint32_t field;
+   int len = end - delta->lit;
+
+   if (len > DELTA_LITERAL_MAX)
+      len = DELTA_LITERAL_MAX;
+
+   putCopy(delta);
+   op = delta->out + delta->outLen;
+   op[0] = DELTA_LITERAL;
+   field = htonl(len);
+   memcpy(op + 1, &field, 4);
+   memcpy(op + 5, delta->buf + delta->lit, len);
+   delta->outLen += 5 + len;
+   delta->lit += len;
+
+   delta->literals++;
+   delta->literal += len;
+}
+
+// The block after the last match is tried first, so runs stay whole
+static int32_t findBlock(struct deltaSender * delta, uint32_t weak, const u_char * window)
+{
+   struct blockSum * sums = delta->sums;
+   int32_t next = delta->last + 1;
+   int32_t i;
+   uint64_t strong = 0;
+   int hashed = 0;
+
+   if (delta->last >= 0 && next < delta->blocks && sums[next].weak == weak) {
+      strong = strongSum(window, delta->blockSize);
+      hashed = 1;
+      if (sums[next].strong == strong)
+         return next;
+   }
+
+   for (i = delta->heads[bucket(delta, weak)]; i >= 0; i = delta->chain[i])
+   {
+      if (sums[i].weak != weak)
+         continue;
+      if (!hashed) {
+         strong = strongSum(window, delta->blockSize);
+         hashed = 1;
+      }
+      if (sums[i].strong == strong)
+         return i;
+   }
+
+   return -1;
+}
+
+/*****
+ * Rolls the window on a byte at a time until its weak sum's bit is set in
+ * the filter, or the window starts at stop. This is where a changed
+ * stretch of the file spends its time, so it is kept to the sums and one
+ * bit test a byte; the filter is sparse enough (at most one bit in 16
+ * set) that few windows go on to the buckets.
+ ****/
+static void rollOn(struct deltaSender * delta, int stop)
+{
+   const u_char * buf = delta->buf;
+   const u_char * filter = delta->filter;
+   uint32_t size = delta->blockSize;
+   uint32_t a = delta->a;
+   uint32_t b = delta->b;
+   uint32_t h;
+   int shift = 32 - FILTER_SHIFT - delta->bits;
+   int pos = delta->pos;
+
+   while (pos < stop)
+   {
+      a += buf[pos + size] - buf[pos];
+      b += a - size * buf[pos];
+      pos++;
+      h = (((a & 0xffff) | (b << 16)) * 2654435761U) >> shift;
+      if (filter[h >> 3] & (1 << (h & 7)))
+         break;
+   }
+
+   delta->scanned += pos - delta->pos;
+   delta->pos = pos;
+   delta->a = a;
+   delta->b = b;
+}
+
+/*****
+ * Scans on until out holds at least target bytes of ops, or the file has
+ * all been scanned. Returns how many bytes out holds, 0 once everything
+ * has gone, or DELTA_MORE if it needs more of the file (deltaSpace(),
+ * deltaRead()) first; what out already holds is kept until then. Ops also
+ * go out once DELTA_FLUSH bytes have been scanned, so a long unchanged
+ * stretch does not hold everything up.
+ ****/
+int makeDelta(struct deltaSender * delta, int target)
+{
+   int size = delta->blockSize;
+   int32_t block;
+   int stop;
+
+   if (delta->outPos == delta->outLen)
+      delta->outLen = delta->outPos = 0;
+
+   while (delta->outLen < target && !delta->done)
+   {
+      // the window has to be able to roll on a byte, except at the end
+      if (!delta->eof && delta->len - delta->pos <= size)
+         return DELTA_MORE;
+
+      if (delta->scanned >= DELTA_FLUSH) {
+         delta->scanned = 0;
+         putCopy(delta);
+         if (delta->pos > delta->lit)
+            putLiteral(delta, delta->pos);
+         if (delta->outLen > 0)
+            break;
+         continue;
+      }
+
+      // less than a block left: it all goes as literals
+      if (delta->len - delta->pos < size) {
+         delta->pos = delta->len;
+         if (delta->lit < delta->len) {
+            putLiteral(delta, delta->len);
+            continue;
+         }
+         putCopy(delta);
+         delta->done = 1;
+         break;
+      }
+
+      if (!delta->rolled) {
+         rollingSums(delta->buf + delta->pos, size, &delta->a, &delta->b);
+         delta->rolled = 1;
+      }
+
+      block = findBlock(delta, (delta->a & 0xffff) | (delta->b << 16),
+         delta->buf + delta->pos);
+      if (block >= 0) {
+         if (delta->pos > delta->lit)
+            putLiteral(delta, delta->pos);
+         if (delta->runLen > 0 && block == delta->runStart + delta->runLen) {
+            delta->runLen++;
+         } else {
+            putCopy(delta);
+            delta->runStart = block;
+            delta->runLen = 1;
+         }
+         delta->last = block;
+         delta->pos += size;
+         delta->lit = delta->pos;
+         delta->rolled = 0;
+         delta->scanned += size;
+         continue;
+      }
+
+      // the last window of the file, nothing to roll on to
+      if (delta->len - delta->pos == size) {
+         delta->pos = delta->len;
+         continue;
+      }
+
+      if (delta->pos - delta->lit == DELTA_LITERAL_MAX)
+         putLiteral(delta, delta->pos);
+
+      // no further than the buffer lets the window go, or a whole literal
+      stop = delta->len - size;
+      if (stop > delta->lit + DELTA_LITERAL_MAX)
+         stop = delta->lit + DELTA_LITERAL_MAX;
+      rollOn(delta, stop);
+   }
+
+   return delta->outLen;
+}
+
+void printDeltaStats(struct deltaSender * delta)
+{
+   printf("Delta %llu bytes as %llu COPYs, %llu bytes as %llu LITERALs"
+      " (%d blocks of %d bytes)\n", (unsigned long long)delta->copied,
+      (unsigned long long)delta->copies, (unsigned long long)delta->literal,
+      (unsigned long long)delta->literals, delta->blocks, delta->blockSize);
+}
+
+void freeDeltaSender(struct deltaSender * delta)
+{
+   free(delta->sums);
+   free(delta->heads);
+   free(delta->chain);
+   free(delta->filter);
+   free(delta->got);
+   free(delta->buf);
+   free(delta->out);
+   memset(delta, 0, sizeof(struct deltaSender));
+}
+
+void initDeltaReceiver(struct deltaReceiver * delta, int basis, int blockSize, int blocks)
+{
+   memset(delta, 0, sizeof(struct deltaReceiver));
+   delta->basis = basis;
+   delta->blockSize = blockSize;
+   delta->blocks = blocks;
+}
+
+/*****
+ * COPY: reads count blocks of the old copy from block index on straight
+ * into the writer's buffer. Returns 0, or -1 if they are not all in the
+ * signature or could not be read or written.
+ ****/
+static int copyBlocks(struct deltaReceiver * delta, uint32_t index, uint32_t count,
+   struct writer * out)
+{
+   off_t offset = (off_t)index * delta->blockSize;
+   int64_t left = (int64_t)count * delta->blockSize;
+   u_char * dst;
+   int chunk;
+
+   if (count == 0 || index >= (uint32_t)delta->blocks || count > delta->blocks - index)
+      return -1;
+
+   while (left > 0)
+   {
+      chunk = left < out->cap ? left : out->cap;
+      if ((dst = reserveData(out, chunk)) == NULL)
+         return -1;
+      if (readAll(delta->basis, dst, chunk, offset) != chunk)
+      {
+         perror("copyBlocks: pread");
+         return -1;
+      }
+      commitData(out, chunk);
+
+      offset += chunk;
+      left -= chunk;
+      delta->copied += chunk;
+   }
+
+   return 0;
+}
+
+/*****
+ * Takes the next len bytes of ops, writing out what each one says as soon
+ * as its header is in. Returns 0, or -1 if an op is malformed or the old
+ * copy or the output failed.
+ ****/
+int takeDelta(struct deltaReceiver * delta, u_char * data, int len, struct writer * out)
+{
+   uint32_t field;
+   uint32_t count;
+   int need;
+   int chunk;
+
+   while (len > 0)
+   {
+      if (delta->literalLeft > 0) {
+         chunk = len < delta->literalLeft ? len : delta->literalLeft;
+         if (writeData(out, data, chunk) < 0)
+            return -1;
+         delta->literalLeft -= chunk;
+         delta->literal += chunk;
+         data += chunk;
+         len -= chunk;
+         continue;
+      }
+
+      if (delta->opLen == 0 && data[0] != DELTA_COPY && data[0] != DELTA_LITERAL)
+         return -1;
+      need = (delta->opLen > 0 ? delta->op[0] : data[0]) == DELTA_COPY ? DELTA_OP_LEN : 5;
+
+      chunk = need - delta->opLen;
+      if (chunk > len)
+         chunk = len;
+      memcpy(delta->op + delta->opLen, data, chunk);
+      delta->opLen += chunk;
+      data += chunk;
+      len -= chunk;
+
+      if (delta->opLen < need)
+         break;
+      delta->opLen = 0;
+
+      memcpy(&field, delta->op + 1, 4);
+      field = ntohl(field);
+
+      if (delta->op[0] == DELTA_LITERAL) {
+         if (field == 0 || field > DELTA_LITERAL_MAX)
+            return -1;
+         delta->literalLeft = field;
+         continue;
+      }
+
+      memcpy(&count, delta->op + 5, 4);
+      if (copyBlocks(delta, field, ntohl(count), out) < 0)
+         return -1;
+   }
+
+   return 0;
+}
+
+// No op is part way through, as it should be at the EOF
+int deltaDone(struct deltaReceiver * delta)
+{
+   return delta->opLen == 0 && delta->literalLeft == 0;
+}
+
+void printDeltaReceived(struct deltaReceiver * delta)
+{
+   printf("Delta %llu bytes from the old copy, %llu bytes sent\n",
+      (unsigned long long)delta->copied, (unsigned long long)delta->literal);
+}
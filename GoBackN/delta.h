@@ -0,0 +1,126 @@
+// Block signatures and delta encoding, so an old copy only needs what changed
+
+#ifndef __DELTA_H__
+#define __DELTA_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "writer.h"
+
+#define DELTA_SUM_LEN 12            // one block's sums on the wire: weak (4), strong (8)
+#define DELTA_BLOCK_MIN 1024        // block size bounds, powers of two
+#define DELTA_BLOCK_MAX (1024 * 1024)
+#define DELTA_BLOCKS_MAX (1 << 20)  // most blocks a signature may have
+#define DELTA_LITERAL_MAX (64 * 1024) // longest LITERAL op
+#define DELTA_READ (256 * 1024)     // file bytes read at a time
+#define DELTA_FLUSH (4 * 1024 * 1024) // bytes scanned before pending ops go out anyway
+#define DELTA_MORE -1               // makeDelta(): read more of the file first
+
+// Ops, one type byte and then network order fields
+#define DELTA_COPY 1     // block index (4), block count (4): blocks of the old copy
+#define DELTA_LITERAL 2  // length (4), then that many bytes of the new file
+#define DELTA_OP_LEN 9   // longest op header
+
+struct blockSum {
+   uint32_t weak;   // rolling sum, see weakSum()
+   uint64_t strong; // XXH64 of the block
+};
+
+/*****
+ * rcopy side: the sums of every whole block of the old copy. The block
+ * size grows with the file (about its square root, a power of two) so the
+ * signature stays small; a tail shorter than a block is left out.
+ ****/
+struct signature {
+   struct blockSum * sums;
+   int blockSize;
+   int blocks;
+};
+
+/*****
+ * Server side. The signature arrives a page of sums at a time, in any
+ * order (got, have counts them). Once it is all in, the sums are hashed
+ * by their weak sum and the file is scanned through buf: a block that
+ * matches one of the old copy's, weak sum first and then strong hash,
+ * becomes a COPY (runs of consecutive blocks coalesce into one), and the
+ * bytes between matches become LITERALs. [lit, pos) is the literal so far
+ * and [pos, pos + blockSize) the window the weak sum rolls over, a byte at
+ * a time while nothing matches. The ops collect in out to be cut into
+ * packets.
+ ****/
+struct deltaSender {
+   struct blockSum * sums;
+   int32_t * heads;  // first block in each bucket, -1 if none
+   int32_t * chain;  // next block in the same bucket
+   int bits;         // log2 of the buckets
+   u_char * filter;  // a bit per weak sum hash, 8 times as many as buckets
+   int blockSize;
+   int blocks;
+   int perPage;      // sums in one page
+   int pages;
+   u_char * got;     // pages that have arrived
+   int have;
+   int missing;      // first page still to come
+   u_char * buf;
+   int cap;
+   int len;
+   int pos;
+   int lit;
+   uint32_t a;       // the window's weak sum, in halves, while rolled
+   uint32_t b;
+   int rolled;
+   int eof;
+   int done;
+   int32_t last;     // block matched last, -1 before any
+   int32_t runStart; // COPY run not yet written, runLen 0 if none
+   int32_t runLen;
+   int64_t scanned;  // since ops last went out
+   u_char * out;
+   int outCap;
+   int outLen;
+   int outPos;       // of them already cut into packets
+   uint64_t copied;  // bytes sent as COPYs
+   uint64_t literal; // bytes sent as LITERALs
+   uint64_t copies;
+   uint64_t literals;
+};
+
+/*****
+ * rcopy side: the ops as they arrive in order. A COPY is read out of the
+ * old copy (basis) straight into the writer's buffer, a LITERAL is passed
+ * through as it comes.
+ ****/
+struct deltaReceiver {
+   int basis;
+   int blockSize;
+   int blocks;
+   u_char op[DELTA_OP_LEN];
+   int opLen;       // bytes of the op header collected so far
+   uint32_t literalLeft;
+   uint64_t copied;
+   uint64_t literal;
+};
+
+uint32_t weakSum(const u_char * data, int len);
+uint64_t strongSum(const u_char * data, int len);
+
+int buildSignature(struct signature * sig, int fd);
+int signaturePages(struct signature * sig, int perPage);
+int signaturePage(struct signature * sig, int page, int perPage, u_char * out);
+void freeSignature(struct signature * sig);
+
+int initDeltaSender(struct deltaSender * delta, int blockSize, int blocks, int payload);
+int takePage(struct deltaSender * delta, int page, u_char * data, int len);
+u_char * deltaSpace(struct deltaSender * delta, int * want);
+void deltaRead(struct deltaSender * delta, int len);
+int makeDelta(struct deltaSender * delta, int target);
+void printDeltaStats(struct deltaSender * delta);
+void freeDeltaSender(struct deltaSender * delta);
+
+void initDeltaReceiver(struct deltaReceiver * delta, int basis, int blockSize, int blocks);
+int takeDelta(struct deltaReceiver * delta, u_char * data, int len, struct writer * out);
+int deltaDone(struct deltaReceiver * delta);
+void printDeltaReceived(struct deltaReceiver * delta);
+
+#endif
@@ -49,38 +49,360 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <sys/types.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CKSUM_X86 1
+#include <immintrin.h>
+#endif
+
 /*
- * in_cksum --
- *      Checksum routine for Internet Protocol family headers (C Version)
+ * The sum behind in_cksum comes in a few versions picked at run time.
+ * They all add up the same 16 bit words in a different order, and a ones'
+ * complement sum does not care about order, so every version folds down to
+ * exactly the same 16 bits.  Each returns the folded sum before the final
+ * complement.
  */
-unsigned short in_cksum(unsigned short *addr,int len)
+typedef u_short (*cksum_sum_fn)(const void *addr, int len);
+
+/*
+ * The copying versions behind in_cksum_copy: copy len bytes from src to
+ * dst and return the folded sum of them, reading each byte only once.
+ */
+typedef u_short (*cksum_copy_fn)(void *dst, const void *src, int len);
+
+static u_short fold64(uint64_t sum)
+{
+        while (sum >> 16)
+                sum = (sum & 0xffff) + (sum >> 16);
+        return (u_short)sum;
+}
+
+/* the original loop, 16 bits at a time */
+static u_short sum_scalar16(const void *addr, int len)
 {
-        register int sum = 0;
-        u_short answer = 0;
-        register u_short *w = addr;
-        register int nleft = len;
-
-        /*
-         * Our algorithm is simple, using a 32 bit accumulator (sum), we add
-         * sequential 16 bit words to it, and at the end, fold back all the
-         * carry bits from the top 16 bits into the lower 16 bits.
-         */
-        while (nleft > 1)  {
-                sum += *w++;
-                nleft -= 2;
+        uint64_t sum = 0;
+        const u_char *p = addr;
+        u_short w = 0;
+
+        while (len > 1)  {
+                memcpy(&w, p, 2);
+                sum += w;
+                p += 2;
+                len -= 2;
         }
 
         /* mop up an odd byte, if necessary */
-        if (nleft == 1) {
-                *(u_char *)(&answer) = *(u_char *)w ;
-                sum += answer;
+        if (len == 1) {
+                w = 0;
+                *(u_char *)(&w) = *p;
+                sum += w;
         }
 
-        /* add back carry outs from top 16 bits to low 16 bits */
-        sum = (sum >> 16) + (sum & 0xffff);     /* add hi 16 to low 16 */
-        sum += (sum >> 16);                     /* add carry */
-        answer = ~sum;                          /* truncate to 16 bits */
-        return(answer);
+        return fold64(sum);
+}
+
+/*
+ * 64 bits at a time.  The two 32 bit halves of each word go into a 64 bit
+ * accumulator, which cannot overflow for any int length.
+ */
+static u_short sum_scalar64(const void *addr, int len)
+{
+        uint64_t sum = 0;
+        uint64_t w;
+        const u_char *p = addr;
+
+        while (len >= 8) {
+                memcpy(&w, p, 8);
+                sum += (w & 0xffffffff) + (w >> 32);
+                p += 8;
+                len -= 8;
+        }
+
+        sum += sum_scalar16(p, len);
+        return fold64(sum);
+}
+
+/* not fused: copy, then sum the copy.  The reference for the others. */
+static u_short copy_scalar16(void *dst, const void *src, int len)
+{
+        memcpy(dst, src, len);
+        return sum_scalar16(dst, len);
+}
+
+static u_short copy_scalar64(void *dst, const void *src, int len)
+{
+        uint64_t sum = 0;
+        uint64_t w;
+        u_char *d = dst;
+        const u_char *p = src;
+
+        while (len >= 8) {
+                memcpy(&w, p, 8);
+                memcpy(d, &w, 8);
+                sum += (w & 0xffffffff) + (w >> 32);
+                p += 8;
+                d += 8;
+                len -= 8;
+        }
+
+        memcpy(d, p, len);
+        sum += sum_scalar16(d, len);
+        return fold64(sum);
+}
+
+#ifdef CKSUM_X86
+
+/*
+ * 16 bytes at a time.  The 16 bit words are widened into 32 bit lanes, so
+ * the lanes are emptied into a 64 bit total every 32K blocks (512KB),
+ * well before they could overflow.
+ */
+__attribute__((target("sse2")))
+static u_short sum_sse2(const void *addr, int len)
+{
+        const u_char *p = addr;
+        const __m128i zero = _mm_setzero_si128();
+        uint64_t sum = 0;
+        uint32_t lanes[4];
+        int blocks;
+
+        while (len >= 16) {
+                __m128i acc = _mm_setzero_si128();
+
+                for (blocks = 0; len >= 16 && blocks < 32768; blocks++) {
+                        __m128i v = _mm_loadu_si128((const __m128i *)p);
+                        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+                        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+                        p += 16;
+                        len -= 16;
+                }
+
+                _mm_storeu_si128((__m128i *)lanes, acc);
+                sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+
+        sum += sum_scalar16(p, len);
+        return fold64(sum);
+}
+
+/* sum_sse2 that stores each block to dst as it goes */
+__attribute__((target("sse2")))
+static u_short copy_sse2(void *dst, const void *src, int len)
+{
+        u_char *d = dst;
+        const u_char *p = src;
+        const __m128i zero = _mm_setzero_si128();
+        uint64_t sum = 0;
+        uint32_t lanes[4];
+        int blocks;
+
+        while (len >= 16) {
+                __m128i acc = _mm_setzero_si128();
+
+                for (blocks = 0; len >= 16 && blocks < 32768; blocks++) {
+                        __m128i v = _mm_loadu_si128((const __m128i *)p);
+                        _mm_storeu_si128((__m128i *)d, v);
+                        acc = _mm_add_epi32(acc, _mm_unpacklo_epi16(v, zero));
+                        acc = _mm_add_epi32(acc, _mm_unpackhi_epi16(v, zero));
+                        p += 16;
+                        d += 16;
+                        len -= 16;
+                }
+
+                _mm_storeu_si128((__m128i *)lanes, acc);
+                sum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+
+        sum += copy_scalar64(d, p, len);
+        return fold64(sum);
+}
+
+/* the same with 32 byte blocks */
+__attribute__((target("avx2")))
+static u_short sum_avx2(const void *addr, int len)
+{
+        const u_char *p = addr;
+        const __m256i zero = _mm256_setzero_si256();
+        uint64_t sum = 0;
+        uint32_t lanes[8];
+        int blocks;
+        int i;
+
+        while (len >= 32) {
+                __m256i acc = _mm256_setzero_si256();
+
+                for (blocks = 0; len >= 32 && blocks < 32768; blocks++) {
+                        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+                        acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+                        acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+                        p += 32;
+                        len -= 32;
+                }
+
+                _mm256_storeu_si256((__m256i *)lanes, acc);
+                for (i = 0; i < 8; i++)
+                        sum += lanes[i];
+        }
+
+        /* not sum_sse2: mixing legacy SSE code into AVX code stalls */
+        sum += sum_scalar64(p, len);
+        return fold64(sum);
+}
+
+__attribute__((target("avx2")))
+static u_short copy_avx2(void *dst, const void *src, int len)
+{
+        u_char *d = dst;
+        const u_char *p = src;
+        const __m256i zero = _mm256_setzero_si256();
+        uint64_t sum = 0;
+        uint32_t lanes[8];
+        int blocks;
+        int i;
+
+        while (len >= 32) {
+                __m256i acc = _mm256_setzero_si256();
+
+                for (blocks = 0; len >= 32 && blocks < 32768; blocks++) {
+                        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+                        _mm256_storeu_si256((__m256i *)d, v);
+                        acc = _mm256_add_epi32(acc, _mm256_unpacklo_epi16(v, zero));
+                        acc = _mm256_add_epi32(acc, _mm256_unpackhi_epi16(v, zero));
+                        p += 32;
+                        d += 32;
+                        len -= 32;
+                }
+
+                _mm256_storeu_si256((__m256i *)lanes, acc);
+                for (i = 0; i < 8; i++)
+                        sum += lanes[i];
+        }
+
+        sum += copy_scalar64(d, p, len);
+        return fold64(sum);
+}
+
+#endif
+
+static cksum_sum_fn cksum_sum;
+static cksum_copy_fn cksum_copy;
+static pthread_once_t cksum_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Runs once, on the first checksum, through pthread_once() so threads
+ * that all start summing at once agree on it: picks the widest versions
+ * this CPU supports.  CPE464_CKSUM=scalar16|scalar64|sse2|avx2 forces
+ * one, for comparing them.
+ */
+static void cksum_pick(void)
+{
+        const char *force = getenv("CPE464_CKSUM");
+        cksum_sum_fn fn = sum_scalar64;
+        cksum_copy_fn copy = copy_scalar64;
+
+#ifdef CKSUM_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+                fn = sum_avx2;
+                copy = copy_avx2;
+        } else if (__builtin_cpu_supports("sse2")) {
+                fn = sum_sse2;
+                copy = copy_sse2;
+        }
+#endif
+
+        if (force != NULL) {
+                if (strcmp(force, "scalar16") == 0) {
+                        fn = sum_scalar16;
+                        copy = copy_scalar16;
+                } else if (strcmp(force, "scalar64") == 0) {
+                        fn = sum_scalar64;
+                        copy = copy_scalar64;
+                }
+#ifdef CKSUM_X86
+                else if (strcmp(force, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+                        fn = sum_sse2;
+                        copy = copy_sse2;
+                } else if (strcmp(force, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+                        fn = sum_avx2;
+                        copy = copy_avx2;
+                }
+#endif
+        }
+
+        cksum_sum = fn;
+        cksum_copy = copy;
+}
+
+/*
+ * in_cksum --
+ *      Checksum routine for Internet Protocol family headers (C Version)
+ */
+unsigned short in_cksum(unsigned short *addr,int len)
+{
+        pthread_once(&cksum_once, cksum_pick);
+        return (unsigned short)~cksum_sum(addr, len);
+}
+
+/*
+ * in_cksum_add --
+ *      Adds len bytes at addr to a running sum, for packets that are not
+ *      contiguous in memory (a header in one buffer, the payload in
+ *      another).  offset is where addr falls in the packet: bytes at an odd
+ *      offset land in the other half of each 16 bit word, so their sum is
+ *      byte swapped before it is added (RFC 1071).  An odd trailing byte is
+ *      padded with zero, which is right as long as the next piece is added
+ *      with its own (odd) offset.
+ */
+unsigned int in_cksum_add(unsigned int sum, const void *addr, int len, int offset)
+{
+        unsigned int part;
+
+        pthread_once(&cksum_once, cksum_pick);
+        part = cksum_sum(addr, len);
+
+        if (offset & 1)
+                part = ((part & 0xff) << 8) | (part >> 8);
+
+        sum += part;
+        sum = (sum >> 16) + (sum & 0xffff);
+        return sum;
+}
+
+/*
+ * in_cksum_copy --
+ *      in_cksum_add for bytes that are also being copied: copies len bytes
+ *      from src to dst (which must not overlap) and adds them to the sum in
+ *      the same pass, so the data is only read once.  offset is where dst
+ *      falls in the packet, as for in_cksum_add.
+ */
+unsigned int in_cksum_copy(unsigned int sum, void *dst, const void *src, int len, int offset)
+{
+        unsigned int part;
+
+        pthread_once(&cksum_once, cksum_pick);
+        part = cksum_copy(dst, src, len);
+
+        if (offset & 1)
+                part = ((part & 0xff) << 8) | (part >> 8);
+
+        sum += part;
+        sum = (sum >> 16) + (sum & 0xffff);
+        return sum;
+}
+
+/*
+ * in_cksum_fold --
+ *      Finishes a sum built with in_cksum_add, giving what in_cksum would
+ *      have returned for the whole packet.
+ */
+unsigned short in_cksum_fold(unsigned int sum)
+{
+        sum = (sum >> 16) + (sum & 0xffff);
+        sum += (sum >> 16);
+        return (unsigned short)~sum;
 }
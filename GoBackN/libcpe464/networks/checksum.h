@@ -14,6 +14,9 @@ extern "C" {
 #endif
 
 unsigned short in_cksum(unsigned short *addr, int len);
+unsigned int in_cksum_add(unsigned int sum, const void *addr, int len, int offset);
+unsigned int in_cksum_copy(unsigned int sum, void *dst, const void *src, int len, int offset);
+unsigned short in_cksum_fold(unsigned int sum);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,230 @@
+// Small LZ77 block codec (LZ4's block format) for compressed transfers
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+static uint32_t read32(const u_char * p)
+{
+   uint32_t v;
+
+   memcpy(&v, p, 4);
+   return v;
+}
+
+static uint64_t read64(const u_char * p)
+{
+   uint64_t v;
+
+   memcpy(&v, p, 8);
+   return v;
+}
+
+static uint32_t hash4(uint32_t v)
+{
+   return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// The bytes of 255 (and the remainder) that carry a length past its nibble
+static u_char * putLength(u_char * op, u_char * oend, int len)
+{
+   for (; len >= 255; len -= 255) {
+      if (op >= oend)
+         return NULL;
+      *op++ = 255;
+   }
+
+   if (op >= oend)
+      return NULL;
+   *op++ = len;
+
+   return op;
+}
+
+/*****
+ * Writes one sequence: a token (literal length, match length - 4, a nibble
+ * each, 15 meaning more bytes follow), the literals, and unless this is
+ * the last sequence (matchLen 0) the match's two byte offset. Returns the
+ * end of what it wrote, or NULL if it does not fit before oend.
+ ****/
+static u_char * putSequence(u_char * op, u_char * oend, const u_char * lit, int litLen,
+   int offset, int matchLen)
+{
+   u_char * token;
+   int ml = matchLen - LZ_MIN_MATCH;
+
+   if (op >= oend)
+      return NULL;
+   token = op++;
+   *token = (litLen >= 15 ? 15 : litLen) << 4;
+
+   if (litLen >= 15 && (op = putLength(op, oend, litLen - 15)) == NULL)
+      return NULL;
+   if (oend - op < litLen)
+      return NULL;
+   memcpy(op, lit, litLen);
+   op += litLen;
+
+   if (matchLen == 0)
+      return op;
+
+   if (oend - op < 2)
+      return NULL;
+   *op++ = offset & 0xff;
+   *op++ = offset >> 8;
+
+   *token |= ml >= 15 ? 15 : ml;
+   if (ml >= 15 && (op = putLength(op, oend, ml - 15)) == NULL)
+      return NULL;
+
+   return op;
+}
+
+/*****
+ * Compresses len bytes of src into at most cap bytes of dst and returns
+ * how many that took, or 0 if it would take more than cap. Matches are
+ * found through a hash of the next four bytes, greedily; every 64 places
+ * in a row without one the search steps a byte further, so data that does
+ * not compress is crossed quickly, and a cap below len stops it as soon as
+ * the output is not going to be worth it.
+ ****/
+int lzCompress(const u_char * src, int len, u_char * dst, int cap)
+{
+   int32_t table[1 << LZ_HASH_BITS];
+   const u_char * ip = src;
+   const u_char * anchor = src;
+   const u_char * end = src + len;
+   const u_char * limit = end - LZ_MATCH_LIMIT;
+   const u_char * matchEnd = end - LZ_LAST_LITERALS;
+   const u_char * ref;
+   const u_char * mp;
+   const u_char * rp;
+   u_char * op = dst;
+   u_char * oend = dst + cap;
+   uint32_t seq;
+   uint32_t h;
+   int misses = 0;
+
+   memset(table, 0, sizeof(table));
+
+   while (len > LZ_MATCH_LIMIT && ip < limit)
+   {
+      seq = read32(ip);
+      h = hash4(seq);
+      ref = src + table[h];
+      table[h] = ip - src;
+
+      if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != seq) {
+         ip += 1 + (misses++ >> 6);
+         continue;
+      }
+      misses = 0;
+
+      // take in any matching bytes just before, then as far on as it goes
+      while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+         ip--;
+         ref--;
+      }
+      mp = ip + LZ_MIN_MATCH;
+      rp = ref + LZ_MIN_MATCH;
+      while (mp + 8 <= matchEnd && read64(mp) == read64(rp)) {
+         mp += 8;
+         rp += 8;
+      }
+      while (mp < matchEnd && *mp == *rp) {
+         mp++;
+         rp++;
+      }
+
+      if ((op = putSequence(op, oend, anchor, ip - anchor, ip - ref, mp - ip)) == NULL)
+         return 0;
+
+      ip = anchor = mp;
+      if (ip - 2 < limit)
+         table[hash4(read32(ip - 2))] = ip - 2 - src;
+   }
+
+   // whatever is left goes as literals
+   if ((op = putSequence(op, oend, anchor, end - anchor, 0, 0)) == NULL)
+      return 0;
+
+   return op - dst;
+}
+
+// Adds the bytes after a nibble of 15 to len, -1 if they run past iend
+static int getLength(const u_char ** ip, const u_char * iend, int len)
+{
+   int b;
+
+   do {
+      if (*ip >= iend)
+         return -1;
+      b = *(*ip)++;
+      len += b;
+   } while (b == 255 && len < (1 << 30));
+
+   return len;
+}
+
+/*****
+ * Decompresses a block of len bytes into at most cap bytes of dst and
+ * returns how many it produced, or -1 if the block is malformed: every
+ * length and offset is checked, so a bad block cannot read or write
+ * outside the buffers.
+ ****/
+int lzDecompress(const u_char * src, int len, u_char * dst, int cap)
+{
+   const u_char * ip = src;
+   const u_char * iend = src + len;
+   const u_char * ref;
+   u_char * op = dst;
+   u_char * oend = dst + cap;
+   int token;
+   int lit;
+   int match;
+   int offset;
+
+   while (ip < iend)
+   {
+      token = *ip++;
+
+      lit = token >> 4;
+      if (lit == 15 && (lit = getLength(&ip, iend, lit)) < 0)
+         return -1;
+      if (iend - ip < lit || oend - op < lit)
+         return -1;
+      memcpy(op, ip, lit);
+      op += lit;
+      ip += lit;
+
+      // the last sequence has no match
+      if (ip == iend)
+         break;
+
+      if (iend - ip < 2)
+         return -1;
+      offset = ip[0] | ip[1] << 8;
+      ip += 2;
+
+      match = token & 15;
+      if (match == 15 && (match = getLength(&ip, iend, match)) < 0)
+         return -1;
+      match += LZ_MIN_MATCH;
+
+      if (offset == 0 || offset > op - dst || oend - op < match)
+         return -1;
+
+      // a match may overlap what it is copying, a run of one byte say
+      ref = op - offset;
+      if (offset >= match) {
+         memcpy(op, ref, match);
+         op += match;
+      } else {
+         while (match-- > 0)
+            *op++ = *ref++;
+      }
+   }
+
+   return op - dst;
+}
@@ -0,0 +1,17 @@
+// Small LZ77 block codec (LZ4's block format) for compressed transfers
+
+#ifndef __LZ_H__
+#define __LZ_H__
+
+#include <sys/types.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_LAST_LITERALS 5  // a block always ends in at least this many literals
+#define LZ_MATCH_LIMIT 12   // and no match starts this close to its end
+#define LZ_MAX_OFFSET 65535
+
+int lzCompress(const u_char * src, int len, u_char * dst, int cap);
+int lzDecompress(const u_char * src, int len, u_char * dst, int cap);
+
+#endif
@@ -1,429 +1,1194 @@
-
-// Hugh Smith April 2017
-// Network code to support TCP/UDP client and server connections
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <sys/uio.h>
-#include <sys/time.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <string.h>
-#include <strings.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <netdb.h>
-
-#include "networks.h"
-#include "gethostbyname.h"
-#include "cpe464.h"
-#include "libcpe464/networks/checksum.h"
-
-int safeRecvfrom(int socketNum, void * buf, int len, int flags, struct sockaddr *srcAddr, int * addrLen)
-{
-	int returnValue = 0;
-	if ((returnValue = recvfrom(socketNum, buf, (size_t) len, flags, srcAddr, (socklen_t *) addrLen)) < 0)
-	{
-		perror("recvfrom: ");
-		exit(-1);
-	}
-	
-	return returnValue;
-}
-
-int safeSendto(int socketNum, void * buf, int len, int flags, struct sockaddr *srcAddr, int addrLen)
-{
-	int returnValue = 0;
-	if ((returnValue = sendto(socketNum, buf, (size_t) len, flags, srcAddr, (socklen_t) addrLen)) < 0)
-	{
-		perror("sendto: ");
-		exit(-1);
-	}
-	
-	return returnValue;
-}
-
-int safeRecv2(int socketNum, void * buf, int len, int flags)
-{
-	int returnValue = 0;
-	if ((returnValue = recv(socketNum, buf, (size_t) len, flags)) < 0)
-	{
-		perror("recv: ");
-		exit(-1);
-	}
-	
-	return returnValue;
-}
-
-int safeSend2(int socketNum, void * buf, int len, int flags)
-{
-	int returnValue = 0;
-	if ((returnValue = send(socketNum, buf, (size_t) len, flags)) < 0)
-	{
-		perror("send: ");
-		exit(-1);
-	}
-	
-	return returnValue;
-}
-
-
-// This function sets the server socket. The function returns the server
-// socket number and prints the port number to the screen.  
-
-int tcpServerSetup(int portNumber)
-{
-	int server_socket= 0;
-	struct sockaddr_in6 server;     
-	socklen_t len= sizeof(server);  
-
-	server_socket= socket(AF_INET6, SOCK_STREAM, 0);
-	if(server_socket < 0)
-	{
-		perror("socket call");
-		exit(1);
-	}
-
-	server.sin6_family= AF_INET6;         		
-	server.sin6_addr = in6addr_any;   
-	server.sin6_port= htons(portNumber);         
-
-	// bind the name (address) to a port 
-	if (bind(server_socket, (struct sockaddr *) &server, sizeof(server)) < 0)
-	{
-		perror("bind call");
-		exit(-1);
-	}
-	
-	// get the port name and print it out
-	if (getsockname(server_socket, (struct sockaddr*)&server, &len) < 0)
-	{
-		perror("getsockname call");
-		exit(-1);
-	}
-
-	if (listen(server_socket, BACKLOG) < 0)
-	{
-		perror("listen call");
-		exit(-1);
-	}
-	
-	printf("Server Port Number %d \n", ntohs(server.sin6_port));
-	
-	return server_socket;
-}
-
-// This function waits for a client to ask for services.  It returns
-// the client socket number.   
-
-int tcpAccept(int server_socket, int debugFlag)
-{
-	struct sockaddr_in6 clientInfo;   
-	int clientInfoSize = sizeof(clientInfo);
-	int client_socket= 0;
-
-	if ((client_socket = accept(server_socket, (struct sockaddr*) &clientInfo, (socklen_t *) &clientInfoSize)) < 0)
-	{
-		perror("accept call");
-		exit(-1);
-	}
-	  
-	if (debugFlag)
-	{
-		printf("Client accepted.  Client IP: %s Client Port Number: %d\n",  
-				getIPAddressString6(clientInfo.sin6_addr.s6_addr), ntohs(clientInfo.sin6_port));
-	}
-	
-
-	return(client_socket);
-}
-
-int tcpClientSetup(char * serverName, char * port, int debugFlag)
-{
-	// This is used by the client to connect to a server using TCP
-	
-	int socket_num;
-	uint8_t * ipAddress = NULL;
-	struct sockaddr_in6 server;      
-	
-	// create the socket
-	if ((socket_num = socket(AF_INET6, SOCK_STREAM, 0)) < 0)
-	{
-		perror("socket call");
-		exit(-1);
-	}
-
-	// setup the server structure
-	server.sin6_family = AF_INET6;
-	server.sin6_port = htons(atoi(port));
-	
-	// get the address of the server 
-	if ((ipAddress = gethostbyname6(serverName, &server)) == NULL)
-	{
-		exit(-1);
-	}
-
-	if(connect(socket_num, (struct sockaddr*)&server, sizeof(server)) < 0)
-	{
-		perror("connect call");
-		exit(-1);
-	}
-
-	if (debugFlag)
-	{
-		printf("Connected to %s IP: %s Port Number: %d\n", serverName, getIPAddressString6(ipAddress), atoi(port));
-	}
-	
-	return socket_num;
-}
-
-int udpServerSetup(int portNumber)
-{
-	struct sockaddr_in6 server;
-	int socketNum = 0;
-	int serverAddrLen = 0;	
-	
-	// create the socket
-	if ((socketNum = socket(AF_INET6,SOCK_DGRAM,0)) < 0)
-	{
-		perror("socket() call error");
-		exit(-1);
-	}
-	
-	// set up the socket
-	server.sin6_family = AF_INET6;    		// internet (IPv6 or IPv4) family
-	server.sin6_addr = in6addr_any ;  		// use any local IP address
-	server.sin6_port = htons(portNumber);   // if 0 = os picks 
-
-	// bind the name (address) to a port
-	if (bind(socketNum,(struct sockaddr *) &server, sizeof(server)) < 0)
-	{
-		perror("bind() call error");
-		exit(-1);
-	}
-
-	/* Get the port number */
-	serverAddrLen = sizeof(server);
-	getsockname(socketNum,(struct sockaddr *) &server,  &serverAddrLen);
-	printf("Server using Port #: %d\n", ntohs(server.sin6_port));
-
-	return socketNum;	
-	
-}
-
-int32_t select_call(int32_t socketNum, int32_t seconds, int32_t microseconds, int32_t set_null)
-{
-   fd_set fdvar;
-   struct timeval aTimeout;
-   struct timeval * timeout = NULL;
-
-   if (set_null == 1)
-   {
-      aTimeout.tv_sec = seconds; 
-      aTimeout.tv_usec = microseconds;
-      timeout = &aTimeout;
-   }
-
-   FD_ZERO(&fdvar);
-   FD_SET(socketNum, &fdvar);
-
-   if (select(socketNum + 1, (fd_set *) &fdvar, (fd_set *) 0, (fd_set *) 0, timeout) < 0)
-   {
-      perror("select");
-      exit(-1);
-   }
-
-   if (FD_ISSET(socketNum, &fdvar))
-   {
-      return 1;
-   } 
-
-   return 0;
-}
-
-int processSelect(Connection * client, int *retryCount, int selectTimeoutState, int dataReadyState, int doneState)
-{
-   //Returns:
-   // doneState if calling this function exceeds MAX_TRIES
-   // selectTimeoutState if the select times out without receiving anything
-   // dataReadyState if select() returns indicating that data is ready for read
-   
-   int returnVal;
-
-   (*retryCount)++;
-   if (*retryCount >= MAX_TRIES)
-   {
-      printf("Send data %d times, no ACK. Other side is down\n", MAX_TRIES);
-      returnVal = doneState;
-   }
-   else
-   {
-      if (select_call(client->sk_num, SHORT_TIME, 0, 1) == 1)
-      {
-         *retryCount = 0;
-         returnVal = dataReadyState;
-      }
-      else
-      {
-         // no data ready
-         returnVal = selectTimeoutState;
-      }
-   }
-
-   return returnVal;
-}
-
-
-// Returns 0 if valid, 1 if corrupt
-int crcCheck(u_char * pkt)
-{
-   unsigned short cksum = 0;
-   if ((cksum = in_cksum((unsigned short *) pkt, HDR_LEN + MAX_PAYLOAD)) != 0)
-   {
-      return 1;
-   }
-
-   return 0;
-}
-
-int32_t safeSend(u_char * pkt, uint32_t len, Connection * connection)
-{
-   int send_len = 0;
-   
-   if ((send_len = sendtoErr(connection->sk_num, pkt, len, 0, 
-      (struct sockaddr *) &(connection->remote), connection->len)) < 0) 
-   {
-      perror("in send_buf(), sendto() call");
-      exit(-1);
-   }
-
-   return send_len;
-}
-
-int32_t safeRecv(int recv_sk_num, u_char * data_buf, int len, Connection * connection)
-{
-   uint32_t recv_len = 0;
-   uint32_t remote_len = sizeof(struct sockaddr_in);
-
-   if ((recv_len = recvfrom(recv_sk_num, data_buf, len, 0, (struct sockaddr *)&(connection->remote), &remote_len)) < 0)
-   {
-      perror("recv_buf, recvfrom");
-      exit(-1);
-   }
-
-   connection->len = remote_len;
-   
-   return recv_len;
-}
-
-void printPkt(u_char * pkt, int bytes_read)
-{
-   uint32_t seq;
-   uint16_t checksum;
-   uint8_t flag;
-   char data[MAX_PAYLOAD];
-
-   memset(data, 0, MAX_PAYLOAD);
-   memcpy(&seq, pkt, 4);
-   memcpy(&checksum, pkt + 4, 2);
-   memcpy(&flag, pkt + 4 + 2, 1);
-   memcpy(data, pkt + 7, MAX_PAYLOAD);
-
-   printf("***********************\n");
-   printf("Packet Data...\n");
-   printf("Bytes Read: %d\n", bytes_read);
-   printf("Sequence num: %d\n", ntohl(seq));
-   printf("Checksum: %.04x\n", checksum);
-   printf("Flag: %d\n", flag);
-   printf("Data: %s\n", data);
-   printf("***********************\n");
-}
-  
-
-int32_t udp_client_setup(char * hostname, uint16_t port_num, Connection * connection)
-{
-   struct hostent * hp = NULL;
-
-   connection->sk_num = 0;
-   connection->len = sizeof(struct sockaddr_in);
-
-   if ((connection->sk_num = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
-   {
-      perror("udp_client_setup, socket");
-      exit(-1);
-   }
-
-   connection->remote.sin_family = AF_INET;
-
-   hp = gethostbyname(hostname);
-   
-   if (hp == NULL)
-   {
-      printf("Host not found: %s\n", hostname);
-      return -1;
-   }
-
-   memcpy(&(connection->remote.sin_addr), hp->h_addr, hp->h_length);
-
-   connection->remote.sin_port = htons(port_num);
-
-   return 0;
-}
-
-int32_t udp_server(int portNumber)
-{
-   int sk = 0;
-   struct sockaddr_in local;
-   uint32_t len = sizeof(local);
-   
-   if ((sk = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
-   {
-      perror("socket");
-      exit(-1);
-   }
-
-   local.sin_family = AF_INET;
-   local.sin_addr.s_addr = INADDR_ANY;
-   local.sin_port = htons(portNumber);
-
-   if (bindMod(sk, (struct sockaddr *)&local, sizeof(local)) < 0)
-   {
-      perror("udp_server, bind");
-      exit(-1);
-   }
-
-   getsockname(sk, (struct sockaddr *)&local, &len);
-   printf("Using Port #: %d\n", ntohs(local.sin_port));
-   
-   return(sk);
-}
-
-int setupUdpClientToServer(struct sockaddr_in6 *server, char * hostName, int portNumber)
-{
-	// currently only setup for IPv4 
-	int socketNum = 0;
-	char ipString[INET6_ADDRSTRLEN];
-	uint8_t * ipAddress = NULL;
-	
-	// create the socket
-	if ((socketNum = socket(AF_INET6, SOCK_DGRAM, 0)) < 0)
-	{
-		perror("socket() call error");
-		exit(-1);
-	}
-  	 	
-	if ((ipAddress = gethostbyname6(hostName, server)) == NULL)
-	{
-		exit(-1);
-	}
-	
-	server->sin6_port = ntohs(portNumber);
-	server->sin6_family = AF_INET6;	
-	
-	inet_ntop(AF_INET6, ipAddress, ipString, sizeof(ipString));
-	printf("Server info - IP: %s Port: %d \n", ipString, portNumber);
-		
-	return socketNum;
-}
+
+// Hugh Smith April 2017
+// Network code to support TCP/UDP client and server connections
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <netdb.h>
+#include <errno.h>
+#include <endian.h>
+#include <time.h>
+#include <pthread.h>
+#include <linux/net_tstamp.h>
+
+#include "networks.h"
+#include "gethostbyname.h"
+#include "cpe464.h"
+#include "libcpe464/networks/checksum.h"
+#include "crc32c.h"
+
+// The error emulation library keeps its state (the random drops, the
+// packet log) in globals, so -t's threads take turns in it. Only sockets
+// already known to be readable are read with it held. With no errors to
+// emulate nothing goes through it, as with a batch, and nothing is locked.
+static pthread_mutex_t emulateLock = PTHREAD_MUTEX_INITIALIZER;
+static int emulating = 0;
+
+// Sets up the error emulation for errorRate, before any thread is started
+void initEmulation(double errorRate)
+{
+   sendtoErr_init(errorRate, DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON);
+   emulating = errorRate > 0;
+}
+
+int safeRecvfrom(int socketNum, void * buf, int len, int flags, struct sockaddr *srcAddr, int * addrLen)
+{
+	int returnValue = 0;
+	if ((returnValue = recvfrom(socketNum, buf, (size_t) len, flags, srcAddr, (socklen_t *) addrLen)) < 0)
+	{
+		perror("recvfrom: ");
+		exit(-1);
+	}
+	
+	return returnValue;
+}
+
+int safeSendto(int socketNum, void * buf, int len, int flags, struct sockaddr *srcAddr, int addrLen)
+{
+	int returnValue = 0;
+	if ((returnValue = sendto(socketNum, buf, (size_t) len, flags, srcAddr, (socklen_t) addrLen)) < 0)
+	{
+		perror("sendto: ");
+		exit(-1);
+	}
+	
+	return returnValue;
+}
+
+int safeRecv2(int socketNum, void * buf, int len, int flags)
+{
+	int returnValue = 0;
+	if ((returnValue = recv(socketNum, buf, (size_t) len, flags)) < 0)
+	{
+		perror("recv: ");
+		exit(-1);
+	}
+	
+	return returnValue;
+}
+
+int safeSend2(int socketNum, void * buf, int len, int flags)
+{
+	int returnValue = 0;
+	if ((returnValue = send(socketNum, buf, (size_t) len, flags)) < 0)
+	{
+		perror("send: ");
+		exit(-1);
+	}
+	
+	return returnValue;
+}
+
+
+// This function sets the server socket. The function returns the server
+// socket number and prints the port number to the screen.  
+
+int tcpServerSetup(int portNumber)
+{
+	int server_socket= 0;
+	struct sockaddr_in6 server;     
+	socklen_t len= sizeof(server);  
+
+	server_socket= socket(AF_INET6, SOCK_STREAM, 0);
+	if(server_socket < 0)
+	{
+		perror("socket call");
+		exit(1);
+	}
+
+	server.sin6_family= AF_INET6;         		
+	server.sin6_addr = in6addr_any;   
+	server.sin6_port= htons(portNumber);         
+
+	// bind the name (address) to a port 
+	if (bind(server_socket, (struct sockaddr *) &server, sizeof(server)) < 0)
+	{
+		perror("bind call");
+		exit(-1);
+	}
+	
+	// get the port name and print it out
+	if (getsockname(server_socket, (struct sockaddr*)&server, &len) < 0)
+	{
+		perror("getsockname call");
+		exit(-1);
+	}
+
+	if (listen(server_socket, BACKLOG) < 0)
+	{
+		perror("listen call");
+		exit(-1);
+	}
+	
+	printf("Server Port Number %d \n", ntohs(server.sin6_port));
+	
+	return server_socket;
+}
+
+// This function waits for a client to ask for services.  It returns
+// the client socket number.   
+
+int tcpAccept(int server_socket, int debugFlag)
+{
+	struct sockaddr_in6 clientInfo;   
+	int clientInfoSize = sizeof(clientInfo);
+	int client_socket= 0;
+
+	if ((client_socket = accept(server_socket, (struct sockaddr*) &clientInfo, (socklen_t *) &clientInfoSize)) < 0)
+	{
+		perror("accept call");
+		exit(-1);
+	}
+	  
+	if (debugFlag)
+	{
+		printf("Client accepted.  Client IP: %s Client Port Number: %d\n",  
+				getIPAddressString6(clientInfo.sin6_addr.s6_addr), ntohs(clientInfo.sin6_port));
+	}
+	
+
+	return(client_socket);
+}
+
+int tcpClientSetup(char * serverName, char * port, int debugFlag)
+{
+	// This is used by the client to connect to a server using TCP
+	
+	int socket_num;
+	uint8_t * ipAddress = NULL;
+	struct sockaddr_in6 server;      
+	
+	// create the socket
+	if ((socket_num = socket(AF_INET6, SOCK_STREAM, 0)) < 0)
+	{
+		perror("socket call");
+		exit(-1);
+	}
+
+	// setup the server structure
+	server.sin6_family = AF_INET6;
+	server.sin6_port = htons(atoi(port));
+	
+	// get the address of the server 
+	if ((ipAddress = gethostbyname6(serverName, &server)) == NULL)
+	{
+		exit(-1);
+	}
+
+	if(connect(socket_num, (struct sockaddr*)&server, sizeof(server)) < 0)
+	{
+		perror("connect call");
+		exit(-1);
+	}
+
+	if (debugFlag)
+	{
+		printf("Connected to %s IP: %s Port Number: %d\n", serverName, getIPAddressString6(ipAddress), atoi(port));
+	}
+	
+	return socket_num;
+}
+
+int udpServerSetup(int portNumber)
+{
+	struct sockaddr_in6 server;
+	int socketNum = 0;
+	int serverAddrLen = 0;	
+	
+	// create the socket
+	if ((socketNum = socket(AF_INET6,SOCK_DGRAM,0)) < 0)
+	{
+		perror("socket() call error");
+		exit(-1);
+	}
+	
+	// set up the socket
+	server.sin6_family = AF_INET6;    		// internet (IPv6 or IPv4) family
+	server.sin6_addr = in6addr_any ;  		// use any local IP address
+	server.sin6_port = htons(portNumber);   // if 0 = os picks 
+
+	// bind the name (address) to a port
+	if (bind(socketNum,(struct sockaddr *) &server, sizeof(server)) < 0)
+	{
+		perror("bind() call error");
+		exit(-1);
+	}
+
+	/* Get the port number */
+	serverAddrLen = sizeof(server);
+	getsockname(socketNum,(struct sockaddr *) &server,  &serverAddrLen);
+	printf("Server using Port #: %d\n", ntohs(server.sin6_port));
+
+	return socketNum;	
+	
+}
+
+int32_t select_call(int32_t socketNum, int32_t seconds, int32_t microseconds, int32_t set_null)
+{
+   fd_set fdvar;
+   struct timeval aTimeout;
+   struct timeval * timeout = NULL;
+
+   if (set_null == 1)
+   {
+      aTimeout.tv_sec = seconds; 
+      aTimeout.tv_usec = microseconds;
+      timeout = &aTimeout;
+   }
+
+   FD_ZERO(&fdvar);
+   FD_SET(socketNum, &fdvar);
+
+   if (select(socketNum + 1, (fd_set *) &fdvar, (fd_set *) 0, (fd_set *) 0, timeout) < 0)
+   {
+      perror("select");
+      exit(-1);
+   }
+
+   if (FD_ISSET(socketNum, &fdvar))
+   {
+      return 1;
+   } 
+
+   return 0;
+}
+
+// Same idea as select_call() but built on poll(), which has no FD_SETSIZE
+// limit on the descriptor number. Returns 1 if data is ready, 0 if not.
+// A negative milliseconds value blocks until data arrives.
+int32_t poll_call(int32_t socketNum, int32_t milliseconds)
+{
+   struct pollfd pfd;
+
+   pfd.fd = socketNum;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   if (poll(&pfd, 1, milliseconds) < 0)
+   {
+      perror("poll");
+      exit(-1);
+   }
+
+   if (pfd.revents & POLLIN)
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+// poll_call() with a microsecond timeout, for waits shorter than a
+// millisecond (pacing). ppoll() takes a timespec, so the timeout is not
+// rounded up to the next millisecond.
+int32_t poll_usec(int32_t socketNum, int64_t microseconds)
+{
+   struct pollfd pfd;
+   struct timespec timeout;
+
+   pfd.fd = socketNum;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   timeout.tv_sec = microseconds / 1000000;
+   timeout.tv_nsec = (microseconds % 1000000) * 1000;
+
+   if (ppoll(&pfd, 1, &timeout, NULL) < 0)
+   {
+      perror("ppoll");
+      exit(-1);
+   }
+
+   if (pfd.revents & POLLIN)
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+int processSelect(Connection * client, int *retryCount, int selectTimeoutState, int dataReadyState, int doneState)
+{
+   //Returns:
+   // doneState if calling this function exceeds MAX_TRIES
+   // selectTimeoutState if the select times out without receiving anything
+   // dataReadyState if select() returns indicating that data is ready for read
+   
+   int returnVal;
+
+   (*retryCount)++;
+   if (*retryCount >= MAX_TRIES)
+   {
+      printf("Send data %d times, no ACK. Other side is down\n", MAX_TRIES);
+      returnVal = doneState;
+   }
+   else
+   {
+      if (select_call(client->sk_num, SHORT_TIME, 0, 1) == 1)
+      {
+         *retryCount = 0;
+         returnVal = dataReadyState;
+      }
+      else
+      {
+         // no data ready
+         returnVal = selectTimeoutState;
+      }
+   }
+
+   return returnVal;
+}
+
+
+// Returns 0 if valid, 1 if corrupt. len is the number of bytes received,
+// since packets are only as long as their payload.
+int crcCheck(u_char * pkt, int len)
+{
+   unsigned short cksum = 0;
+
+   if (len < HDR_LEN)
+   {
+      return 1;
+   }
+
+   if ((cksum = in_cksum((unsigned short *) pkt, len)) != 0)
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+/*****
+ * Header length for a connection with these options. With OPT_CRC32C the
+ * 16 bit checksum field is left 0 and a CRC32C of the rest of the packet
+ * follows the flag, in network order.
+ ****/
+int hdrLen(uint8_t options)
+{
+   return (options & OPT_CRC32C) ? HDR_LEN + CRC_LEN : HDR_LEN;
+}
+
+// crcCheck() for a connection, using the check it negotiated
+int checkPkt(u_char * pkt, int len, uint8_t options)
+{
+   uint32_t crc;
+   uint32_t want;
+
+   if (!(options & OPT_CRC32C))
+   {
+      return crcCheck(pkt, len);
+   }
+
+   if (len < HDR_LEN + CRC_LEN)
+   {
+      return 1;
+   }
+
+   memcpy(&want, pkt + HDR_LEN, CRC_LEN);
+   crc = crc32c(0, pkt, HDR_LEN);
+   crc = crc32c(crc, pkt + HDR_LEN + CRC_LEN, len - HDR_LEN - CRC_LEN);
+
+   return htonl(crc) != want;
+}
+
+/*****
+ * Returns the size bytes that start skip bytes after the NUL ending the
+ * file name at nameOffset, or NULL if the packet stops before them.
+ ****/
+static u_char * afterName(u_char * pkt, int len, int nameOffset, int skip, int size)
+{
+   u_char * end = memchr(pkt + nameOffset, 0, len > nameOffset ? len - nameOffset : 0);
+
+   if (end == NULL || end + 1 + skip + size > pkt + len)
+      return NULL;
+
+   return end + 1 + skip;
+}
+
+/*****
+ * Returns the options byte that follows the NUL terminated file name
+ * starting at nameOffset, or 0 if the sender did not include one.
+ ****/
+uint8_t getOptions(u_char * pkt, int len, int nameOffset)
+{
+   u_char * field = afterName(pkt, len, nameOffset, 0, 1);
+
+   return field != NULL ? field[0] : 0;
+}
+
+/*****
+ * Returns the payload size (network order) that follows the options byte
+ * after the file name starting at nameOffset, or 0 if the sender did not
+ * include one.
+ ****/
+uint16_t getPayload(u_char * pkt, int len, int nameOffset)
+{
+   u_char * field = afterName(pkt, len, nameOffset, 1, 2);
+   uint16_t payload;
+
+   if (field == NULL)
+      return 0;
+
+   memcpy(&payload, field, 2);
+   return ntohs(payload);
+}
+
+/*****
+ * Setup packet with OPT_STRIPE: reads which stripe of how many the client
+ * wants, two network order shorts after the options byte. Returns 0, or
+ * -1 if they are missing or make no sense.
+ ****/
+int getStripe(u_char * pkt, int len, int nameOffset, uint16_t * index, uint16_t * count)
+{
+   u_char * field = afterName(pkt, len, nameOffset, 1, 4);
+
+   if (field == NULL)
+      return -1;
+
+   memcpy(index, field, 2);
+   memcpy(count, field + 2, 2);
+   *index = ntohs(*index);
+   *count = ntohs(*count);
+
+   return *count > 0 && *index < *count ? 0 : -1;
+}
+
+/*****
+ * Setup packet with OPT_RESUME: reads the offset the client wants to start
+ * at and the file size it expects, -1 if it does not know, two network
+ * order 64 bit values after the stripe fields if there are any. Returns 0,
+ * or -1 if they are missing.
+ ****/
+int getResume(u_char * pkt, int len, int nameOffset, int64_t * offset, int64_t * size)
+{
+   int skip = (getOptions(pkt, len, nameOffset) & OPT_STRIPE) ? 5 : 1;
+   u_char * field = afterName(pkt, len, nameOffset, skip, 16);
+   uint64_t value;
+
+   if (field == NULL)
+      return -1;
+
+   memcpy(&value, field, 8);
+   *offset = be64toh(value);
+   memcpy(&value, field + 8, 8);
+   *size = be64toh(value);
+
+   return 0;
+}
+
+/*****
+ * Setup packet with OPT_DELTA: reads the block size and block count of the
+ * signature the client is about to send, two network order 32 bit values
+ * after the stripe and resume fields. Returns 0, or -1 if they are missing.
+ ****/
+int getDelta(u_char * pkt, int len, int nameOffset, uint32_t * blockSize, uint32_t * blocks)
+{
+   uint8_t options = getOptions(pkt, len, nameOffset);
+   int skip = 1 + ((options & OPT_STRIPE) ? 4 : 0) + ((options & OPT_RESUME) ? 16 : 0);
+   u_char * field = afterName(pkt, len, nameOffset, skip, 8);
+
+   if (field == NULL)
+      return -1;
+
+   memcpy(blockSize, field, 4);
+   memcpy(blocks, field + 4, 4);
+   *blockSize = ntohl(*blockSize);
+   *blocks = ntohl(*blocks);
+
+   return 0;
+}
+
+/*****
+ * Setup reply with OPT_STRIPE or OPT_RESUME: reads where the data starts
+ * and how long the whole file is, two network order 64 bit values after
+ * the payload size. Returns 0, or -1 if the reply stops before them.
+ ****/
+int getRange(u_char * pkt, int len, int nameOffset, int64_t * start, int64_t * size)
+{
+   u_char * field = afterName(pkt, len, nameOffset, 3, 16);
+   uint64_t value;
+
+   if (field == NULL)
+      return -1;
+
+   memcpy(&value, field, 8);
+   *start = be64toh(value);
+   memcpy(&value, field + 8, 8);
+   *size = be64toh(value);
+
+   return 0;
+}
+
+/*****
+ * Connects the socket to connection's remote end and returns the path MTU
+ * the kernel has for it: the outgoing interface's, or less once an ICMP
+ * "fragmentation needed" has come back. IP_PMTUDISC_WANT sets DF on every
+ * datagram that fits it, so a smaller hop further on reports itself, and
+ * lets the kernel fragment rather than fail a send if the MTU drops later.
+ * Returns -1 if it cannot tell.
+ ****/
+int pathMtu(Connection * connection)
+{
+   int mode = IP_PMTUDISC_WANT;
+   int mtu = 0;
+   socklen_t len = sizeof(mtu);
+
+   if (connect(connection->sk_num, (struct sockaddr *)&connection->remote, connection->len) < 0)
+   {
+      perror("pathMtu, connect");
+      return -1;
+   }
+
+   if (setsockopt(connection->sk_num, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode)) < 0
+      || getsockopt(connection->sk_num, IPPROTO_IP, IP_MTU, &mtu, &len) < 0)
+   {
+      perror("pathMtu, IP_MTU");
+      return -1;
+   }
+
+   return mtu;
+}
+
+int32_t safeSend(u_char * pkt, uint32_t len, Connection * connection)
+{
+   int send_len = 0;
+   
+   if (emulating) {
+      pthread_mutex_lock(&emulateLock);
+      send_len = sendtoErr(connection->sk_num, pkt, len, 0, 
+         (struct sockaddr *) &(connection->remote), connection->len);
+      pthread_mutex_unlock(&emulateLock);
+   } else {
+      // the parentheses keep the library's sendto macro out of it
+      send_len = (sendto)(connection->sk_num, pkt, len, 0,
+         (struct sockaddr *) &(connection->remote), connection->len);
+   }
+
+   if (send_len < 0) 
+   {
+      // a connected socket hears back when the client's port has closed,
+      // which only ends that client, so leave it to the caller
+      if (errno == ECONNREFUSED)
+         return -1;
+
+      perror("in send_buf(), sendto() call");
+      exit(-1);
+   }
+
+   return send_len;
+}
+
+int32_t safeRecv(int recv_sk_num, u_char * data_buf, int len, Connection * connection)
+{
+   uint32_t recv_len = 0;
+   uint32_t remote_len = sizeof(struct sockaddr_in);
+
+   if (emulating) {
+      pthread_mutex_lock(&emulateLock);
+      recv_len = recvfrom(recv_sk_num, data_buf, len, 0, (struct sockaddr *)&(connection->remote), &remote_len);
+      pthread_mutex_unlock(&emulateLock);
+   } else {
+      recv_len = (recvfrom)(recv_sk_num, data_buf, len, 0, (struct sockaddr *)&(connection->remote), &remote_len);
+   }
+
+   if (recv_len < 0)
+   {
+      perror("recv_buf, recvfrom");
+      exit(-1);
+   }
+
+   connection->len = remote_len;
+   
+   return recv_len;
+}
+
+void initSendBatch(struct sendBatch * batch, Connection * connection, int limit, int emulate)
+{
+   memset(batch, 0, sizeof(struct sendBatch));
+   batch->connection = connection;
+   batch->emulate = emulate;
+   batch->limit = (limit < 1 || limit > BATCH_MAX) ? BATCH_MAX : limit;
+}
+
+/*****
+ * Turns on SO_TXTIME for the batch's socket so every datagram can carry the
+ * time it should leave at (sendAt). Only a qdisc that knows about departure
+ * times (fq, etf) holds them back, any other sends them straight away.
+ * Emulated batches go through sendtoErr, which cannot pass the time, so
+ * they are left alone. Returns 1 if the times will be sent.
+ ****/
+int enableTxtime(struct sendBatch * batch)
+{
+   struct sock_txtime txtime;
+
+   if (batch->emulate)
+      return 0;
+
+   txtime.clockid = CLOCK_MONOTONIC;
+   txtime.flags = 0;
+
+   if (setsockopt(batch->connection->sk_num, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0)
+   {
+      perror("enableTxtime, setsockopt(SO_TXTIME)");
+      return 0;
+   }
+
+   batch->txtime = 1;
+   return 1;
+}
+
+/*****
+ * Turns on UDP generic segmentation offload for the batch if the kernel
+ * has it (UDP_SEGMENT, Linux 4.18). Not for emulated batches, which go out
+ * one sendtoErr at a time, nor with SO_TXTIME, since every datagram of a
+ * segmented send would leave at the first one's time. Returns 1 if on.
+ ****/
+int enableGso(struct sendBatch * batch)
+{
+   int size = 0;
+   socklen_t len = sizeof(size);
+
+   if (batch->emulate || batch->txtime)
+      return 0;
+
+   if (getsockopt(batch->connection->sk_num, SOL_UDP, UDP_SEGMENT, &size, &len) < 0)
+      return 0;
+
+   batch->gso = 1;
+   return 1;
+}
+
+// Queues pkt for the next sendmmsg() call, flushing first if the batch is full
+void queueSend(struct sendBatch * batch, u_char * pkt, uint32_t len)
+{
+   queueSendv(batch, pkt, len, NULL, 0);
+}
+
+// Same as queueSend() for a datagram in two pieces; the kernel gathers
+// them, so the payload is never copied here. sendtoErr only takes one
+// buffer, so the emulated path has to put the pieces together first.
+void queueSendv(struct sendBatch * batch, u_char * hdr, uint32_t hdrLen, u_char * payload, uint32_t payloadLen)
+{
+   struct mmsghdr * msg;
+   struct iovec * iov;
+   struct cmsghdr * cmsg;
+
+   if (batch->refused)
+      return;
+
+   if (batch->emulate)
+   {
+      u_char whole[hdrLen + payloadLen];
+
+      if (payloadLen > 0)
+      {
+         memcpy(whole, hdr, hdrLen);
+         memcpy(whole + hdrLen, payload, payloadLen);
+         hdr = whole;
+         hdrLen += payloadLen;
+      }
+
+      if (safeSend(hdr, hdrLen, batch->connection) < 0)
+      {
+         batch->refused = 1;
+         return;
+      }
+      batch->packets++;
+      batch->syscalls++;
+      return;
+   }
+
+   msg = &batch->msgs[batch->count];
+   iov = &batch->iov[2 * batch->count];
+   iov[0].iov_base = hdr;
+   iov[0].iov_len = hdrLen;
+   iov[1].iov_base = payload;
+   iov[1].iov_len = payloadLen;
+
+   memset(msg, 0, sizeof(struct mmsghdr));
+   msg->msg_hdr.msg_name = &batch->connection->remote;
+   msg->msg_hdr.msg_namelen = batch->connection->len;
+   msg->msg_hdr.msg_iov = iov;
+   msg->msg_hdr.msg_iovlen = payloadLen > 0 ? 2 : 1;
+
+   if (batch->txtime)
+   {
+      msg->msg_hdr.msg_control = batch->control[batch->count];
+      msg->msg_hdr.msg_controllen = sizeof(batch->control[batch->count]);
+      cmsg = CMSG_FIRSTHDR(&msg->msg_hdr);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_TXTIME;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+      memcpy(CMSG_DATA(cmsg), &batch->sendAt, sizeof(uint64_t));
+   }
+
+   if (++batch->count == batch->limit)
+      flushSend(batch);
+}
+
+// Length of the idx'th datagram queued in the batch
+static size_t batchMsgLen(struct sendBatch * batch, int idx)
+{
+   return batch->iov[2 * idx].iov_len + batch->iov[2 * idx + 1].iov_len;
+}
+
+/*****
+ * Splits the batch into runs of datagrams the same length as the run's
+ * first (the last of a run may be shorter, as the kernel allows) and makes
+ * each run one message whose iovecs are all of its datagrams' pieces, with
+ * UDP_SEGMENT set to that length. Returns the number of runs.
+ ****/
+static int gsoRuns(struct sendBatch * batch)
+{
+   struct mmsghdr * msg;
+   struct cmsghdr * cmsg;
+   uint16_t segment;
+   size_t total;
+   int runs = 0;
+   int first = 0;
+   int idx;
+
+   while (first < batch->count)
+   {
+      segment = batchMsgLen(batch, first);
+      total = segment;
+
+      for (idx = first + 1; idx < batch->count && idx - first < GSO_MAX_SEGS
+         && batchMsgLen(batch, idx) <= segment && total + batchMsgLen(batch, idx) <= UDP_MAX; idx++)
+      {
+         total += batchMsgLen(batch, idx);
+         if (batchMsgLen(batch, idx) < segment) {
+            idx++;
+            break; // a short datagram can only end a run
+         }
+      }
+
+      msg = &batch->gsoMsgs[runs];
+      memset(msg, 0, sizeof(struct mmsghdr));
+      msg->msg_hdr.msg_name = &batch->connection->remote;
+      msg->msg_hdr.msg_namelen = batch->connection->len;
+      msg->msg_hdr.msg_iov = &batch->iov[2 * first];
+      msg->msg_hdr.msg_iovlen = 2 * (idx - first);
+
+      if (idx - first > 1)
+      {
+         msg->msg_hdr.msg_control = batch->gsoControl[runs];
+         msg->msg_hdr.msg_controllen = sizeof(batch->gsoControl[runs]);
+         cmsg = CMSG_FIRSTHDR(&msg->msg_hdr);
+         cmsg->cmsg_level = SOL_UDP;
+         cmsg->cmsg_type = UDP_SEGMENT;
+         cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+         memcpy(CMSG_DATA(cmsg), &segment, sizeof(uint16_t));
+      }
+
+      batch->gsoFirst[runs++] = first;
+      first = idx;
+   }
+
+   return runs;
+}
+
+/*****
+ * flushSend() with UDP GSO: sends the batch as gsoRuns() in one sendmmsg()
+ * and returns how many of its datagrams went out. If the kernel refuses a
+ * segmented send (EIO when the device cannot checksum it, EMSGSIZE when
+ * the datagrams no longer fit the path MTU, EINVAL for anything else about
+ * the run) GSO is turned off for the batch and the datagrams from that run
+ * on are left for the plain path, where the kernel may fragment them.
+ ****/
+static int flushGso(struct sendBatch * batch)
+{
+   int runs = gsoRuns(batch);
+   int sent = 0;
+   int end;
+   int ret;
+
+   while (sent < runs)
+   {
+      if ((ret = sendmmsg(batch->connection->sk_num, batch->gsoMsgs + sent, runs - sent, 0)) < 0)
+      {
+         if (errno == ECONNREFUSED)
+         {
+            batch->refused = 1;
+            return batch->count;
+         }
+
+         if (errno != EIO && errno != EMSGSIZE && errno != EINVAL)
+         {
+            perror("flushGso, sendmmsg");
+            exit(-1);
+         }
+
+         perror("flushGso, UDP_SEGMENT refused, sending datagrams one by one");
+         batch->gso = 0;
+         return batch->gsoFirst[sent];
+      }
+
+      batch->syscalls++;
+      for (; ret > 0; ret--, sent++)
+      {
+         end = sent + 1 < runs ? batch->gsoFirst[sent + 1] : batch->count;
+         if (end - batch->gsoFirst[sent] > 1) {
+            batch->gsoSends++;
+            batch->gsoPackets += end - batch->gsoFirst[sent];
+         }
+      }
+   }
+
+   return batch->count;
+}
+
+void flushSend(struct sendBatch * batch)
+{
+   int sent = 0;
+   int ret;
+
+   if (batch->gso && batch->count > 1)
+      sent = flushGso(batch);
+
+   while (sent < batch->count)
+   {
+      if ((ret = sendmmsg(batch->connection->sk_num, batch->msgs + sent, batch->count - sent, 0)) < 0)
+      {
+         if (errno == ECONNREFUSED)
+         {
+            batch->refused = 1;
+            break;
+         }
+
+         perror("flushSend, sendmmsg");
+         exit(-1);
+      }
+
+      sent += ret;
+      batch->syscalls++;
+   }
+
+   batch->packets += sent;
+   batch->count = 0;
+}
+
+void initRecvBatch(struct recvBatch * batch, int bufLen)
+{
+   memset(batch, 0, sizeof(struct recvBatch));
+   batch->bufLen = bufLen;
+
+   if ((batch->bufs = malloc(BATCH_MAX * bufLen)) == NULL)
+   {
+      perror("initRecvBatch: malloc");
+      exit(-1);
+   }
+}
+
+void freeRecvBatch(struct recvBatch * batch)
+{
+   free(batch->bufs);
+   free(batch->segs);
+   batch->bufs = NULL;
+   batch->segs = NULL;
+}
+
+/*****
+ * Turns on UDP generic receive offload for the socket (UDP_GRO, Linux
+ * 5.0): the kernel may hand over a run of datagrams from one sender as one
+ * buffer, with their size in a cmsg. Every buffer is grown to a whole UDP
+ * datagram to hold one. Returns 1 if on, 0 if the kernel does not have it
+ * and the batch reads datagram by datagram as before.
+ ****/
+int enableGro(struct recvBatch * batch, int sk_num)
+{
+   int on = 1;
+
+   if (setsockopt(sk_num, SOL_UDP, UDP_GRO, &on, sizeof(on)) < 0)
+      return 0;
+
+   free(batch->bufs);
+   batch->bufLen = UDP_MAX;
+
+   if ((batch->bufs = malloc(BATCH_MAX * batch->bufLen)) == NULL
+      || (batch->segs = malloc(BATCH_MAX * GRO_MAX_SEGS * sizeof(struct iovec))) == NULL)
+   {
+      perror("enableGro: malloc");
+      exit(-1);
+   }
+
+   batch->gro = 1;
+   return 1;
+}
+
+/*****
+ * GRO: splits each buffer read into the datagrams it holds, using the
+ * gso_size the kernel passed with it (no cmsg means one datagram), and
+ * returns how many there were in all.
+ ****/
+static int groSplit(struct recvBatch * batch, int reads)
+{
+   struct cmsghdr * cmsg;
+   u_char * buf;
+   int segment;
+   int left;
+   int count = 0;
+   int segs;
+   int i;
+
+   for (i = 0; i < reads; i++)
+   {
+      buf = batch->bufs + i * batch->bufLen;
+      left = batch->msgs[i].msg_len;
+      segment = left;
+
+      for (cmsg = CMSG_FIRSTHDR(&batch->msgs[i].msg_hdr); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(&batch->msgs[i].msg_hdr, cmsg))
+      {
+         if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+            memcpy(&segment, CMSG_DATA(cmsg), sizeof(int));
+      }
+
+      for (segs = 0; left > 0 && segment > 0 && segs < GRO_MAX_SEGS; segs++)
+      {
+         batch->segs[count].iov_base = buf;
+         batch->segs[count++].iov_len = left < segment ? left : segment;
+         buf += segment;
+         left -= segment;
+      }
+
+      if (segs > 1) {
+         batch->groReads++;
+         batch->groPackets += segs;
+      }
+   }
+
+   return count;
+}
+
+// Waits for one datagram, then takes whatever else is already queued on the
+// socket in the same recvmmsg() call. Returns the number of datagrams read;
+// the remote address of the last one is saved in connection.
+int safeRecvBatch(int recv_sk_num, struct recvBatch * batch, Connection * connection)
+{
+   struct mmsghdr * msg;
+   int i;
+   int ret;
+
+   for (i = 0; i < BATCH_MAX; i++)
+   {
+      msg = &batch->msgs[i];
+      batch->iov[i].iov_base = batch->bufs + i * batch->bufLen;
+      batch->iov[i].iov_len = batch->bufLen;
+
+      memset(msg, 0, sizeof(struct mmsghdr));
+      msg->msg_hdr.msg_name = &batch->addrs[i];
+      msg->msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      msg->msg_hdr.msg_iov = &batch->iov[i];
+      msg->msg_hdr.msg_iovlen = 1;
+
+      if (batch->gro)
+      {
+         msg->msg_hdr.msg_control = batch->control[i];
+         msg->msg_hdr.msg_controllen = sizeof(batch->control[i]);
+      }
+   }
+
+   if ((ret = recvmmsg(recv_sk_num, batch->msgs, BATCH_MAX, MSG_WAITFORONE, NULL)) < 0)
+   {
+      perror("safeRecvBatch, recvmmsg");
+      exit(-1);
+   }
+
+   if (ret > 0)
+   {
+      memcpy(&connection->remote, &batch->addrs[ret - 1], sizeof(struct sockaddr_in));
+      connection->len = batch->msgs[ret - 1].msg_hdr.msg_namelen;
+   }
+
+   if (batch->gro)
+      ret = groSplit(batch, ret);
+
+   batch->count = ret;
+   batch->packets += ret;
+   batch->syscalls++;
+
+   return ret;
+}
+
+u_char * batchPkt(struct recvBatch * batch, int i)
+{
+   if (batch->gro)
+      return batch->segs[i].iov_base;
+
+   return batch->bufs + i * batch->bufLen;
+}
+
+int batchLen(struct recvBatch * batch, int i)
+{
+   if (batch->gro)
+      return batch->segs[i].iov_len;
+
+   return batch->msgs[i].msg_len;
+}
+
+void printBatchStats(char * what, uint64_t packets, uint64_t syscalls)
+{
+   printf("%s %llu packets in %llu syscalls (%.1f packets/syscall)\n", what,
+      (unsigned long long) packets, (unsigned long long) syscalls,
+      syscalls ? (double) packets / syscalls : 0.0);
+}
+
+void printPkt(u_char * pkt, int bytes_read)
+{
+   uint32_t seq;
+   uint16_t checksum;
+   uint8_t flag;
+   int len = bytes_read > HDR_LEN ? bytes_read - HDR_LEN : 0;
+   char data[len + 1];
+
+   memcpy(&seq, pkt, 4);
+   memcpy(&checksum, pkt + 4, 2);
+   memcpy(&flag, pkt + 4 + 2, 1);
+   memcpy(data, pkt + HDR_LEN, len);
+   data[len] = 0;
+
+   printf("***********************\n");
+   printf("Packet Data...\n");
+   printf("Bytes Read: %d\n", bytes_read);
+   printf("Sequence num: %d\n", ntohl(seq));
+   printf("Checksum: %.04x\n", checksum);
+   printf("Flag: %d\n", flag);
+   printf("Data: %s\n", data);
+   printf("***********************\n");
+}
+  
+
+int32_t udp_client_setup(char * hostname, uint16_t port_num, Connection * connection)
+{
+   struct hostent * hp = NULL;
+
+   connection->sk_num = 0;
+   connection->len = sizeof(struct sockaddr_in);
+
+   if ((connection->sk_num = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+   {
+      perror("udp_client_setup, socket");
+      exit(-1);
+   }
+
+   connection->remote.sin_family = AF_INET;
+
+   hp = gethostbyname(hostname);
+   
+   if (hp == NULL)
+   {
+      printf("Host not found: %s\n", hostname);
+      return -1;
+   }
+
+   memcpy(&(connection->remote.sin_addr), hp->h_addr, hp->h_length);
+
+   connection->remote.sin_port = htons(port_num);
+
+   return 0;
+}
+
+int32_t udp_server(int portNumber)
+{
+   int sk = 0;
+   struct sockaddr_in local;
+   uint32_t len = sizeof(local);
+   
+   if ((sk = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+   {
+      perror("socket");
+      exit(-1);
+   }
+
+   local.sin_family = AF_INET;
+   local.sin_addr.s_addr = INADDR_ANY;
+   local.sin_port = htons(portNumber);
+
+   if (bindMod(sk, (struct sockaddr *)&local, sizeof(local)) < 0)
+   {
+      perror("udp_server, bind");
+      exit(-1);
+   }
+
+   getsockname(sk, (struct sockaddr *)&local, &len);
+   printf("Using Port #: %d\n", ntohs(local.sin_port));
+   
+   return(sk);
+}
+
+// Like udp_server() but with SO_REUSEPORT set before the bind, so several
+// sockets (one per server thread) can share the port and the kernel spreads
+// clients across them. Pass 0 to let the OS pick the port for the first
+// socket, then the port it picked (see getsockname) for the rest.
+int32_t udp_server_reuseport(int portNumber)
+{
+   int sk = 0;
+   int on = 1;
+   struct sockaddr_in local;
+   
+   if ((sk = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+   {
+      perror("socket");
+      exit(-1);
+   }
+
+   if (setsockopt(sk, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+   {
+      perror("udp_server_reuseport, setsockopt");
+      exit(-1);
+   }
+
+   local.sin_family = AF_INET;
+   local.sin_addr.s_addr = INADDR_ANY;
+   local.sin_port = htons(portNumber);
+
+   if (bindMod(sk, (struct sockaddr *)&local, sizeof(local)) < 0)
+   {
+      perror("udp_server_reuseport, bind");
+      exit(-1);
+   }
+
+   return(sk);
+}
+
+int setupUdpClientToServer(struct sockaddr_in6 *server, char * hostName, int portNumber)
+{
+	// currently only setup for IPv4 
+	int socketNum = 0;
+	char ipString[INET6_ADDRSTRLEN];
+	uint8_t * ipAddress = NULL;
+	
+	// create the socket
+	if ((socketNum = socket(AF_INET6, SOCK_DGRAM, 0)) < 0)
+	{
+		perror("socket() call error");
+		exit(-1);
+	}
+  	 	
+	if ((ipAddress = gethostbyname6(hostName, server)) == NULL)
+	{
+		exit(-1);
+	}
+	
+	server->sin6_port = ntohs(portNumber);
+	server->sin6_family = AF_INET6;	
+	
+	inet_ntop(AF_INET6, ipAddress, ipString, sizeof(ipString));
+	printf("Server info - IP: %s Port: %d \n", ipString, portNumber);
+		
+	return socketNum;
+}
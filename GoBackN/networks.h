@@ -16,15 +16,30 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 
+#include "wheel.h"
+
 #define BACKLOG 10
 #define LONG_TIME 10
 #define SHORT_TIME 1
 #define MAX_TRIES 10
 #define HDR_LEN 7
-#define MAX_PAYLOAD 1400
+#define CRC_LEN 4 // CRC32C after the flag when OPT_CRC32C was negotiated
+#define MAX_HDR_LEN (HDR_LEN + CRC_LEN)
+#define DEFAULT_PAYLOAD 1400 // fits any Ethernet path, and the most a control packet carries
+#define UDP_MAX 65507 // largest UDP payload over IPv4
+#define MAX_PAYLOAD (UDP_MAX - MAX_HDR_LEN) // largest payload that can be negotiated
+#define IP_UDP_LEN 28 // IPv4 and UDP headers, taken off the path MTU
+#define PROBE_TRIES 2 // unanswered setups before rcopy asks for DEFAULT_PAYLOAD
 #define TIMER_SET 1
 #define FILE_LEN 100
 #define START_SEQ_NUM 1
+#define BATCH_MAX 64 // datagrams per sendmmsg/recvmmsg call
+#define GSO_MAX_SEGS 64 // datagrams the kernel will cut one UDP_SEGMENT send into
+#define GRO_MAX_SEGS 64 // datagrams the kernel coalesces into one UDP_GRO receive
+#define SACK_MAX (DEFAULT_PAYLOAD - 4) // bytes of SACK bitmap after a RR, 11168 packets
+#define MAX_WINDOW 16384 // most packets a client may ask to have outstanding
+#define STRIPE_MAX 64 // concurrent sessions rcopy -j may split one file over
+#define STRIPE_ALIGN (64 * 1024) // stripes start on multiples of this many bytes
 
 // FLAGS
 #define DATA_FLAG 3
@@ -33,6 +48,16 @@
 #define EOF_FLAG 9
 #define EOF_ACK 10
 #define SEND_ARGS_FLAG 4
+#define SIG_FLAG 11 // OPT_DELTA: a page of rcopy's block sums, the page number as seq
+
+// SETUP OPTIONS (bits of the byte after the file name in the setup packet)
+#define OPT_SELECTIVE 0x01 // selective repeat instead of Go-Back-N
+#define OPT_CRC32C 0x02    // CRC32C instead of the 16 bit in_cksum
+#define OPT_SACK 0x04      // RRs carry a bitmap of packets held above them
+#define OPT_STRIPE 0x08    // fetch one stripe of the file, see getStripe()
+#define OPT_RESUME 0x10    // start at a byte offset, see getResume()
+#define OPT_COMPRESS 0x20  // data packets carry compressed frames, see compress.h
+#define OPT_DELTA 0x40     // only send what rcopy's old copy lacks, see getDelta(), delta.h
 
 // STATES
 #define FILENAME 1
@@ -45,6 +70,10 @@
 #define SETUP 8
 #define RESEND_WINDOW 9
 #define DONE 10
+#define WINDOW_WAIT 11
+#define PACE_WAIT 12
+#define SEND_SIG 13 // rcopy: uploading the signature of its old copy
+#define SIG_WAIT 14 // server: waiting on the rest of the signature
 
 typedef struct connection Connection;
 
@@ -55,27 +84,122 @@ struct connection
    uint32_t len;
 };
 
+/*****
+ * Datagrams queued for one sendmmsg() call. The packets are not copied, so
+ * they must stay put until the batch is flushed. Each datagram can be two
+ * pieces (header and payload) gathered by the kernel. With emulate set
+ * every packet goes straight out through safeSend() instead, so the
+ * sendtoErr drop/flip emulation still sees it. With txtime set (SO_TXTIME,
+ * see enableTxtime()) each datagram carries the sendAt it was queued with
+ * and the qdisc holds it until then. With gso set (see enableGso()) each
+ * run of same-length datagrams goes to the kernel as one UDP_SEGMENT send,
+ * which it cuts back into datagrams only at the bottom of the stack.
+ ****/
+struct sendBatch {
+   Connection * connection;
+   int emulate;
+   int limit;
+   int count;
+   int txtime;
+   int gso;
+   int refused;     // the client's port is closed (ECONNREFUSED), nothing more goes out
+   uint64_t sendAt; // CLOCK_MONOTONIC nanoseconds for the next datagram queued
+   struct mmsghdr msgs[BATCH_MAX];
+   struct iovec iov[2 * BATCH_MAX];
+   char control[BATCH_MAX][CMSG_SPACE(sizeof(uint64_t))];
+   struct mmsghdr gsoMsgs[BATCH_MAX]; // the runs, each over its datagrams' iovecs
+   char gsoControl[BATCH_MAX][CMSG_SPACE(sizeof(uint16_t))];
+   int gsoFirst[BATCH_MAX];           // index in msgs of each run's first datagram
+   uint64_t packets;
+   uint64_t syscalls;
+   uint64_t gsoSends; // UDP_SEGMENT sends, each more than one datagram
+   uint64_t gsoPackets;
+};
+
+/*****
+ * Receive side of the above: one recvmmsg() call fills up to BATCH_MAX
+ * buffers of bufLen bytes each. With gro set (see enableGro()) a buffer
+ * may hold several datagrams the kernel coalesced, all of them gso_size
+ * long but the last. They are split back out into segs, so count and
+ * batchPkt()/batchLen() are still one datagram each.
+ ****/
+struct recvBatch {
+   int count;
+   int bufLen;
+   int gro;
+   u_char * bufs;
+   struct mmsghdr msgs[BATCH_MAX];
+   struct iovec iov[BATCH_MAX];
+   struct sockaddr_in addrs[BATCH_MAX];
+   char control[BATCH_MAX][CMSG_SPACE(sizeof(int))];
+   struct iovec * segs; // gro: the datagrams read, BATCH_MAX * GRO_MAX_SEGS
+   uint64_t packets;
+   uint64_t syscalls;
+   uint64_t groReads;   // buffers that held more than one datagram
+   uint64_t groPackets;
+};
+
 struct packets {
    int32_t seq_num; // 4 bytes
-   u_char packet[HDR_LEN + MAX_PAYLOAD]; // 1407 bytes
+   int32_t len;     // bytes of packet actually used (header + payload)
+   int32_t resent;  // times resent, Karn's rule skips RTT samples from these
+   int32_t sacked;  // the client holds it (SACK) though it is not RR'd yet
+   uint64_t sent;   // when it was last sent, in microseconds
+   uint64_t delivered; // packets the client had RR'd when it was last sent
+   u_char * payload; // payload left in place (mmap'd file), NULL if in packet
+   struct timer timer; // server: retransmit timer while it is outstanding
+   struct packets * nextExpired;   // server: on the session's expired list from when
+   struct packets ** pprevExpired; // its timer runs out until it is resent, NULL if not
+   u_char packet[];    // header and payload, PACKETS_SIZE() says how long
 };
 
+// Bytes a struct packets takes with room for len bytes of packet, rounded
+// up so an array of them stays aligned
+#define PACKETS_SIZE(len) ((sizeof(struct packets) + (len) + 7) & ~(size_t)7)
+
 int safeRecv2(int socketNum, void * buf, int len, int flags);
 int safeSend2(int socketNum, void * buf, int len, int flags);
 int safeRecvfrom(int socketNum, void * buf, int len, int flags, struct sockaddr *srcAddr, int * addrLen);
 int safeSendto(int socketNum, void * buf, int len, int flags, struct sockaddr *srcAddr, int addrLen);
 int32_t select_call(int32_t socketNum, int32_t seconds, int32_t microseconds, int32_t set_null);
+int32_t poll_call(int32_t socketNum, int32_t milliseconds);
+int32_t poll_usec(int32_t socketNum, int64_t microseconds);
 int processSelect(Connection * client, int *retryCount, int selectTimeoutState, int dataReadyState, int doneState);
-int crcCheck(u_char * pkt);
+int crcCheck(u_char * pkt, int len);
+int hdrLen(uint8_t options);
+int checkPkt(u_char * pkt, int len, uint8_t options);
+uint8_t getOptions(u_char * pkt, int len, int nameOffset);
+uint16_t getPayload(u_char * pkt, int len, int nameOffset);
+int getStripe(u_char * pkt, int len, int nameOffset, uint16_t * index, uint16_t * count);
+int getResume(u_char * pkt, int len, int nameOffset, int64_t * offset, int64_t * size);
+int getDelta(u_char * pkt, int len, int nameOffset, uint32_t * blockSize, uint32_t * blocks);
+int getRange(u_char * pkt, int len, int nameOffset, int64_t * start, int64_t * size);
+int pathMtu(Connection * connection);
 void printPkt(u_char * pkt, int bytes_read);
+void initEmulation(double errorRate);
 int32_t safeSend(u_char * pkt, uint32_t len, Connection * connection);
 int32_t safeRecv(int recv_sk_num, u_char * data_buf, int len, Connection * connection);
 
+void initSendBatch(struct sendBatch * batch, Connection * connection, int limit, int emulate);
+int enableTxtime(struct sendBatch * batch);
+int enableGso(struct sendBatch * batch);
+void queueSend(struct sendBatch * batch, u_char * pkt, uint32_t len);
+void queueSendv(struct sendBatch * batch, u_char * hdr, uint32_t hdrLen, u_char * payload, uint32_t payloadLen);
+void flushSend(struct sendBatch * batch);
+void initRecvBatch(struct recvBatch * batch, int bufLen);
+void freeRecvBatch(struct recvBatch * batch);
+int enableGro(struct recvBatch * batch, int sk_num);
+int safeRecvBatch(int recv_sk_num, struct recvBatch * batch, Connection * connection);
+u_char * batchPkt(struct recvBatch * batch, int i);
+int batchLen(struct recvBatch * batch, int i);
+void printBatchStats(char * what, uint64_t packets, uint64_t syscalls);
+
 // for the server side
 int tcpServerSetup(int portNumber);
 int tcpAccept(int server_socket, int debugFlag);
 int udpServerSetup(int portNumber);
 int32_t udp_server(int portNumber);
+int32_t udp_server_reuseport(int portNumber);
 
 // for the client side
 int tcpClientSetup(char * serverName, char * port, int debugFlag);
@@ -0,0 +1,47 @@
+// Paces the server's datagrams at a target rate
+
+#include <stdio.h>
+
+#include "pace.h"
+
+void initPace(struct pace * pace, double rate, int64_t ahead)
+{
+   pace->rate = rate;
+   pace->ahead = ahead;
+   pace->next = 0;
+   pace->waits = 0;
+}
+
+void setPaceRate(struct pace * pace, double rate)
+{
+   pace->rate = rate;
+}
+
+// Microseconds until the next packet may go, 0 if it can go now
+int64_t paceDelay(struct pace * pace, uint64_t now)
+{
+   if (pace->rate <= 0 || pace->next <= now + pace->ahead)
+      return 0;
+
+   return (int64_t)(pace->next - pace->ahead) - now + 1;
+}
+
+/*****
+ * Takes the next slot for a packet of len bytes and returns it, which is
+ * when the packet should leave (never before now).
+ ****/
+uint64_t paceSend(struct pace * pace, uint64_t now, int len)
+{
+   double slot = pace->next > now ? pace->next : now;
+
+   if (pace->rate > 0)
+      pace->next = slot + len / pace->rate;
+
+   return (uint64_t)slot;
+}
+
+void printPaceStats(struct pace * pace, int kernel)
+{
+   printf("Paced at %.1f Mbit/s%s, waited %llu times\n", pace->rate * 8,
+      kernel ? " (SO_TXTIME)" : "", (unsigned long long)pace->waits);
+}
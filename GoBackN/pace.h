@@ -0,0 +1,33 @@
+// Paces the server's datagrams at a target rate
+
+#ifndef __PACE_H__
+#define __PACE_H__
+
+#include <stdint.h>
+
+#define PACE_QUANTUM 100   // microseconds a packet may go ahead of its slot
+#define PACE_HORIZON 1000  // same, when the kernel holds it until its slot
+#define PACE_TIMER_SLACK 1000 // nanoseconds of timer slack while pacing
+
+/*****
+ * Per connection pacing. Every packet gets a slot len / rate microseconds
+ * after the one before it. A packet may be handed to the kernel up to ahead
+ * microseconds before its slot, so the sender wakes once per quantum rather
+ * than once per packet; with SO_TXTIME the kernel holds it until the slot,
+ * so ahead can be longer. An idle connection earns no credit: the first
+ * packet after a pause gets a slot no earlier than now.
+ ****/
+struct pace {
+   double rate;    // bytes per microsecond, 0 sends as fast as it can
+   int64_t ahead;
+   double next;    // slot of the next packet, microseconds
+   uint64_t waits; // times the sender had to wait for a slot
+};
+
+void initPace(struct pace * pace, double rate, int64_t ahead);
+void setPaceRate(struct pace * pace, double rate);
+int64_t paceDelay(struct pace * pace, uint64_t now);
+uint64_t paceSend(struct pace * pace, uint64_t now, int len);
+void printPaceStats(struct pace * pace, int kernel);
+
+#endif
@@ -7,8 +7,10 @@
 #include <sys/stat.h>
 #include <sys/uio.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <endian.h>
 #include <string.h>
 #include <strings.h>
 #include <sys/socket.h>
@@ -16,7 +18,15 @@
 #include <netdb.h>
 
 #include "networks.h"
+#include "reorder.h"
+#include "ack.h"
+#include "rtt.h"
+#include "writer.h"
+#include "checkpoint.h"
+#include "compress.h"
+#include "delta.h"
 #include "libcpe464/networks/checksum.h"
+#include "crc32c.h"
 #include "cpe464.h"
 
 #define MAXBUF 80
@@ -24,64 +34,220 @@
 #define str(a) #a
 
 #define HDR_LEN 7
-#define MAX_PAYLOAD 1400
 #define TIMER_SET 1
+#define SIG_TIMEOUT 200000 // usec without a RR before unacknowledged signature pages go again
+#define SIG_DUPS 3         // RRs for the same page that resend it
+
+struct rcopyArgs {
+   char * toFile;
+   char * fromFile;
+   int16_t windowSize;
+   uint16_t bufSize; // payload bytes per packet to ask for
+   double errorRate;
+   char * remoteMachine;
+   int portNumber;
+   uint8_t options; // setup options to ask the server for
+   int ackEvery;    // -n: RR once this many packets are waiting on one
+   int64_t ackDelay; // -d: or this many microseconds after the first
+   int64_t srejGap;  // -r: least microseconds between SREJs for a hole
+   int noGro;        // -g: read datagram by datagram, no UDP_GRO
+   int jobs;         // -j: fetch the file as this many stripes at once
+   int stripe;       // which of them this process fetches
+   int resume;       // -c: start where an earlier run's checkpoint says
+   int delta;        // -u: only fetch what the old local-TO-file lacks
+};
+
+/*****
+ * Receive side state for one transfer. expected is the next in-order
+ * sequence number and highest the largest one seen so far; in selective
+ * repeat mode anything between them that arrived early waits in reorder.
+ ****/
+struct receiver {
+   Connection * server;
+   struct writer out;
+   int32_t my_seq;
+   int32_t expected;
+   int32_t highest;
+   uint8_t options; // setup options the server accepted
+   int payload;     // payload bytes per packet the server settled on
+   int64_t start;   // OPT_STRIPE, OPT_RESUME: where the data goes in the output file
+   int64_t size;    // the whole file's length, -1 if the server did not say
+   int complete;    // the EOF arrived with everything before it written
+   struct checkpoint ckpt;
+   struct decompressor unzip; // OPT_COMPRESS: frames on their way to the writer
+   int basis;       // -u: the old copy, -1 if there is none to build on
+   struct signature sig;      // its block sums
+   struct deltaReceiver delta; // OPT_DELTA: ops on their way to the writer
+   char partial[FILE_LEN + 8]; // OPT_DELTA: where the new copy is built
+   uint64_t heard;  // when the server was last heard from, microseconds
+   struct reorder reorder;
+   struct ackPolicy ack;
+   struct recvBatch batch;
+};
 
 void talkToServer(int socketNum, struct sockaddr_in6 server);
 int getData(char * buffer);
-int checkArgs(int argc, char * argv[]);
+void checkArgs(int argc, char * argv[], struct rcopyArgs * args);
+void usage(char * name);
 void fileTransfer(int socketNum, struct sockaddr_in6 server, char * file);
 
-void processClient(Connection * server, char * outputFile, char * srcFile, int16_t *windowSize, int16_t *bufSize);
-void fillPkt(u_char *pkt, uint32_t seq, uint8_t flag, char *data);
-int fileCheck(Connection * server, char * file, int16_t *windowSize, int16_t *bufSize);
-int recvData(Connection * server, char * outputFile, int32_t * my_seq);
+int processClient(Connection * server, struct rcopyArgs * args);
+int fetchStripes(struct rcopyArgs * args);
+int fillPkt(u_char *pkt, uint32_t seq, uint8_t flag, char *data, int len, uint8_t options);
+int fileCheck(Connection * server, struct rcopyArgs * args, struct receiver * rx);
+int createFile(int * outputFD, char * outputFile, int64_t size);
+int sendSignature(struct receiver * rx, struct rcopyArgs * args);
+int recvData(struct receiver * rx);
+int recvPacket(struct receiver * rx, u_char * dataBuf, int recv_len);
+int copyChecked(struct receiver * rx, u_char * dataBuf, int recv_len);
+int deliverPacket(struct receiver * rx, u_char * dataBuf, int recv_len, int copied);
+void sendAck(struct receiver * rx, uint8_t flag, int32_t seq_num);
 
 
 int main (int argc, char *argv[])
  {
 	int32_t socketNum = 0;				
-	int portNumber = 0;
-   static int16_t windowSize;
-   static int16_t bufSize;
-	portNumber = checkArgs(argc, argv);
+   static struct rcopyArgs args;
    Connection server;  
 
-   sendtoErr_init(atof(argv[5]), DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON);
+	checkArgs(argc, argv, &args);
 
-   if( (socketNum = udp_client_setup(argv[6], portNumber, &server)) < 0)
+   initEmulation(args.errorRate);
+
+   if (args.jobs > 1)
+      return fetchStripes(&args);
+
+   if( (socketNum = udp_client_setup(args.remoteMachine, args.portNumber, &server)) < 0)
    {
       printf("Could not connect to server\n");
       exit(-1);
    }
    
-   windowSize = atoi(argv[3]);
-   bufSize = atoi(argv[4]);
-   processClient(&server, argv[1], argv[2], &windowSize, &bufSize);
+   processClient(&server, &args);
 
 	close(socketNum);
    
    return 0;
 }
 
-void processClient(Connection * server, char * outputFile, char * srcFile, int16_t *windowSize, int16_t *bufSize)
+/*****
+ * -j: forks one rcopy per stripe, each with its own socket and so its own
+ * session on the server, which reads its byte range with pread() while
+ * the child writes it at the same offset in the output file. The stripes
+ * run side by side, so a round trip or a loss only stalls one of them.
+ * Returns 0 once every stripe has arrived, 1 if any did not.
+ ****/
+int fetchStripes(struct rcopyArgs * args)
+{
+   Connection server;
+   pid_t pids[STRIPE_MAX];
+   int failed = 0;
+   int status;
+   int i;
+
+   fflush(stdout); // or every child prints it again
+   for (i = 0; i < args->jobs; i++)
+   {
+      if ((pids[i] = fork()) < 0)
+      {
+         perror("fetchStripes: fork");
+         exit(-1);
+      }
+
+      if (pids[i] == 0) {
+         args->stripe = i;
+         if (udp_client_setup(args->remoteMachine, args->portNumber, &server) < 0)
+         {
+            printf("Could not connect to server\n");
+            exit(1);
+         }
+         exit(processClient(&server, args) == 0 ? 0 : 1);
+      }
+   }
+
+   for (i = 0; i < args->jobs; i++)
+   {
+      if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      {
+         printf("Stripe %d of %d did not arrive\n", i, args->jobs);
+         failed = 1;
+      }
+   }
+
+   return failed;
+}
+
+/*****
+ * Fetches the file, or with -j one stripe of it. Returns 0 if it all
+ * arrived and -1 if not.
+ ****/
+int processClient(Connection * server, struct rcopyArgs * args)
 { 
    int state = FILENAME;
    int32_t outputFD = 0;
-   static int32_t my_seq = START_SEQ_NUM + 1;
+   struct receiver rx;
+
+   memset(&rx, 0, sizeof(struct receiver));
+   rx.server = server;
+   rx.size = -1;
+   rx.my_seq = START_SEQ_NUM + 1;
+   rx.expected = START_SEQ_NUM + 1;
+   rx.highest = START_SEQ_NUM;
+   rx.basis = -1;
+
+   // -u: the delta is against the old copy, if there is one worth signing
+   if (args->delta && (rx.basis = open(args->toFile, O_RDONLY)) >= 0
+      && buildSignature(&rx.sig, rx.basis) < 0)
+   {
+      close(rx.basis);
+      rx.basis = -1;
+   }
+   if (rx.basis >= 0)
+      printf("Signature of %s: %d blocks of %d bytes\n", args->toFile, rx.sig.blocks,
+         rx.sig.blockSize);
+
+   initCheckpoint(&rx.ckpt, args->toFile, args->fromFile, args->stripe, args->jobs);
+   if (args->resume && loadCheckpoint(&rx.ckpt) == 0)
+      printf("Checkpoint %s at byte %lld\n", rx.ckpt.path, (long long)rx.ckpt.offset);
 
    while (state != DONE)
    {
       switch (state)
       {
          case FILENAME:
-            state = fileCheck(server, srcFile, windowSize, bufSize);
+            state = fileCheck(server, args, &rx);
             break;
          case FILE_STATUS:
-            state = createFile(&outputFD, outputFile);
+            // a delta is built beside the old copy, which it reads from; a
+            // stripe or a resume writes into the file as it is
+            if (rx.options & OPT_DELTA) {
+               snprintf(rx.partial, sizeof(rx.partial), "%s.part", args->toFile);
+               state = createFile(&outputFD, rx.partial, -1);
+               initDeltaReceiver(&rx.delta, rx.basis, rx.sig.blockSize, rx.sig.blocks);
+            } else {
+               state = createFile(&outputFD, args->toFile,
+                  (rx.options & OPT_STRIPE) || rx.start > 0 ? rx.size : -1);
+            }
+            if (state == RECV_DATA)
+               initWriter(&rx.out, outputFD, rx.start, WRITE_BUF);
+            // buffers only need to hold packets of the size the server picked
+            initRecvBatch(&rx.batch, hdrLen(rx.options) + rx.payload);
+            if (!args->noGro)
+               enableGro(&rx.batch, server->sk_num);
+            if (rx.options & OPT_COMPRESS)
+               initDecompressor(&rx.unzip);
+            if (rx.options & OPT_SELECTIVE)
+               initReorder(&rx.reorder, args->windowSize, hdrLen(rx.options) + rx.payload);
+            initAckPolicy(&rx.ack, args->ackEvery, args->ackDelay, args->srejGap,
+               args->windowSize);
+            if (state == RECV_DATA && (rx.options & OPT_DELTA))
+               state = SEND_SIG;
+            break;
+         case SEND_SIG:
+            state = sendSignature(&rx, args);
             break;
          case RECV_DATA:
-            state = recvData(server, outputFile, &my_seq);
+            state = recvData(&rx);
             break;
          case DONE:
             break;
@@ -90,132 +256,591 @@ void processClient(Connection * server, char * outputFile, char * srcFile, int16
             break;
       }
    }
+
+   if (rx.batch.packets > 0)
+      printBatchStats("Received", rx.batch.packets, rx.batch.syscalls);
+   if (rx.batch.groReads > 0)
+      printf("GRO %llu packets in %llu coalesced reads (%.1f packets/read)\n",
+         (unsigned long long)rx.batch.groPackets, (unsigned long long)rx.batch.groReads,
+         (double)rx.batch.groPackets / rx.batch.groReads);
+
+   if (rx.out.buf != NULL)
+   {
+      flushWriter(&rx.out);
+      printf("Wrote %llu bytes in %llu writes\n", (unsigned long long)rx.out.bytes,
+         (unsigned long long)rx.out.writes);
+
+      // keep what did arrive for rcopy -c, or drop the checkpoint once it all
+      // has. Part of a delta is no use without the rest, so it is not kept.
+      if (rx.complete)
+         removeCheckpoint(&rx.ckpt);
+      else if (!(rx.options & OPT_DELTA) && rx.out.offset > rx.start
+         && saveCheckpoint(&rx.ckpt, rx.out.fd, rx.out.offset) == 0)
+      {
+         printf("Checkpoint %s at byte %lld, -c picks up from there\n", rx.ckpt.path,
+            (long long)rx.ckpt.offset);
+      }
+
+      freeWriter(&rx.out);
+      close(outputFD);
+
+      // the new copy only replaces the old one once it is all there
+      if ((rx.options & OPT_DELTA) && rx.complete && rename(rx.partial, args->toFile) < 0)
+      {
+         perror("processClient: rename");
+         rx.complete = 0;
+      }
+      if ((rx.options & OPT_DELTA) && !rx.complete)
+         unlink(rx.partial);
+   }
+
+   if (rx.delta.copied + rx.delta.literal > 0)
+      printDeltaReceived(&rx.delta);
+   freeSignature(&rx.sig);
+   if (rx.basis >= 0)
+      close(rx.basis);
+
+   if (rx.unzip.blocks > 0)
+      printDecompressStats(&rx.unzip);
+   freeDecompressor(&rx.unzip);
+
+   if (rx.ack.holes != NULL) {
+      printAckStats(&rx.ack);
+      freeAckPolicy(&rx.ack);
+   }
+
+   if (rx.reorder.slots != NULL)
+      freeReorder(&rx.reorder);
+   freeRecvBatch(&rx.batch);
+
+   return rx.complete ? 0 : -1;
 }
 
-int recvData(Connection * server, char * outputFile, int32_t * my_seq)
+/*****
+ * OPT_DELTA: sends the signature of the old copy before any data comes,
+ * as many sums to a page as fit in a data packet (SIG_FLAG, the page
+ * number as the sequence number), up to a window of pages past the first
+ * one the server still needs. The server RRs every page with that first
+ * missing page: SIG_DUPS RRs for the same one resend it, and SIG_TIMEOUT
+ * without a RR resends everything not acknowledged yet, up to MAX_TRIES
+ * times. Data instead of a RR means the server has the whole signature and
+ * its last RR was lost, so the data is handled as usual.
+ ****/
+int sendSignature(struct receiver * rx, struct rcopyArgs * args)
 {
-   int32_t seq_num = 0;
-   int32_t data_len = 0;
-   uint8_t flag = 0;
-   u_char dataBuf[HDR_LEN + MAX_PAYLOAD];
-   u_char packet[HDR_LEN + MAX_PAYLOAD];
-   int serverAddrLen = sizeof(server);
-   FILE *fptr = fopen(outputFile, "a");
-   static int32_t expected_seq_num = START_SEQ_NUM + 1;   
+   int perPage = rx->payload / DELTA_SUM_LEN;
+   int pages = signaturePages(&rx->sig, perPage);
+   u_char page[perPage * DELTA_SUM_LEN];
+   u_char pkt[MAX_HDR_LEN + sizeof(page)];
+   int hdr_len = hdrLen(rx->options);
+   int state = SEND_SIG;
+   int acked = 0;
+   int next = 0;
+   int resent = -1;
+   int dups = 0;
+   int tries = 0;
+   int32_t rr;
+   u_char * data;
+   int len;
+   int i;
+
+   while (state == SEND_SIG)
+   {
+      for (; next < pages && next < acked + args->windowSize; next++) {
+         len = signaturePage(&rx->sig, next, perPage, page);
+         len = fillPkt(pkt, next, SIG_FLAG, (char *)page, len, rx->options);
+         safeSend(pkt, len, rx->server);
+      }
 
-   if (select_call(server->sk_num, LONG_TIME, 0, TIMER_SET) == 0)
+      if (poll_usec(rx->server->sk_num, SIG_TIMEOUT) == 0)
+      {
+         if (++tries > MAX_TRIES) {
+            printf("No answer to the signature, server must be gone.\n");
+            return DONE;
+         }
+         next = acked;
+         resent = -1;
+         continue;
+      }
+
+      safeRecvBatch(rx->server->sk_num, &rx->batch, rx->server);
+
+      for (i = 0; i < rx->batch.count && state != DONE; i++)
+      {
+         data = batchPkt(&rx->batch, i);
+         len = batchLen(&rx->batch, i);
+
+         if (state == RECV_DATA) {
+            state = recvPacket(rx, data, len);
+            continue;
+         }
+         if (len < HDR_LEN || checkPkt(data, len, rx->options) == 1)
+            continue;
+         if (data[6] != RR) {
+            state = recvPacket(rx, data, len);
+            continue;
+         }
+         if (len < hdr_len + 4)
+            continue;
+
+         memcpy(&rr, data + hdr_len, 4);
+         rr = ntohl(rr);
+         if (rr > acked) {
+            acked = rr;
+            dups = 0;
+            tries = 0;
+            if (next < acked)
+               next = acked;
+         } else if (rr == acked && ++dups >= SIG_DUPS && resent != acked && acked < pages) {
+            len = signaturePage(&rx->sig, acked, perPage, page);
+            len = fillPkt(pkt, acked, SIG_FLAG, (char *)page, len, rx->options);
+            safeSend(pkt, len, rx->server);
+            resent = acked;
+         }
+
+         if (acked >= pages)
+            state = RECV_DATA;
+      }
+   }
+
+   return state;
+}
+
+/*****
+ * Waits for data, then reads every datagram already queued on the socket
+ * with one recvmmsg() and handles them in order. While packets are waiting
+ * on a delayed RR, or a SREJ'd packet is still missing, it only waits until
+ * the RR is due or the packet may be SREJ'd again, and sends that if
+ * nothing came in first.
+ ****/
+int recvData(struct receiver * rx)
+{
+   int state = RECV_DATA;
+   uint64_t now = nowUsec();
+   int64_t wait = ackWait(&rx->ack, now);
+   int64_t srej = srejWait(&rx->ack, rx->expected, now);
+   uint64_t giveUp;
+   int i;
+
+   if (rx->heard == 0)
+      rx->heard = now;
+   giveUp = rx->heard + LONG_TIME * 1000000LL;
+
+   if (srej >= 0 && (wait < 0 || srej < wait))
+      wait = srej;
+   if (wait < 0 || now + wait > giveUp)
+      wait = giveUp > now ? giveUp - now : 0;
+
+   if (poll_usec(rx->server->sk_num, wait) == 0)
    {
-      printf("Timeout after 10 seconds, server must be gone.\n");
-      fclose(fptr);
-      return DONE;
+      now = nowUsec();
+      if (now >= giveUp)
+      {
+         printf("Timeout after 10 seconds, server must be gone.\n");
+         return DONE;
+      }
+
+      if (ackDue(&rx->ack, now))
+         sendAck(rx, RR, rx->expected);
+      if (srejWait(&rx->ack, rx->expected, now) == 0
+         && srejAllowed(&rx->ack, rx->expected, now))
+      {
+         sendAck(rx, SREJ, rx->expected);
+      }
+      return RECV_DATA;
    }
-   
-   memset(dataBuf, 0, HDR_LEN + MAX_PAYLOAD);
-   memset(packet, 0, HDR_LEN + MAX_PAYLOAD);
 
-   safeRecv(server->sk_num, dataBuf, HDR_LEN + MAX_PAYLOAD, server);
- 
+   rx->heard = nowUsec();
+   safeRecvBatch(rx->server->sk_num, &rx->batch, rx->server);
+
+   for (i = 0; i < rx->batch.count && state == RECV_DATA; i++)
+      state = recvPacket(rx, batchPkt(&rx->batch, i), batchLen(&rx->batch, i));
+
+   if (state == RECV_DATA && !(rx->options & OPT_DELTA)
+      && rx->out.offset >= rx->ckpt.offset + CHECKPOINT_EVERY)
+      saveCheckpoint(&rx->ckpt, rx->out.fd, rx->out.offset);
+
+   // with no delay to wait on, the batch gets one RR for whatever it left
+   if (state == RECV_DATA && (ackDue(&rx->ack, nowUsec())
+      || (rx->ack.delay == 0 && rx->ack.pending > 0)))
+   {
+      sendAck(rx, RR, rx->expected);
+   }
+
+   return state;
+}
+
+/*****
+ * Handles one data or EOF packet. In-order packets are RR'd as the ack
+ * policy (ack.c) allows, straight away if they let early packets through.
+ * In Go-Back-N mode an early packet is dropped and answered with a SREJ for
+ * the expected packet. In selective-repeat mode early packets are buffered
+ * and each newly noticed gap is SREJ'd straight away. Either way a hole is
+ * SREJ'd again only once a round trip has passed. Duplicates get a RR.
+ ****/
+int recvPacket(struct receiver * rx, u_char * dataBuf, int recv_len)
+{
+   int32_t seq_num = 0;
+   int32_t missing;
+   int state = RECV_DATA;
+   int copied = 0;
+   int corrupt;
+   int held;
+   uint64_t now;
+   struct packets * early;
+
+   if (recv_len < hdrLen(rx->options))
+      return RECV_DATA;
+
    memcpy(&seq_num, dataBuf, 4);
-   flag = dataBuf[6];
    seq_num = ntohl(seq_num);
 
-   // recvData again if there is a crc error
-   if (crcCheck(dataBuf) == 1) {
-      fclose(fptr);
+   // recvData again if there is a crc error. The packet we are waiting on
+   // is checked as it is copied out, anything else before it is looked at.
+   // Compressed and delta payloads are not the file's bytes, so they are
+   // checked first.
+   if (seq_num == rx->expected && dataBuf[6] != EOF_FLAG
+      && !(rx->options & (OPT_COMPRESS | OPT_DELTA)))
+   {
+      if ((corrupt = copyChecked(rx, dataBuf, recv_len)) != 0)
+         return corrupt < 0 ? DONE : RECV_DATA;
+      copied = 1;
+   } else if (checkPkt(dataBuf, recv_len, rx->options) == 1) {
       return RECV_DATA;
    }
 
-   if (flag == EOF_FLAG) {
-      // Send ACK
-      fillPkt(packet, *my_seq, EOF_ACK, &expected_seq_num);
-      safeSend(packet, HDR_LEN + MAX_PAYLOAD, server);
-      fclose(fptr);
+   now = nowUsec();
+   rx->ack.packets++;
+
+   // if packet is what we are expecting
+   if (seq_num == rx->expected) {
+      holeFilled(&rx->ack, seq_num, now);
+      held = rx->reorder.count;
+      state = deliverPacket(rx, dataBuf, recv_len, copied);
+
+      // hand over anything it was holding up
+      while (state == RECV_DATA && rx->reorder.count > 0
+         && (early = takeFromReorder(&rx->reorder, rx->expected)) != NULL)
+      {
+         state = deliverPacket(rx, early->packet, early->len, 0);
+      }
+
+      if (state != RECV_DATA)
+         return state;
+
+      ackPacket(&rx->ack, now);
+      if (rx->reorder.count < held || ackDue(&rx->ack, now))
+         sendAck(rx, RR, rx->expected);
+      return state;
+   }
+
+   if (!(rx->options & OPT_SELECTIVE)) { // not what we are expecting
+      if (seq_num < rx->expected)
+         sendAck(rx, RR, rx->expected);
+      else if (srejAllowed(&rx->ack, rx->expected, now))
+         sendAck(rx, SREJ, rx->expected);
+      return RECV_DATA;
+   }
+
+   if (seq_num > rx->expected && seq_num < rx->expected + rx->reorder.size) {
+      saveToReorder(&rx->reorder, seq_num, dataBuf, recv_len);
+      holeFilled(&rx->ack, seq_num, now);
+
+      if (seq_num > rx->highest + 1) {
+         // a new gap, SREJ what it skipped straight away
+         for (missing = rx->highest + 1; missing < seq_num; missing++) {
+            if (missing >= rx->expected && !inReorder(&rx->reorder, missing)
+               && srejAllowed(&rx->ack, missing, now))
+            {
+               sendAck(rx, SREJ, missing);
+            }
+         }
+         rx->highest = seq_num;
+
+         // with SACK the server also hears which packets are held
+         if (rx->options & OPT_SACK)
+            sendAck(rx, RR, rx->expected);
+         return RECV_DATA;
+      }
+
+      // the packet holding everything up, again if its resend got lost
+      if (srejAllowed(&rx->ack, rx->expected, now))
+         sendAck(rx, SREJ, rx->expected);
+      if (seq_num > rx->highest)
+         rx->highest = seq_num;
+
+      // without SACK a RR could not say anything about an early packet
+      if (rx->options & OPT_SACK) {
+         ackPacket(&rx->ack, now);
+         if (ackDue(&rx->ack, now))
+            sendAck(rx, RR, rx->expected);
+      }
+      return RECV_DATA;
+   }
+
+   // duplicate, or a resend filling a gap below the newest packet
+   sendAck(rx, RR, rx->expected);
+
+   return RECV_DATA;
+}
+
+/*****
+ * Copies the payload into the writer's buffer while checking the packet's
+ * checksum, so the bytes are read once instead of once to check and once
+ * to copy. The copy is only kept if the packet is good. Returns 0 if it
+ * was, 1 if it was corrupt and -1 if the writer failed.
+ ****/
+int copyChecked(struct receiver * rx, u_char * dataBuf, int recv_len)
+{
+   u_char * dst;
+   unsigned int sum;
+   uint32_t crc;
+   int hdr_len = hdrLen(rx->options);
+   int len = recv_len - hdr_len;
+
+   if ((dst = reserveData(&rx->out, len)) == NULL)
+      return -1;
+
+   if (rx->options & OPT_CRC32C) {
+      crc = crc32c(0, dataBuf, HDR_LEN);
+      crc = htonl(crc32cCopy(crc, dst, dataBuf + hdr_len, len));
+      if (memcmp(&crc, dataBuf + HDR_LEN, CRC_LEN) != 0)
+         return 1;
+
+      commitData(&rx->out, len);
+      return 0;
+   }
+
+   sum = in_cksum_add(0, dataBuf, HDR_LEN, 0);
+   sum = in_cksum_copy(sum, dst, dataBuf + HDR_LEN, len, HDR_LEN);
+   if (in_cksum_fold(sum) != 0)
+      return 1;
+
+   commitData(&rx->out, len);
+   return 0;
+}
+
+/*****
+ * Hands the in-order packet's payload to the writer, unless copyChecked()
+ * already has, or with OPT_COMPRESS to the decompressor and with OPT_DELTA
+ * to the delta's ops, and moves expected past it. The EOF packet is only accepted here, once everything before it
+ * has arrived.
+ ****/
+int deliverPacket(struct receiver * rx, u_char * dataBuf, int recv_len, int copied)
+{
+   if (dataBuf[6] == EOF_FLAG) {
+      if ((rx->options & OPT_COMPRESS) && !framesDone(&rx->unzip)) {
+         printf("Compressed data ends part way through a block\n");
+         return DONE;
+      }
+      if ((rx->options & OPT_DELTA) && !deltaDone(&rx->delta)) {
+         printf("Delta ends part way through an op\n");
+         return DONE;
+      }
+
+      // only ACK once the whole file has made it to disk
+      if (flushWriter(&rx->out) == 0) {
+         sendAck(rx, EOF_ACK, rx->expected);
+         rx->complete = 1;
+      }
       return DONE;
    }
 
-   // if packet is what we are expecting
-   if (seq_num == expected_seq_num) {
-      expected_seq_num++;
-      expected_seq_num = htonl(expected_seq_num);
-      fillPkt(packet, *my_seq, RR, &expected_seq_num);
-      fwrite(dataBuf + HDR_LEN, 1, strlen(dataBuf + HDR_LEN), fptr);
-      fclose(fptr);
-   } else { // not what we are expecting
-      expected_seq_num = htonl(expected_seq_num);
-      fillPkt(packet, *my_seq, SREJ, &expected_seq_num);
-      fclose(fptr);
-   } 
+   int hdr_len = hdrLen(rx->options);
 
-   expected_seq_num = ntohl(expected_seq_num);   
+   if (rx->options & OPT_COMPRESS) {
+      if (takeFrames(&rx->unzip, dataBuf + hdr_len, recv_len - hdr_len, &rx->out) < 0) {
+         printf("Compressed data is corrupt or could not be written\n");
+         return DONE;
+      }
+   } else if (rx->options & OPT_DELTA) {
+      if (takeDelta(&rx->delta, dataBuf + hdr_len, recv_len - hdr_len, &rx->out) < 0) {
+         printf("Delta data is corrupt, or the old copy could not be read\n");
+         return DONE;
+      }
+   } else if (!copied && writeData(&rx->out, dataBuf + hdr_len, recv_len - hdr_len) < 0) {
+      return DONE;
+   }
 
-   (*my_seq)++;
-   safeSend(packet, HDR_LEN + MAX_PAYLOAD, server);
+   rx->expected++;
+   if (rx->highest < rx->expected - 1)
+      rx->highest = rx->expected - 1;
 
    return RECV_DATA;
-} 
+}
 
-// returns state
-int fileCheck(Connection * server, char * file, int16_t * windowSize, int16_t * buffSize)
+/*****
+ * Sends a RR, SREJ or EOF_ACK for seq_num. With OPT_SACK a RR also carries
+ * a bitmap of the packets held above it (sackMap()).
+ ****/
+void sendAck(struct receiver * rx, uint8_t flag, int32_t seq_num)
 {
-   u_char pkt[HDR_LEN + MAX_PAYLOAD];
-   u_char recv[HDR_LEN + MAX_PAYLOAD];
-   u_char stats[103];
+   u_char packet[MAX_HDR_LEN + 4 + SACK_MAX];
+   u_char ack[4 + SACK_MAX];
+   int ack_len = 4;
+   int packet_len = 0;
+
+   seq_num = htonl(seq_num);
+   memcpy(ack, &seq_num, 4);
+
+   if (flag == RR && (rx->options & OPT_SACK))
+      ack_len += sackMap(&rx->reorder, rx->expected, rx->highest, ack + 4);
+
+   packet_len = fillPkt(packet, rx->my_seq, flag, (char *)ack, ack_len, rx->options);
+
+   rx->my_seq++;
+   ackSent(&rx->ack, flag);
+   safeSend(packet, packet_len, rx->server);
+}
+
+/*****
+ * Sends the setup packet and reads the reply. Returns the state. The reply
+ * says which options and payload size the server settled on, and is padded
+ * to a full data packet's length to probe the path: if PROBE_TRIES setups
+ * asking for more than DEFAULT_PAYLOAD go unanswered, packets that big may
+ * not get through, so the rest ask for DEFAULT_PAYLOAD. With -j the setup
+ * asks for one stripe (OPT_STRIPE). It always asks to start where the
+ * checkpoint says (OPT_RESUME, byte 0 without -c or a checkpoint), and
+ * the reply says where the server did start and how big the file is.
+ ****/
+int fileCheck(Connection * server, struct rcopyArgs * args, struct receiver * rx)
+{
+   u_char pkt[HDR_LEN + DEFAULT_PAYLOAD];
+   u_char recv[MAX_HDR_LEN + MAX_PAYLOAD];
+   u_char setup[4 + FILE_LEN + 2 + 4 + 16 + 8];
+   char * file = args->fromFile;
+   int setup_len = 0;
+   int pkt_len = 0;
+   int recv_len = 0;
    int serverAddrLen = sizeof(server);
    static int retryCount = 0; 
    int returnVal = FILENAME;
    int16_t ws;
-   int16_t bs;
-   unsigned short cksum = 0;
-   u_char tmp[1];
+   uint16_t bs;
+   uint16_t stripe;
+   uint64_t resume;
+   uint32_t sig;
 
    // Send first packet. This implies that the window is closed and we select
-   // for 1-second waiting on RRs.
-   fillPkt(pkt, 1, 1, tmp);
-
-   ws = htons((int16_t)*windowSize);
-   bs = htons((int16_t)*buffSize);
-
-   memset(pkt + HDR_LEN, 0, MAX_PAYLOAD);
-   memcpy(pkt + HDR_LEN, &ws, 2);
-   memcpy(pkt + HDR_LEN + 2, &bs, 2);
-   memcpy(pkt + HDR_LEN + 2 + 2, file, strlen(file));
+   // for 1-second waiting on RRs. The payload is window size, buffer size,
+   // the NUL terminated file name, the options byte, for a stripe its index
+   // and the number of stripes, then the offset to resume at and the file
+   // size the checkpoint was for, and with -u the signature's block size
+   // and count.
+   if (retryCount == PROBE_TRIES && args->bufSize > DEFAULT_PAYLOAD) {
+      printf("No answer asking for %d byte packets, asking for %d\n", args->bufSize,
+         DEFAULT_PAYLOAD);
+      args->bufSize = DEFAULT_PAYLOAD;
+   }
 
-   memcpy(&ws, pkt + HDR_LEN, 2);
-   memcpy(&bs, pkt + HDR_LEN + 2, 2);
+   ws = htons((int16_t)args->windowSize);
+   bs = htons(args->bufSize);
+
+   memcpy(setup, &ws, 2);
+   memcpy(setup + 2, &bs, 2);
+   memcpy(setup + 2 + 2, file, strlen(file) + 1);
+   setup_len = 4 + strlen(file) + 1;
+   if (args->jobs > 1) {
+      setup[setup_len++] = args->options | OPT_STRIPE | OPT_RESUME;
+      stripe = htons(args->stripe);
+      memcpy(setup + setup_len, &stripe, 2);
+      stripe = htons(args->jobs);
+      memcpy(setup + setup_len + 2, &stripe, 2);
+      setup_len += 4;
+   } else {
+      setup[setup_len++] = args->options | OPT_RESUME | (rx->basis >= 0 ? OPT_DELTA : 0);
+   }
+   resume = htobe64(rx->ckpt.offset);
+   memcpy(setup + setup_len, &resume, 8);
+   resume = htobe64(rx->ckpt.size);
+   memcpy(setup + setup_len + 8, &resume, 8);
+   setup_len += 16;
+   if (rx->basis >= 0) {
+      sig = htonl(rx->sig.blockSize);
+      memcpy(setup + setup_len, &sig, 4);
+      sig = htonl(rx->sig.blocks);
+      memcpy(setup + setup_len + 4, &sig, 4);
+      setup_len += 8;
+   }
 
-   memset(pkt + 4, 0, 2);
-   cksum = in_cksum((unsigned short *)pkt, HDR_LEN + MAX_PAYLOAD);
-   memcpy(pkt + 4, &cksum, 2);
+   pkt_len = fillPkt(pkt, 1, 1, setup, setup_len, 0);
  
-   safeSend(pkt, HDR_LEN + MAX_PAYLOAD, server);
+   safeSend(pkt, pkt_len, server);
  
    if ((returnVal = processSelect(server, &retryCount, FILENAME, FILE_STATUS, DONE)) == FILE_STATUS)
    {  
       // Socket is ready to recv data
-      safeRecv(server->sk_num, recv, HDR_LEN + MAX_PAYLOAD, server);
+      recv_len = safeRecv(server->sk_num, recv, MAX_HDR_LEN + MAX_PAYLOAD, server);
        
-      // Corrupt Data
-      if(crcCheck(recv) == 1)
-         return returnVal;
+      // Corrupt Data. Ask again rather than go on without knowing what the
+      // server accepted; it answers a repeated setup with the same reply
+      if(crcCheck(recv, recv_len) == 1)
+         return FILENAME;
 
       if (recv[6] == 2) {
          returnVal = FILE_STATUS; // file is ok so create output file and recv data
-      } else  {
-         returnVal = DONE;
+         rx->options = getOptions(recv, recv_len, HDR_LEN);
+         // a server that does not say uses what was asked for
+         if ((rx->payload = getPayload(recv, recv_len, HDR_LEN)) == 0)
+            rx->payload = args->bufSize;
+
+         if ((rx->options & (OPT_STRIPE | OPT_RESUME))
+            && getRange(recv, recv_len, HDR_LEN, &rx->start, &rx->size) < 0)
+         {
+            rx->options &= ~(OPT_STRIPE | OPT_RESUME);
+         }
+
+         if (rx->ckpt.offset > 0 && rx->start != rx->ckpt.offset)
+            printf("%s, starting from byte %lld\n", (rx->options & OPT_RESUME)
+               ? "Checkpoint does not match the remote file" : "Server cannot resume",
+               (long long)rx->start);
+         // saves from here on are for this file, and count from where it starts
+         rx->ckpt.offset = rx->start;
+         rx->ckpt.size = rx->size;
+
+         if (rx->options & OPT_STRIPE) {
+            printf("Stripe %d of %d from byte %lld of %lld\n", args->stripe, args->jobs,
+               (long long)rx->start, (long long)rx->size);
+         } else if (args->jobs > 1 && args->stripe > 0) {
+            // a server that does not stripe sends stripe 0 the whole file
+            printf("Server does not stripe, stripe 0 fetches the file\n");
+            rx->complete = 1;
+            returnVal = DONE;
+         }
+      } else if (recv[6] == 8) {
+         returnVal = DONE; // no such file
+      } else {
+         // data, so the reply was lost. The address is now the session's
+         // socket, so the setup goes there and the reply is sent again
+         returnVal = FILENAME;
       }
    } 
    
    return returnVal;
 }
 
-int createFile(int * outputFD, char * outputFile) 
+/*****
+ * Opens the output file. A stripe must not truncate what the others have
+ * written, nor a resume what the last run did, so with size (the whole
+ * file's length, -1 unless this is one of those) the file is only set to
+ * that length, which every stripe agrees on.
+ ****/
+int createFile(int * outputFD, char * outputFile, int64_t size) 
 {
    int returnVal = DONE;
-   if ((*outputFD = open(outputFile, O_CREAT | O_TRUNC | O_WRONLY, 0600)) < 0)
+   int flags = size < 0 ? O_CREAT | O_TRUNC | O_WRONLY : O_CREAT | O_WRONLY;
+
+   if ((*outputFD = open(outputFile, flags, 0600)) < 0)
    {
       perror("createFile: File open error");
       returnVal = DONE;
    } 
+   else if (size >= 0 && ftruncate(*outputFD, size) < 0)
+   {
+      perror("createFile: ftruncate");
+      close(*outputFD);
+      returnVal = DONE;
+   }
    else 
    {
       returnVal = RECV_DATA; // receive data once set up arugments is complete
@@ -224,13 +849,15 @@ int createFile(int * outputFD, char * outputFile)
    return returnVal;
 }
 
-void fillPkt(u_char *pkt, uint32_t seq, uint8_t flag, char *data)
+/*****
+ * Builds a packet carrying len bytes of data and returns its total length.
+ * With OPT_CRC32C in options it carries a CRC32C instead of the checksum.
+ ****/
+int fillPkt(u_char *pkt, uint32_t seq, uint8_t flag, char *data, int len, uint8_t options)
 {
    unsigned short cksum = 0;
    uint32_t seq_num = htonl(seq);
-
-   // clearing pkt
-   memset(pkt, 0, HDR_LEN + MAX_PAYLOAD);
+   uint32_t crc;
 
    // store sequence number in network order
    memcpy(pkt, &seq_num, 4);
@@ -241,40 +868,151 @@ void fillPkt(u_char *pkt, uint32_t seq, uint8_t flag, char *data)
    // store flag
    pkt[6] = flag;
 
+   if (options & OPT_CRC32C) {
+      crc = crc32c(0, pkt, HDR_LEN);
+      crc = htonl(crc32cCopy(crc, pkt + HDR_LEN + CRC_LEN, data, len));
+      memcpy(pkt + HDR_LEN, &crc, CRC_LEN);
+      return HDR_LEN + CRC_LEN + len;
+   }
+
    // store data
-   memcpy(pkt + HDR_LEN, data, MAX_PAYLOAD);
+   memcpy(pkt + HDR_LEN, data, len);
 
    // calculate and store checksum
-   cksum = in_cksum((unsigned short *)pkt, HDR_LEN + MAX_PAYLOAD);
+   cksum = in_cksum((unsigned short *)pkt, HDR_LEN + len);
    memcpy(pkt + 4, &cksum, 2);
+
+   return HDR_LEN + len;
 }
 
-int checkArgs(int argc, char * argv[])
+void usage(char * name)
 {
-   int portNumber = 0;
+   printf("usage: %s [-s] [-a] [-i cksum|crc32c] [-n packets] [-d usec] [-r usec] [-g]"
+      " [-j stripes] [-c] [-z] [-u]", name);
+   printf(" local-TO-file remote-FROM-file window-size");
+   printf(" buffer-size error-percent remote-machine remote-port\n");
+   printf("   -s: selective repeat, only resend the packets that were lost\n");
+   printf("   -a: selective repeat with RRs that list the packets held above them\n");
+   printf("   -i: integrity check for the transfer (default cksum, the 16 bit\n");
+   printf("       Internet checksum)\n");
+   printf("   -n: RR once this many packets are waiting on one (default %d)\n",
+      ACK_EVERY_DEFAULT);
+   printf("   -d: or this many microseconds after the first, 0 once per read\n");
+   printf("       batch (default %d)\n", ACK_DELAY_DEFAULT);
+   printf("   -r: least microseconds between SREJs for one packet, when a round\n");
+   printf("       trip is shorter (default %d)\n", SREJ_GAP_DEFAULT);
+   printf("   -g: no UDP GRO, read every datagram on its own\n");
+   printf("   -j: fetch the file as this many stripes over as many sessions\n");
+   printf("       at once, up to %d (default 1)\n", STRIPE_MAX);
+   printf("   -c: resume where the checkpoint an aborted run left next to\n");
+   printf("       local-TO-file says\n");
+   printf("   -z: the server compresses the file as it sends it, except for\n");
+   printf("       blocks that do not compress\n");
+   printf("   -u: only fetch what an old local-TO-file lacks; not with -j, -c\n");
+   printf("       or -z\n");
+   printf("   window-size: packets outstanding at once, 1 to %d\n", MAX_WINDOW);
+   printf("   buffer-size: payload bytes per packet, up to %d; the server\n", MAX_PAYLOAD);
+   printf("       sends less if the path MTU cannot carry that\n");
+   exit(1);
+}
+
+void checkArgs(int argc, char * argv[], struct rcopyArgs * args)
+{
+   int opt;
+
+   memset(args, 0, sizeof(struct rcopyArgs));
+   args->ackEvery = ACK_EVERY_DEFAULT;
+   args->ackDelay = ACK_DELAY_DEFAULT;
+   args->srejGap = SREJ_GAP_DEFAULT;
+   args->jobs = 1;
+
+   while ((opt = getopt(argc, argv, "sai:n:d:r:gj:czu")) != -1)
+   {
+      switch (opt)
+      {
+         case 's':
+            args->options |= OPT_SELECTIVE;
+            break;
+         case 'a':
+            args->options |= OPT_SELECTIVE | OPT_SACK;
+            break;
+         case 'i':
+            if (strcmp(optarg, "crc32c") == 0)
+               args->options |= OPT_CRC32C;
+            else if (strcmp(optarg, "cksum") != 0)
+               usage(argv[0]);
+            break;
+         case 'n':
+            if ((args->ackEvery = atoi(optarg)) < 1)
+               usage(argv[0]);
+            break;
+         case 'd':
+            if ((args->ackDelay = atoll(optarg)) < 0)
+               usage(argv[0]);
+            break;
+         case 'r':
+            if ((args->srejGap = atoll(optarg)) < 0)
+               usage(argv[0]);
+            break;
+         case 'g':
+            args->noGro = 1;
+            break;
+         case 'c':
+            args->resume = 1;
+            break;
+         case 'z':
+            args->options |= OPT_COMPRESS;
+            break;
+         case 'u':
+            args->delta = 1;
+            break;
+         case 'j':
+            if ((args->jobs = atoi(optarg)) < 1 || args->jobs > STRIPE_MAX)
+               usage(argv[0]);
+            break;
+         default:
+            usage(argv[0]);
+            break;
+      }
+   }
+
+   if (args->delta && (args->jobs > 1 || args->resume || (args->options & OPT_COMPRESS)))
+      usage(argv[0]);
 
 	/* check command line arguments  */
-	if (argc != 8)
+	if (argc - optind != 7)
 	{
-		printf("usage: local-TO-file remote-FROM-file window-size");
-      printf(" buffer-size error-percent remote-machine remote-port\n");
-		exit(1);
+		usage(argv[0]);
 	}
+
+   argv += optind;
    
-   if (strlen(argv[1]) > 100 || strlen(argv[2]) > 100) {
+   if (strlen(argv[0]) > 100 || strlen(argv[1]) > 100) {
       printf("File name is too long. Please enter something <= 100 chars\n");	
+      exit(-1);
    }
 
-   if (atoi(argv[5]) < 0 || atoi(argv[5]) >= 1)
+   if (atoi(argv[4]) < 0 || atoi(argv[4]) >= 1)
    {
-      printf("Error rate needs to be between 0 and less than 1 and is %s\n", argv[5]);
+      printf("Error rate needs to be between 0 and less than 1 and is %s\n", argv[4]);
       exit(-1);
    }
 
-	// Checks args and returns port number
-	
-	portNumber = atoi(argv[7]);		
+   args->toFile = argv[0];
+   args->fromFile = argv[1];
+   // the setup packet carries it in 16 signed bits, and ack.c and
+   // reorder.c index their rings modulo it
+   if (atoi(argv[2]) < 1 || atoi(argv[2]) > MAX_WINDOW)
+      usage(argv[0]);
+   args->windowSize = atoi(argv[2]);
+   if (atoi(argv[3]) < 1 || atoi(argv[3]) > MAX_PAYLOAD)
+   {
+      printf("Buffer size needs to be between 1 and %d and is %s\n", MAX_PAYLOAD, argv[3]);
+      exit(-1);
+   }
 
-	return portNumber;
+   args->bufSize = atoi(argv[3]);
+   args->errorRate = atof(argv[4]);
+   args->remoteMachine = argv[5];
+	args->portNumber = atoi(argv[6]);		
 }
-
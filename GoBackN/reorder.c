@@ -0,0 +1,141 @@
+// Receive side reorder buffer used by rcopy in selective-repeat mode
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reorder.h"
+#include "sack.h"
+
+// packetLen is the longest packet a slot has to hold, header included
+void initReorder(struct reorder * reorder, int windowSize, int packetLen)
+{
+   reorder->size = windowSize;
+   reorder->slotSize = PACKETS_SIZE(packetLen);
+   reorder->count = 0;
+   reorder->sackBase = 0;
+   reorder->sackBits = 0;
+   memset(reorder->sack, 0, SACK_MAX);
+
+   if ((reorder->slots = malloc((size_t)windowSize * reorder->slotSize)) == NULL)
+   {
+      perror("initReorder: malloc");
+      exit(-1);
+   }
+
+   memset(reorder->slots, 0, (size_t)windowSize * reorder->slotSize);
+}
+
+// Sets seq_num's bit in the SACK bitmap, if the bitmap reaches that far
+static void markSack(struct reorder * reorder, int32_t seq_num)
+{
+   int32_t bit = seq_num - reorder->sackBase;
+
+   if (bit < 0 || bit >= SACK_MAX * 8)
+      return;
+
+   reorder->sack[bit / 8] |= 0x80 >> (bit % 8);
+   if (bit >= reorder->sackBits)
+      reorder->sackBits = bit + 1;
+}
+
+static struct packets * reorderSlot(struct reorder * reorder, int32_t seq_num)
+{
+   return (struct packets *)(reorder->slots + (size_t)(seq_num % reorder->size) * reorder->slotSize);
+}
+
+void freeReorder(struct reorder * reorder)
+{
+   free(reorder->slots);
+   reorder->slots = NULL;
+   reorder->size = 0;
+   reorder->count = 0;
+}
+
+/*****
+ * Buffers an early packet. Returns 1 if it was saved and 0 if it was a
+ * duplicate of one already held.
+ ****/
+int saveToReorder(struct reorder * reorder, int32_t seq_num, u_char * packet, int len)
+{
+   struct packets * slot = reorderSlot(reorder, seq_num);
+
+   if (slot->seq_num == seq_num)
+      return 0;
+
+   slot->seq_num = seq_num;
+   slot->len = len;
+   memcpy(slot->packet, packet, len);
+   reorder->count++;
+   markSack(reorder, seq_num);
+
+   return 1;
+}
+
+int inReorder(struct reorder * reorder, int32_t seq_num)
+{
+   return reorderSlot(reorder, seq_num)->seq_num == seq_num;
+}
+
+/*****
+ * Removes and returns the buffered packet for seq_num, or NULL if it has
+ * not arrived. The packet data stays valid until that slot is reused.
+ ****/
+struct packets * takeFromReorder(struct reorder * reorder, int32_t seq_num)
+{
+   struct packets * slot = reorderSlot(reorder, seq_num);
+
+   if (slot->seq_num != seq_num)
+      return NULL;
+
+   slot->seq_num = 0;
+   reorder->count--;
+
+   return slot;
+}
+
+/*****
+ * Fills map with a bitmap of the packets held above expected, the one that
+ * is missing: bit i, counting from the high bit of map[0], is expected + 1
+ * + i. Only as many bytes as it takes to reach highest are used, at most
+ * SACK_MAX. Returns that many, 0 if nothing is held.
+ * The bitmap is kept as packets are saved, so this only has to move it
+ * along once expected has moved (shiftSack()) and mark the packets that
+ * came in beyond where it reached before: each packet is looked at once.
+ ****/
+int sackMap(struct reorder * reorder, int32_t expected, int32_t highest, u_char * map)
+{
+   int32_t base = expected + 1;
+   int32_t seq;
+   int bits = highest - expected;
+   int len;
+
+   if (reorder->count == 0 || bits <= 0) {
+      // nothing held, so the bitmap can start again from here
+      memset(reorder->sack, 0, (reorder->sackBits + 7) / 8);
+      reorder->sackBits = 0;
+      reorder->sackBase = base;
+      return 0;
+   }
+
+   if (base > reorder->sackBase) {
+      seq = reorder->sackBase + SACK_MAX * 8;
+      shiftSack(reorder->sack, (reorder->sackBits + 7) / 8, base - reorder->sackBase);
+      reorder->sackBits -= base - reorder->sackBase;
+      if (reorder->sackBits < 0)
+         reorder->sackBits = 0;
+      reorder->sackBase = base;
+
+      for (seq = seq > base ? seq : base; seq <= highest && seq < base + SACK_MAX * 8; seq++)
+         if (inReorder(reorder, seq))
+            markSack(reorder, seq);
+   }
+
+   if (bits > SACK_MAX * 8)
+      bits = SACK_MAX * 8;
+
+   len = (bits + 7) / 8;
+   memcpy(map, reorder->sack, len);
+
+   return len;
+}
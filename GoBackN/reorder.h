@@ -0,0 +1,34 @@
+// Receive side reorder buffer used by rcopy in selective-repeat mode
+
+#ifndef __REORDER_H__
+#define __REORDER_H__
+
+#include "networks.h"
+
+/*****
+ * Holds packets that arrived ahead of the one rcopy is waiting for. There
+ * is one slot per window entry, indexed by seq_num % size, and a slot is
+ * empty when its seq_num is 0 (sequence numbers start above that). Slots
+ * are slotSize bytes apart, room for the longest packet negotiated.
+ * sack is the SACK bitmap of what is held, bit i for sackBase + i, set as
+ * packets come in and only moved along when the packet rcopy is waiting
+ * for changes; bits from sackBits on are 0.
+ ****/
+struct reorder {
+   u_char * slots;
+   int32_t slotSize;
+   int32_t size;
+   int32_t count;
+   int32_t sackBase;
+   int32_t sackBits;
+   u_char sack[SACK_MAX];
+};
+
+void initReorder(struct reorder * reorder, int windowSize, int packetLen);
+void freeReorder(struct reorder * reorder);
+int saveToReorder(struct reorder * reorder, int32_t seq_num, u_char * packet, int len);
+struct packets * takeFromReorder(struct reorder * reorder, int32_t seq_num);
+int inReorder(struct reorder * reorder, int32_t seq_num);
+int sackMap(struct reorder * reorder, int32_t expected, int32_t highest, u_char * map);
+
+#endif
@@ -0,0 +1,98 @@
+// Round trip time estimator and retransmit timeout for the server
+
+#include <stdio.h>
+#include <time.h>
+
+#include "rtt.h"
+
+static int64_t clampRto(struct rtt * rtt, int64_t rto)
+{
+   if (rto < rtt->min)
+      return rtt->min;
+   if (rto > rtt->max)
+      return rtt->max;
+   return rto;
+}
+
+void initRtt(struct rtt * rtt, int64_t min, int64_t max)
+{
+   rtt->srtt = 0;
+   rtt->rttvar = 0;
+   rtt->min = min;
+   rtt->max = max;
+   rtt->backoff = 0;
+   rtt->samples = 0;
+   rtt->timeouts = 0;
+   rtt->rto = clampRto(rtt, RTO_INITIAL);
+}
+
+/*****
+ * Folds in one measured round trip. The first sample seeds srtt and
+ * rttvar, after that srtt moves 1/8 and rttvar 1/4 of the way towards it.
+ * A fresh sample also drops any backoff.
+ ****/
+void rttSample(struct rtt * rtt, int64_t sample)
+{
+   int64_t err;
+
+   if (sample < 1)
+      sample = 1;
+
+   if (rtt->samples == 0)
+   {
+      rtt->srtt = sample;
+      rtt->rttvar = sample / 2;
+   }
+   else
+   {
+      err = sample - rtt->srtt;
+      rtt->srtt += err / 8;
+      rtt->rttvar += ((err < 0 ? -err : err) - rtt->rttvar) / 4;
+   }
+
+   rtt->samples++;
+   rtt->backoff = 0;
+   rtt->rto = clampRto(rtt, rtt->srtt + 4 * rtt->rttvar);
+}
+
+void rttBackoff(struct rtt * rtt)
+{
+   rtt->timeouts++;
+
+   if (rttTimeout(rtt) < rtt->max)
+      rtt->backoff++;
+}
+
+/*****
+ * Called when an ACK covers new data but could not be timed (Karn's rule).
+ * The path is clearly working again, so the timeout stops backing off.
+ ****/
+void rttProgress(struct rtt * rtt)
+{
+   rtt->backoff = 0;
+}
+
+/*****
+ * The timeout to wait before resending: rto doubled once per timeout since
+ * the last ACK of new data, never more than max.
+ ****/
+int64_t rttTimeout(struct rtt * rtt)
+{
+   return clampRto(rtt, rtt->rto << rtt->backoff);
+}
+
+void printRttStats(struct rtt * rtt)
+{
+   printf("RTT srtt %lld us rttvar %lld us rto %lld us (%u samples, %u timeouts)\n",
+      (long long)rtt->srtt, (long long)rtt->rttvar, (long long)rttTimeout(rtt),
+      rtt->samples, rtt->timeouts);
+}
+
+uint64_t nowUsec(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
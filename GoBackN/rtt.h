@@ -0,0 +1,39 @@
+// Round trip time estimator and retransmit timeout for the server
+
+#ifndef __RTT_H__
+#define __RTT_H__
+
+#include <stdint.h>
+
+#define RTO_INITIAL 1000000 // microseconds, used until the first sample
+#define RTO_MIN_DEFAULT 2000
+#define RTO_MAX_DEFAULT 4000000
+
+/*****
+ * Jacobson/Karels estimator (RFC 6298), everything in microseconds. rto is
+ * srtt + 4 * rttvar clamped to [min, max] and each timeout doubles the
+ * timeout actually used (up to max). Callers apply Karn's rule by never
+ * sampling a packet that was resent. Under heavy loss nearly everything
+ * gets resent, so the backoff is also dropped whenever new data is acked
+ * instead of waiting for a clean sample.
+ ****/
+struct rtt {
+   int64_t srtt;
+   int64_t rttvar;
+   int64_t rto;
+   int64_t min;
+   int64_t max;
+   int backoff;
+   uint32_t samples;
+   uint32_t timeouts;
+};
+
+void initRtt(struct rtt * rtt, int64_t min, int64_t max);
+void rttSample(struct rtt * rtt, int64_t sample);
+void rttBackoff(struct rtt * rtt);
+void rttProgress(struct rtt * rtt);
+int64_t rttTimeout(struct rtt * rtt);
+void printRttStats(struct rtt * rtt);
+uint64_t nowUsec(void);
+
+#endif
@@ -0,0 +1,119 @@
+// Selective-ack bookkeeping: moving a RR's bitmap along, and the server's scoreboard
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sack.h"
+
+/*****
+ * Moves the bits of map (len bytes, bit i from the high bit of map[0])
+ * bits places towards its start, as the sequence number they count from
+ * moves up by that much. Zeros come in at the end.
+ ****/
+void shiftSack(u_char * map, int len, int bits)
+{
+   int bytes = bits / 8;
+   int rest = bits % 8;
+   int i;
+
+   if (bits <= 0)
+      return;
+
+   if (bytes >= len) {
+      memset(map, 0, len);
+      return;
+   }
+
+   for (i = 0; i < len - bytes; i++) {
+      map[i] = map[i + bytes] << rest;
+      if (rest > 0 && i + bytes + 1 < len)
+         map[i] |= map[i + bytes + 1] >> (8 - rest);
+   }
+
+   memset(map + len - bytes, 0, bytes);
+}
+
+// The holes ring has room for two windows: a hole stays in it until it
+// reaches the front, even once it has been RR'd
+void initScoreboard(struct scoreboard * board, int windowSize, int32_t start_seq)
+{
+   memset(board, 0, sizeof(struct scoreboard));
+   board->next = start_seq;
+   board->top = start_seq;
+   board->lastRr = start_seq;
+   board->size = 2 * windowSize;
+
+   if ((board->holes = malloc((size_t)board->size * sizeof(struct sackHole))) == NULL)
+   {
+      perror("initScoreboard: malloc");
+      exit(-1);
+   }
+}
+
+void freeScoreboard(struct scoreboard * board)
+{
+   free(board->holes);
+   board->holes = NULL;
+   board->count = 0;
+}
+
+/*****
+ * Takes the map of a SACK RR for rr and clears every bit that the last
+ * map already had, so only packets the client has newly reported holding
+ * are left. A RR older than the last one (ACKs can be reordered too) is
+ * taken as all new. Returns how many bytes of map are used.
+ ****/
+int newlySacked(struct scoreboard * board, int32_t rr, u_char * map, int len)
+{
+   u_char held[SACK_MAX];
+   int i;
+
+   if (len > SACK_MAX)
+      len = SACK_MAX;
+
+   if (rr < board->lastRr)
+      board->lastLen = 0;
+   else
+      shiftSack(board->last, board->lastLen, rr - board->lastRr);
+
+   memcpy(held, map, len);
+   for (i = 0; i < len && i < board->lastLen; i++)
+      map[i] &= ~board->last[i];
+
+   memcpy(board->last, held, len);
+   board->lastLen = len;
+   board->lastRr = rr;
+
+   return len;
+}
+
+// Adds a hole that was just resent. Returns -1 if the ring is full.
+int pushSackHole(struct scoreboard * board, int32_t seq_num, uint64_t sent)
+{
+   struct sackHole * hole;
+
+   if (board->count == board->size)
+      return -1;
+
+   hole = &board->holes[(board->head + board->count) % board->size];
+   hole->seq_num = seq_num;
+   hole->sent = sent;
+   board->count++;
+   return 0;
+}
+
+// The hole resent longest ago, NULL if there is none
+struct sackHole * firstSackHole(struct scoreboard * board)
+{
+   return board->count > 0 ? &board->holes[board->head] : NULL;
+}
+
+void popSackHole(struct scoreboard * board)
+{
+   if (board->count == 0)
+      return;
+
+   board->head = (board->head + 1) % board->size;
+   board->count--;
+}
@@ -0,0 +1,44 @@
+// Selective-ack bookkeeping: moving a RR's bitmap along, and the server's scoreboard
+
+#ifndef __SACK_H__
+#define __SACK_H__
+
+#include <stdint.h>
+
+#include "networks.h"
+
+/*****
+ * What the server has learnt from a client's SACK RRs, so each RR only
+ * costs what is new in it. last is the previous map, relative to lastRr;
+ * newlySacked() lines it up with the next RR and leaves only the bits that
+ * were not in it. Every packet below next has been looked at once for
+ * loss: it is held, or it is one of the holes, a ring of the packets
+ * resent since, the earliest resend first, each with the time of that
+ * resend. top is the highest packet the client has said it holds.
+ ****/
+struct sackHole {
+   int32_t seq_num;
+   uint64_t sent;
+};
+
+struct scoreboard {
+   int32_t next;
+   int32_t top;
+   struct sackHole * holes;
+   int32_t size;
+   int32_t head;
+   int32_t count;
+   int32_t lastRr;
+   int lastLen;
+   u_char last[SACK_MAX];
+};
+
+void shiftSack(u_char * map, int len, int bits);
+void initScoreboard(struct scoreboard * board, int windowSize, int32_t start_seq);
+void freeScoreboard(struct scoreboard * board);
+int newlySacked(struct scoreboard * board, int32_t rr, u_char * map, int len);
+int pushSackHole(struct scoreboard * board, int32_t seq_num, uint64_t sent);
+struct sackHole * firstSackHole(struct scoreboard * board);
+void popSackHole(struct scoreboard * board);
+
+#endif
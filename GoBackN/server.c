@@ -5,56 +5,250 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <pthread.h>
+#include <stdint.h>
 
 #include "networks.h"
+#include "window.h"
+#include "rtt.h"
+#include "cc.h"
+#include "pace.h"
+#include "wheel.h"
+#include "compress.h"
+#include "delta.h"
+#include "cache.h"
+#include "sack.h"
 #include "libcpe464/networks/checksum.h"
+#include "crc32c.h"
 #include "cpe464.h"
 
 #define MAXBUF 80
 #define HDR_LEN 7
-#define MAX_PAYLOAD 1400
+
+// SERVER MODES
+#define FORK_MODE 0
+#define EVENT_MODE 1
+#define THREAD_MODE 2
+
+#define MAX_EVENTS 256
+#define SESSION_BUDGET 64 // steps a session may run before yielding the loop
+
+// EVENT SOURCES
+#define EV_LISTEN 1
+#define EV_SOCKET 2
+#define EV_TIMER 3
+
+struct serverArgs {
+   double errorRate;
+   int portNumber;
+   int mode;
+   int numThreads; // THREAD_MODE, 0 means one per core
+   int batchSize;  // packets per sendmmsg, 1 sends them one at a time
+   int64_t rtoMin; // retransmit timeout bounds in microseconds
+   int64_t rtoMax;
+   int zeroCopy;   // mmap files and send payloads straight from the mapping
+   struct ccOps * cc; // congestion controller every session uses
+   double paceRate; // -p: bytes per microsecond, 0 sends unpaced
+   int paceCc;      // -p cc: pace at the congestion controller's rate
+   int kernelPace;  // -k: leave the waiting to the qdisc through SO_TXTIME
+   int noGso;       // -g: send every datagram itself, no UDP_SEGMENT
+   size_t cacheBytes; // -C: packet cache budget, 0 for none
+   struct packetCache * cache; // shared by every session, NULL without -C
+};
+
+typedef struct session Session;
+typedef struct eventLoop EventLoop;
+
+struct evTag {
+   int type;
+   Session * session;
+};
+
+/*****
+ * Everything one transfer needs. In fork mode a child owns one session; in
+ * event mode the loop owns many and steps each one as its socket becomes
+ * readable or one of its timers fires. The timers (one per packet in the
+ * window, the idle timeout and the pacing wakeup) live on the wheel of
+ * whatever drives the session; when one fires it only sets a flag here and
+ * has the session run.
+ ****/
+struct session {
+   Connection client;
+   int state;
+   int fd;
+   u_char * map;   // zero-copy: the whole file mapped read-only, or NULL
+   off_t mapLen;
+   off_t offset;   // file offset of the next payload to send
+   off_t end;      // OPT_STRIPE: where this session's stripe ends, -1 to EOF
+   uint16_t stripe;  // OPT_STRIPE: which stripe of how many the client asked for
+   uint16_t stripes;
+   off_t fileSize;   // OPT_STRIPE, OPT_RESUME: the whole file's length, for the reply
+   int16_t windowSize;
+   uint16_t buffSize; // payload bytes per packet, negotiated in setupResponse()
+   uint16_t asked;    // what the client asked for
+   int mtu;           // path MTU when the session started, -1 if unknown
+   int windowCount;
+   int32_t seq_num;
+   int32_t srejSeq;  // last SREJ answered with an immediate resend
+   uint64_t srejAt;  // and when
+   int32_t resendNext; // [resendNext, resendEnd) still has to be resent
+   int32_t resendEnd;  // once the congestion window allows
+   uint64_t rackSent;  // SACK: when the newest packet known delivered was sent
+   uint64_t sacked;    // SACK: packets the client reported holding early
+   uint64_t sackResent; // SACK: holes resent because later packets got there
+   struct scoreboard board; // SACK: what the RRs have said so far
+   uint8_t options; // setup options accepted for this client
+   struct window myWindow;
+   struct rtt rtt;
+   struct cc cc;
+   struct pace pace;
+   struct sendBatch batch;
+   struct compressor zip; // OPT_COMPRESS: the frame being cut into packets
+   struct deltaSender delta; // OPT_DELTA: the client's signature, and the file's ops against it
+   struct cacheReader cache; // -C: the file's packets out of the server's packet cache
+   u_char * reply;   // the setup reply, for a client that did not get it, until it is heard from
+   int replyLen;
+
+   struct wheel * wheel;
+   struct timer idle; // nothing heard from the client for LONG_TIME seconds
+   struct timer wake; // PACE_WAIT: the next pacing slot has come
+   uint64_t lastAck;  // when the client was last heard from, microseconds
+   int expired;       // packet timers that fired since the last timeout
+   struct packets * expiredList;   // their slots, oldest first, until resent or acked
+   struct packets ** expiredTail;
+   int paced;
+   int timedOut;
+
+   // event mode only
+   EventLoop * loop;
+   int queued;
+   struct evTag sockTag;
+   Session * nextRun;
+   Session * nextClosed; // apart from nextRun, a session may finish while still queued
+};
+
+/*****
+ * State for the event mode loop. runQueue holds sessions that still have
+ * work to do without waiting on anything; closed holds finished sessions
+ * until the current batch of epoll events has been handled. Every session's
+ * timers share the loop's wheel, and the one timerfd is kept armed for the
+ * wheel's next deadline (armed, 0 when disarmed).
+ ****/
+struct eventLoop {
+   int epoll_fd;
+   int listen_fd;
+   int timer_fd;
+   uint64_t armed;
+   struct evTag listenTag;
+   struct evTag timerTag;
+   struct wheel wheel;
+   Session * runQueue;
+   Session * closed;
+};
 
 void printClientIP(struct sockaddr_in6 * client);
-int checkArgs(int argc, char *argv[]);
+void usage(char * name);
+void checkArgs(int argc, char *argv[], struct serverArgs * args);
 void sendFile(int socketNum);
-void fillPkt(u_char *pkt, uint32_t seq, uint8_t flag, char *data);
-int crcCheck(u_char * pkt);
+int fillPkt(u_char *pkt, uint32_t seq, uint8_t flag, char *data, int len, uint8_t options);
+int fillHdr(u_char *pkt, uint32_t seq, uint8_t flag, u_char *payload, int len, uint8_t options);
+int fillSummed(u_char *pkt, uint32_t seq, uint8_t flag, u_char *data, int len, uint8_t options,
+   uint32_t sum, uint32_t shift);
+void getFileName(u_char * pkt, int len, char * file);
 
 void processServer(int socketNum);
-void processClient(int socketNum, u_char * buf, Connection * client);
-int setupResponse(Connection *client, u_char *pkt, int16_t * windowSize, int16_t * buffSize);
-
-int sendData(Connection * client, int fd, int32_t * seq_num, 
-   int buf_size, int window_size, int *windowCount, struct packets *myWindow);
-int recvAck(Connection * client, struct packets * myWindow, int windowSize, int32_t *srej);
-
-void printWindow(struct packets *myWindow, int windowSize);
-void saveToWindow(struct packets *myWindow, int windowSize, u_char * packet);
-int32_t resendRR(Connection * client, struct packets *myWindow, int windowSize);
-int resendBuff(Connection * client, struct packets *myWindow, int windowSize);
-int windowClosed(Connection * client, struct packets * myWindow, int windowSize, int * windowCount);
-void delFromWindow(struct packets * myWindow, int windowSize, int seq_num);
-int notExpected(struct packets *myWindow, int windowSize, int32_t seq_num);
-int itemsInWindow(struct packets * myWindow, int windowSize);
+void processClient(int socketNum, u_char * buf, int len, Connection * client);
+int setupResponse(Session * session, u_char *pkt, int len);
+Session * newSession(u_char * buf, int len, Connection * client, struct wheel * wheel);
+void endSession(Session * session);
+void mapFile(Session * session);
+void sendRange(Session * session, int64_t resume, int64_t size);
+int nextFrame(Session * session, int buf_size, u_char ** from);
+int nextDelta(Session * session, int buf_size, u_char ** from);
+int recvSignature(Session * session);
+void queueSlot(Session * session, struct packets * slot);
+int ackReady(Session * session);
+void updatePace(Session * session);
+void packetExpired(struct timer * timer);
+void idleExpired(struct timer * timer);
+void paceExpired(struct timer * timer);
+void wakeLater(Session * session);
+int sessionDue(Session * session);
+int wakeSession(Session * session, int readable);
+void releaseWindow(Session * session, int32_t seq_num);
+void pushExpired(Session * session, struct packets * slot);
+void dropExpired(Session * session, struct packets * slot);
+
+int stepSession(Session * session);
+int sendData(Session * session);
+int recvAck(Session * session);
+void recvSack(Session * session, int32_t rr, u_char * map, int len, uint64_t now);
+
+int32_t resendRR(Session * session, int32_t seq_num);
+int resendBuff(Session * session);
+int resendExpired(Session * session);
+int resendReady(Session * session);
+int windowClosed(Session * session);
+int windowWait(Session * session, int ready);
+
+void processServerEvents(int socketNum);
+void processServerThreads(int portNumber, int numThreads);
+void * serverWorker(void * arg);
+void raiseFileLimit(void);
+void acceptClient(struct eventLoop * loop);
+void runSession(struct eventLoop * loop, Session * session, int readable);
+void queueSession(struct eventLoop * loop, Session * session);
+void watchFd(struct eventLoop * loop, int fd, struct evTag * tag);
+void armLoopTimer(struct eventLoop * loop);
+
+static struct serverArgs args;
 
 int main ( int argc, char *argv[]  )
 { 
 	int socketNum = 0;				
-	int portNumber = 0;
 
-	portNumber = checkArgs(argc, argv);
+	checkArgs(argc, argv, &args);
+
+   // before any child or thread, so they all share it
+   if (args.cacheBytes > 0 && (args.cache = newPacketCache(args.cacheBytes)) == NULL)
+   {
+      printf("Packet cache of %zu bytes could not be made\n", args.cacheBytes);
+      exit(-1);
+   }
 	
-   sendtoErr_init(atof(argv[1]), DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON);
+   initEmulation(args.errorRate);
+
+   // pacing waits are a fraction of a millisecond, so keep the kernel from
+   // stretching them (forked children and threads inherit this)
+   if (args.paceRate > 0 || args.paceCc)
+      prctl(PR_SET_TIMERSLACK, PACE_TIMER_SLACK, 0, 0, 0);
+
+   if (args.mode == THREAD_MODE)
+   {
+      processServerThreads(args.portNumber, args.numThreads);
+      return 0;
+   }
 	
-	socketNum = udp_server(portNumber);
+	socketNum = udp_server(args.portNumber);
 
-   processServer(socketNum);
+   if (args.mode == EVENT_MODE)
+      processServerEvents(socketNum);
+   else
+      processServer(socketNum);
 
 	close(socketNum);
 
@@ -64,7 +258,7 @@ int main ( int argc, char *argv[]  )
 void processServer(int socketNum)
 {
    pid_t pid = 0;
-   u_char buf[HDR_LEN + MAX_PAYLOAD];
+   u_char buf[HDR_LEN + DEFAULT_PAYLOAD];
    int status = 0;
    uint16_t windowSize = 0;
    uint16_t bufSize = 0;
@@ -77,9 +271,9 @@ void processServer(int socketNum)
       // block waiting for a new client
       if (select_call(socketNum, LONG_TIME, 0, TIMER_SET) == 1)
       { 
-         recv_len = safeRecv(socketNum, buf, HDR_LEN + MAX_PAYLOAD, &client);
+         recv_len = safeRecv(socketNum, buf, HDR_LEN + DEFAULT_PAYLOAD, &client);
 
-         if (crcCheck(buf) == 1) // corrupt packet 
+         if (crcCheck(buf, recv_len) == 1) // corrupt packet 
          {
             printf("corrupt packet!... dropping\n");
             continue;
@@ -94,8 +288,7 @@ void processServer(int socketNum)
             }
             if (pid == 0)
             {
-               processClient(socketNum, buf, &client);
-               close(client.sk_num);
+               processClient(socketNum, buf, recv_len, &client);
                exit(0);
             }
          }
@@ -105,459 +298,1812 @@ void processServer(int socketNum)
    }
 }
 
-void processClient(int socketNum, u_char * buf, Connection * client)
+void processClient(int socketNum, u_char * buf, int len, Connection * client)
 {
-   int state = FILENAME;
-   char file[FILE_LEN];
-   static int16_t windowSize = 0;
-   static int16_t buffSize = 0;
-   static int windowCount = 0;
-   static int32_t seq_num = START_SEQ_NUM + 1;
-   int fd;
-   int i;
-   int num;
-   static int32_t srej;
-   static int32_t count = 0;
-   int32_t zero = (int32_t)0;
-   struct packets * myWindow; // change window size to be dynamic
+   struct wheel wheel;
+   Session * session;
+   int64_t wait;
+   int ready;
 
-   memset(file, 0, FILE_LEN);
-   memcpy(file, buf + HDR_LEN + 4, FILE_LEN);   
-   
-   fd = open(file, O_RDONLY);
+   initWheel(&wheel, nowUsec());
+   session = newSession(buf, len, client, &wheel);
 
    while(1)
    {
-      switch (state)
+      switch (session->state)
       {
-         case FILENAME:
-            state = setupResponse(client, buf, &windowSize, &buffSize);
-            myWindow = malloc((int)windowSize * sizeof(struct packets));
-            for (i = 0; i < windowSize; i++) {
-               myWindow[i].seq_num = zero;
-               memset(myWindow[i].packet, 0, HDR_LEN + MAX_PAYLOAD);
-            }
-            break;
-         case SEND_DATA: // Open window
-            state = sendData(client, fd, &seq_num, buffSize, windowSize, &windowCount, myWindow);
-            break;
-         case RECV_ACK:
-            state = recvAck(client, myWindow, windowSize, &srej);
-            break;
-         case WINDOW_CLOSED:
-            state = windowClosed(client, myWindow, windowSize, &windowCount);
+         case WINDOW_WAIT:
+         case PACE_WAIT:
+         case SIG_WAIT:
+            // an RR or the next of the session's timers ends the wait
+            wakeLater(session);
+            if (sessionDue(session) || (wait = timerDelay(&wheel, nowUsec())) < 0)
+               wait = 0;
+            ready = poll_usec(session->client.sk_num, wait);
+            runTimers(&wheel, nowUsec());
+            session->state = wakeSession(session, ready);
             break;
          case DONE:
-            close(fd);
+            endSession(session);
             exit(0);
             break;
          default:
-            state = DONE;
+            session->state = stepSession(session);
             break;  
       }
    }
 }
 
-int setupResponse(Connection *client, u_char *pkt, int16_t *windowSize,  int16_t * buffSize)
+/*****
+ * Event mode: one process serves every client. The well-known socket, each
+ * session's socket and the loop's timerfd are registered with epoll. The
+ * timers that are due run after every batch of events and queue their
+ * sessions. Sessions with an open window go on the run queue and get
+ * SESSION_BUDGET steps per pass so one fast transfer cannot starve the rest.
+ ****/
+void processServerEvents(int socketNum)
 {
-   uint8_t flag;
-   char file[FILE_LEN + HDR_LEN];
-   u_char send[HDR_LEN + MAX_PAYLOAD];
-   int returnVal = DONE;
+   struct eventLoop loop;
+   struct epoll_event events[MAX_EVENTS];
+   struct evTag * tag;
+   Session * session;
+   Session * ready;
+   uint64_t expirations;
+   int numEvents;
    int i;
-   int32_t zero = (int32_t)0;
- 
-   // Save filename 
-   memset(file, 0, FILE_LEN);
-   memcpy(file, pkt + HDR_LEN + 4, FILE_LEN);
 
-   memcpy(windowSize, pkt + HDR_LEN, 2);
-   memcpy(buffSize, pkt + HDR_LEN + 2, 2);
- 
-   if ((client->sk_num = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+   raiseFileLimit();
+
+   memset(&loop, 0, sizeof(loop));
+   loop.listen_fd = socketNum;
+   loop.listenTag.type = EV_LISTEN;
+
+   if ((loop.epoll_fd = epoll_create1(0)) < 0)
    {
-      perror("filename, open client socket");
+      perror("epoll_create1");
       exit(-1);
    }
-   
 
-   *windowSize = (int16_t)ntohs(*windowSize) ;
-   *buffSize = (int16_t)ntohs(*buffSize);
- 
-   if( access( file, F_OK ) != -1 ) { 
-      flag = 2; // file exists 
-      returnVal = SEND_DATA;
-   } else {
-      flag = 8; // file doesn't exist
+   watchFd(&loop, socketNum, &loop.listenTag);
+
+   initWheel(&loop.wheel, nowUsec());
+   if ((loop.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0)
+   {
+      perror("timerfd_create");
+      exit(-1);
    }
+   loop.timerTag.type = EV_TIMER;
+   watchFd(&loop, loop.timer_fd, &loop.timerTag);
 
-   fillPkt(send, 1, flag, file);
-   
-   safeSend(send, HDR_LEN + MAX_PAYLOAD, client);
+   while (1)
+   {
+      numEvents = epoll_wait(loop.epoll_fd, events, MAX_EVENTS,
+         loop.runQueue != NULL ? 0 : -1);
 
-   return returnVal;
-}
+      if (numEvents < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         perror("epoll_wait");
+         exit(-1);
+      }
 
-/***** 
- * This sendData() method used to read file contents into a buffer to send to the client.
- * Some of the code below was adapted from Professor Smith's solution for Stop
- * and Wait Protocol
- ****/
-int sendData(Connection * client, int fd, int32_t * seq_num,
-   int buf_size, int window_size, int *windowCount, struct packets *myWindow)
-{
-   int returnVal = SEND_DATA;
-   int clientAddrLen = sizeof(client);
-   int len_read = 0;
-   int items = itemsInWindow(myWindow, window_size);
-   u_char data[buf_size + 1];
-   u_char pkt[HDR_LEN + MAX_PAYLOAD];
-   
-   if (select_call(client->sk_num, 0, 0, TIMER_SET) == 1) {
-      (*windowCount)--;
-      return RECV_ACK;
-   }
+      for (i = 0; i < numEvents; i++)
+      {
+         tag = (struct evTag *) events[i].data.ptr;
 
-   memset(data, 0, buf_size + 1);
-   memset(pkt, 0, HDR_LEN + MAX_PAYLOAD);
+         switch (tag->type)
+         {
+            case EV_LISTEN:
+               acceptClient(&loop);
+               break;
+            case EV_SOCKET:
+               runSession(&loop, tag->session, 1);
+               break;
+            case EV_TIMER:
+               if (read(loop.timer_fd, &expirations, sizeof(expirations)) < 0)
+                  expirations = 0;
+               loop.armed = 0;
+               break;
+         }
+      }
 
-   // *****
-   // if window is closed wait for ack before continuing!!!
-   // *****
+      // whatever woke the loop, fire every timer that is due
+      runTimers(&loop.wheel, nowUsec());
 
-   if (*windowCount == window_size) {
-      (*windowCount)--; // once window is open, reduce the count and send more data
-      return WINDOW_CLOSED;
-   }
+      // one more turn for every session that was left with an open window
+      ready = loop.runQueue;
+      loop.runQueue = NULL;
+      while ((session = ready) != NULL)
+      {
+         ready = session->nextRun;
+         session->nextRun = NULL;
+         session->queued = 0;
+         runSession(&loop, session, 0);
+      }
 
-   if (items == window_size) {
-      (*windowCount) = 0;
-      return resendBuff(client, myWindow, window_size);
+      while ((session = loop.closed) != NULL)
+      {
+         loop.closed = session->nextClosed;
+         endSession(session);
+      }
+
+      armLoopTimer(&loop);
    }
+}
 
-   // *****
-   // Window is currently open
-   // *****
-   
-   len_read = read(fd, data, (size_t)buf_size);
+/*****
+ * Thread mode: numThreads workers, each running its own event loop on its
+ * own socket. The sockets share the port through SO_REUSEPORT, so the
+ * kernel hashes every client to one worker and the workers never touch
+ * each other's sessions.
+ ****/
+void processServerThreads(int portNumber, int numThreads)
+{
+   pthread_t * threads;
+   int32_t * sockets;
+   struct sockaddr_in local;
+   socklen_t len = sizeof(local);
+   int i;
+
+   if (numThreads <= 0 && (numThreads = sysconf(_SC_NPROCESSORS_ONLN)) <= 0)
+      numThreads = 1;
 
-   switch(len_read)
+   threads = malloc(numThreads * sizeof(pthread_t));
+   sockets = malloc(numThreads * sizeof(int32_t));
+   if (threads == NULL || sockets == NULL)
    {
-      case -1: // error with read() system call
-         perror("sendData: read error");
-         returnVal = DONE;
-         break;
-      case 0: // no bytes read in system call (end of file)
-         fillPkt(pkt, *seq_num, EOF_FLAG, data);
-         returnVal = WINDOW_CLOSED;                
-         break;
-      default: // something read
-         fillPkt(pkt, *seq_num, DATA_FLAG, data);
-         returnVal = SEND_DATA;
-         (*seq_num)++;
-         break;
+      perror("processServerThreads: malloc");
+      exit(-1);
    }
 
-   saveToWindow(myWindow, (int)window_size, pkt);
-   safeSend(pkt, HDR_LEN + MAX_PAYLOAD, client);
-    
-   // *****
-   // Continually check for RRs and SREJs
-   // *****
-   if (select_call(client->sk_num, 0, 0, TIMER_SET) == 1) {
-      (*windowCount)--;
-      return RECV_ACK;
+   // the first bind picks the port when portNumber is 0
+   sockets[0] = udp_server_reuseport(portNumber);
+   getsockname(sockets[0], (struct sockaddr *)&local, &len);
+   printf("Using Port #: %d (%d threads)\n", ntohs(local.sin_port), numThreads);
+
+   for (i = 1; i < numThreads; i++)
+      sockets[i] = udp_server_reuseport(ntohs(local.sin_port));
+
+   for (i = 0; i < numThreads; i++)
+   {
+      if (pthread_create(&threads[i], NULL, serverWorker, (void *)(intptr_t) sockets[i]) != 0)
+      {
+         perror("pthread_create");
+         exit(-1);
+      }
    }
 
-   (*windowCount)++;
-   return returnVal;
+   for (i = 0; i < numThreads; i++)
+      pthread_join(threads[i], NULL);
 }
 
-int recvAck(Connection * client, struct packets * myWindow, int windowSize, int32_t * srrej)
+void * serverWorker(void * arg)
 {
-   int32_t recv_len = 0;
-   int recvFlag = 0;
-   int min;
-   int i;
-   int32_t seq_num;
-   int32_t srej;
-   int32_t rr;
-   u_char ack[HDR_LEN + MAX_PAYLOAD];
-
-   recv_len = safeRecv(client->sk_num, ack, HDR_LEN + MAX_PAYLOAD, client);
+   processServerEvents((int)(intptr_t) arg);
 
-   if (crcCheck(ack) == 1) {
-      return WINDOW_CLOSED; // Wait on ACK
-   }
+   return NULL;
+}
 
-   recvFlag = ack[6];
+/*****
+ * Each session holds a socket and the file it is sending, so make
+ * sure the descriptor limit is not what caps the number of clients.
+ ****/
+void raiseFileLimit(void)
+{
+   struct rlimit limit;
 
-   if (recvFlag == RR) {
-      memcpy(&rr, ack + HDR_LEN, 4);
-      rr = ntohl(rr);
-      delFromWindow(myWindow, windowSize, rr - 1);
-   } else if (recvFlag == SREJ) {
-      memcpy(&srej, ack + HDR_LEN, 4); // seq num we want to resend
-      srej = ntohl(srej);
-      delFromWindow(myWindow, windowSize, srej - 1);
-      return WINDOW_CLOSED; // resend buffer and close window
-   } else if (recvFlag == EOF_ACK) {
-      close(client->sk_num);
-      return DONE;
-   } else {
-      return DONE;
+   if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+   {
+      limit.rlim_cur = limit.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &limit);
    }
-
-   return SEND_DATA;
 }
- 
-int windowClosed(Connection * client, struct packets * myWindow, int windowSize, int * windowCount)
+
+void acceptClient(struct eventLoop * loop)
 {
-   int dataLen = 0;
-   int flag = 0;
-   static int resend = 0;
-   int32_t seq_num;
-   u_char dataBuf[HDR_LEN + MAX_PAYLOAD];
+   u_char buf[HDR_LEN + DEFAULT_PAYLOAD];
+   uint32_t recv_len;
+   Connection client;
+   Session * session;
 
-   memset(dataBuf, 0, HDR_LEN + MAX_PAYLOAD);
+   recv_len = safeRecv(loop->listen_fd, buf, HDR_LEN + DEFAULT_PAYLOAD, &client);
 
-   if (itemsInWindow(myWindow, windowSize) == 0)
-      return SEND_DATA;
+   if (crcCheck(buf, recv_len) == 1) // corrupt packet 
+   {
+      printf("corrupt packet!... dropping\n");
+      return;
+   }
 
-   resend++;
+   if (recv_len == 0)
+      return;
 
-   if (resend > 10) {
-      printf("Data resent 10 times. other side is down\n");
-      return DONE;
-   }
-   
-   if (select_call(client->sk_num, 1, 0, TIMER_SET) == 0)
+   session = newSession(buf, recv_len, &client, &loop->wheel);
+
+   if (session->state == DONE)
    {
-      (*windowCount) = 0;
-      resendBuff(client, myWindow, windowSize);
-      return WINDOW_CLOSED;
+      endSession(session);
+      return;
    }
 
-   resend = 0;
-   return RECV_ACK;
-}
+   session->loop = loop;
+   session->sockTag.type = EV_SOCKET;
+   session->sockTag.session = session;
+   watchFd(loop, session->client.sk_num, &session->sockTag);
 
+   runSession(loop, session, 0);
+}
 
 /*****
- * Function to Resend the packets in the buffer
+ * Steps a session until it has to wait (WINDOW_WAIT, PACE_WAIT or SIG_WAIT),
+ * finishes, or uses up its budget. readable says the loop is running it because its
+ * socket is; its timers say for themselves whether they fired.
  ****/
-int resendBuff(Connection * client, struct packets *myWindow, int windowSize)
+void runSession(struct eventLoop * loop, Session * session, int readable)
 {
-   int i = 0;
-   int numPackets = itemsInWindow(myWindow, windowSize);
-   int32_t zero = (int32_t)0;
-   int32_t min = 0;
-   struct packets *tmpWindow = malloc(windowSize * sizeof(struct packets));
+   int budget = SESSION_BUDGET;
 
-   if (numPackets == 0) // if we do not have anything in out window
-      return SEND_DATA;
+   if (session->state == DONE)
+      return;
 
-   // If temp window is emtpy (aka we have resnt buffer before) 
-   for (i = 0; i < windowSize; i++) {
-      tmpWindow[i].seq_num = (int32_t)0;
-      memset(tmpWindow[i].packet, 0, HDR_LEN + MAX_PAYLOAD);
-      tmpWindow[i].seq_num = myWindow[i].seq_num;
-      memcpy(tmpWindow[i].packet, myWindow[i].packet, HDR_LEN + MAX_PAYLOAD);
-   } 
-
-
-   // Resend Buffer
-   for (i = 0; i < numPackets; i++) {
-      // Returns the index of the lowest unacknowledged sequencen umber sent
-      min = resendRR(client, tmpWindow, windowSize);
-      tmpWindow[min].seq_num = (int32_t)0;
-      memset(tmpWindow[min].packet, 0, HDR_LEN + MAX_PAYLOAD);
-   
-      if (select_call(client->sk_num, 0, 0, TIMER_SET) == 1) {
-         return RECV_ACK;
-      }
+   session->state = wakeSession(session, readable);
+
+   while (budget-- > 0 && session->state != DONE && session->state != WINDOW_WAIT
+      && session->state != PACE_WAIT && session->state != SIG_WAIT)
+   {
+      session->state = stepSession(session);
    }
 
-   return WINDOW_CLOSED;
+   if (session->state == WINDOW_WAIT || session->state == PACE_WAIT
+      || session->state == SIG_WAIT)
+   {
+      // a timer may have fired while it was still sending
+      wakeLater(session);
+      if (sessionDue(session))
+         queueSession(loop, session);
+   }
+   else if (session->state == DONE)
+   {
+      // freed once the current batch of events has been handled
+      session->nextClosed = loop->closed;
+      loop->closed = session;
+   }
+   else
+   {
+      queueSession(loop, session);
+   }
 }
 
+void queueSession(struct eventLoop * loop, Session * session)
+{
+   // a finished session is already waiting on the closed list
+   if (session->queued || session->state == DONE)
+      return;
+
+   session->queued = 1;
+   session->nextRun = loop->runQueue;
+   loop->runQueue = session;
+}
 
-int32_t resendRR(Connection * client, struct packets *myWindow, int windowSize)
+void watchFd(struct eventLoop * loop, int fd, struct evTag * tag)
 {
-   int i = 0;
-   int32_t minRR = 0; // index of the lowest unacknowledged packet
-   int32_t zero = (int32_t) 0;
-   u_char send[HDR_LEN + MAX_PAYLOAD];
-   
-   // This loop gets the first seq_num from the queue that is not 0
-   for(i = 0; i < windowSize; i++) 
+   struct epoll_event ev;
+
+   ev.events = EPOLLIN;
+   ev.data.ptr = tag;
+
+   if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
    {
-      if (myWindow[i].seq_num != zero)
-         minRR = i;
+      perror("epoll_ctl");
+      exit(-1);
    }
+}
 
-   if (minRR == 0 && myWindow[minRR].seq_num == zero) {
-      return 0;
-   }
+/*****
+ * Points the loop's timerfd at the wheel's next deadline (an absolute
+ * CLOCK_MONOTONIC time, the clock nowUsec() reads), or disarms it when no
+ * timer is armed. Only touches the timerfd when that deadline has moved.
+ ****/
+void armLoopTimer(struct eventLoop * loop)
+{
+   struct itimerspec spec;
+   uint64_t next = nextTimer(&loop->wheel);
 
-   for(i = 0; i < windowSize; i++)
+   if (next == loop->armed)
+      return;
+
+   memset(&spec, 0, sizeof(spec));
+   spec.it_value.tv_sec = next / 1000000;
+   spec.it_value.tv_nsec = (next % 1000000) * 1000;
+
+   if (timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
    {
-      if (myWindow[i].seq_num < myWindow[minRR].seq_num && myWindow[i].seq_num != 0)
-         minRR = i;
+      perror("timerfd_settime");
+      exit(-1);
    }
-   
-   if (myWindow[minRR].seq_num != 0) {
-      memset(send, 0, HDR_LEN + MAX_PAYLOAD);
-      memcpy(send, myWindow[minRR].packet, HDR_LEN + MAX_PAYLOAD);
-      safeSend(send, HDR_LEN + MAX_PAYLOAD, client);
-   } 
 
-   return minRR;
+   loop->armed = next;
 }
 
 /*****
- * Function to check if the received sequence number is greater than any of
- * the unacknowledged sequence numbers.
+ * Builds a session from a setup packet and answers the client. The session
+ * comes back in SEND_DATA if the file is there (SIG_WAIT with OPT_DELTA,
+ * until the client's signature is in) and DONE if it is not, or if the
+ * window the client asked for is out of range or cannot be allocated.
  ****/
-int notExpected(struct packets *myWindow, int windowSize, int32_t seq_num)
+Session * newSession(u_char * buf, int len, Connection * client, struct wheel * wheel)
 {
-   int i;
+   Session * session;
+   char file[FILE_LEN];
 
-   for (i = 0; i < windowSize; i++)
+   if ((session = malloc(sizeof(Session))) == NULL)
    {
-      if (myWindow[i].seq_num != 0 && myWindow[i].seq_num < seq_num)
-         return 1;
+      perror("newSession: malloc");
+      exit(-1);
    }
+
+   memset(session, 0, sizeof(Session));
+   memcpy(&session->client, client, sizeof(Connection));
+   session->seq_num = START_SEQ_NUM + 1;
+   session->wheel = wheel;
+   session->expiredTail = &session->expiredList;
+   initTimer(&session->idle, idleExpired, session);
+   initTimer(&session->wake, paceExpired, session);
+
+   getFileName(buf, len, file);
    
-   return 0;
+   session->fd = open(file, O_RDONLY);
+
+   session->state = setupResponse(session, buf, len);
+   // a client that was turned away only needs endSession()
+   if (session->state == DONE)
+      return session;
+
+   // compressing and delta scanning read every byte anyway, so they do
+   // without the mapping
+   if (session->options & OPT_COMPRESS)
+      initCompressor(&session->zip);
+   else if (args.zeroCopy && session->state == SEND_DATA && !(session->options & OPT_DELTA))
+      mapFile(session);
+   // the rest read the file a packet at a time, which the cache can do for them
+   if (args.cache != NULL && session->state == SEND_DATA && session->map == NULL
+      && !(session->options & (OPT_COMPRESS | OPT_DELTA)))
+      initCacheReader(&session->cache, args.cache, session->fd, session->buffSize,
+         (session->options & OPT_CRC32C) ? CACHE_CRC32C : CACHE_CKSUM);
+   if ((session->options & OPT_DELTA) && session->state == SEND_DATA)
+      session->state = SIG_WAIT;
+   // zero-copy slots only keep the header, the payload stays in the mapping.
+   // A window there is no memory for ends this session, not the server
+   if (initWindow(&session->myWindow, session->windowSize, session->seq_num,
+      session->map != NULL ? MAX_HDR_LEN : hdrLen(session->options) + session->buffSize) < 0)
+   {
+      session->state = DONE;
+      return session;
+   }
+   initRtt(&session->rtt, args.rtoMin, args.rtoMax);
+   initCc(&session->cc, args.cc, session->windowSize);
+   if (session->options & OPT_SACK)
+      initScoreboard(&session->board, session->windowSize, session->seq_num);
+   session->lastAck = nowUsec();
+   addTimer(wheel, &session->idle, session->lastAck + LONG_TIME * 1000000ULL);
+
+   // batching bypasses sendtoErr, so only batch when no errors are emulated
+   initSendBatch(&session->batch, &session->client, args.batchSize, args.errorRate > 0);
+
+   // with SO_TXTIME the qdisc does the waiting, so hand packets over sooner
+   if (args.kernelPace && enableTxtime(&session->batch))
+      initPace(&session->pace, args.paceRate, PACE_HORIZON);
+   else
+      initPace(&session->pace, args.paceRate, PACE_QUANTUM);
+
+   // after SO_TXTIME, which rules it out
+   if (!args.noGso)
+      enableGso(&session->batch);
+
+   return session;
 }
 
-void printClientIP(struct sockaddr_in6 * client)
+void endSession(Session * session)
 {
-	char ipString[INET6_ADDRSTRLEN];
-
-	inet_ntop(AF_INET6, &client->sin6_addr, ipString, sizeof(ipString));
-	printf("Client info - IP: %s Port: %d ", ipString, ntohs(client->sin6_port));
-	
+   int32_t seq;
+   struct packets * slot;
+
+   if (session->batch.packets > 0)
+      printBatchStats("Sent", session->batch.packets, session->batch.syscalls);
+   if (session->batch.gsoSends > 0)
+      printf("GSO %llu packets in %llu segmented sends (%.1f packets/send)\n",
+         (unsigned long long)session->batch.gsoPackets,
+         (unsigned long long)session->batch.gsoSends,
+         (double)session->batch.gsoPackets / session->batch.gsoSends);
+   if (session->rtt.samples > 0 || session->rtt.timeouts > 0)
+      printRttStats(&session->rtt);
+   if (session->cc.delivered > 0)
+      printCcStats(&session->cc);
+   if (session->zip.blocks > 0)
+      printCompressStats(&session->zip);
+   if (session->delta.copies + session->delta.literals > 0)
+      printDeltaStats(&session->delta);
+   if (session->cache.lookups > 0)
+      printCacheStats(&session->cache);
+   if (session->pace.rate > 0)
+      printPaceStats(&session->pace, session->batch.txtime);
+   if (session->buffSize < session->asked)
+      printf("Payload %d bytes, %d asked for (path MTU %d)\n", session->buffSize,
+         session->asked, session->mtu);
+   if (session->options & OPT_SACK)
+      printf("SACK %llu packets held early, %llu holes resent\n",
+         (unsigned long long)session->sacked, (unsigned long long)session->sackResent);
+
+   if (session->map != NULL)
+      munmap(session->map, session->mapLen);
+   if (session->fd >= 0)
+      close(session->fd);
+
+   // the wheel outlives the session in event mode
+   delTimer(session->wheel, &session->idle);
+   delTimer(session->wheel, &session->wake);
+   for (seq = session->myWindow.base; seq < session->myWindow.next; seq++)
+      if ((slot = getFromWindow(&session->myWindow, seq)) != NULL)
+         delTimer(session->wheel, &slot->timer);
+
+   close(session->client.sk_num);
+   freeWindow(&session->myWindow);
+   freeScoreboard(&session->board);
+   freeCompressor(&session->zip);
+   freeDeltaSender(&session->delta);
+   freeCacheReader(&session->cache);
+   free(session->reply);
+   free(session);
 }
 
-void fillPkt(u_char *pkt, uint32_t seq, uint8_t flag, char *data)
+/*****
+ * Zero-copy mode: maps the whole file so data packets can be sent straight
+ * from the page cache. Empty files and files that cannot be mapped fall
+ * back to read().
+ ****/
+void mapFile(Session * session)
 {
-   unsigned short cksum = 0;
-   uint32_t seq_num = htonl(seq);
+   struct stat st;
+   void * map;
 
-   // clearing pkt
-   memset(pkt, 0, HDR_LEN + MAX_PAYLOAD);
+   if (fstat(session->fd, &st) < 0 || st.st_size == 0)
+      return;
 
-   // store sequence number in network order
-   memcpy(pkt, &seq_num, 4);
+   if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, session->fd, 0)) == MAP_FAILED)
+   {
+      perror("mapFile: mmap");
+      return;
+   }
 
-   // store fake (0-value) checksum 
-   memcpy(pkt + 4, &cksum, 2);
+   madvise(map, st.st_size, MADV_SEQUENTIAL);
+   session->map = map;
+   session->mapLen = st.st_size;
+}
 
-   // store flag
-   pkt[6] = flag;
+/*****
+ * Works out which bytes of the file the session sends. With OPT_STRIPE
+ * the file is cut into stripes counted equal pieces, each rounded up to
+ * STRIPE_ALIGN bytes, so every session for the same file cuts it the same
+ * way whatever payload size it settled on; stripes past the end are empty.
+ * Without a stripe the session sends from 0 to EOF. With OPT_RESUME it
+ * starts at resume instead, as long as that is inside the range and the
+ * file is still the size the client expects; otherwise it starts from
+ * the beginning of the range, and the reply says which.
+ ****/
+void sendRange(Session * session, int64_t resume, int64_t size)
+{
+   struct stat st;
+   off_t chunk;
 
-   // store data
-   memcpy(pkt + 7, data, MAX_PAYLOAD);
+   session->offset = 0;
+   session->end = -1;
 
-   // calculate and store checksum
-   cksum = in_cksum((unsigned short *)pkt, HDR_LEN + MAX_PAYLOAD);
-   memcpy(pkt + 4, &cksum, 2);
-}
+   if (!(session->options & (OPT_STRIPE | OPT_RESUME)))
+      return;
 
-void printWindow(struct packets *myWindow, int windowSize)
-{
-   int i = 0;
-   int32_t seq;
-   int32_t zero = (int32_t) 0;
-   printf("***************\nWindow:\n");
-   for (i = 0; i < windowSize; i++)
+   if (fstat(session->fd, &st) < 0)
    {
-      printf("%d: ", i);
-      if (myWindow[i].seq_num != zero)
-         printf("seq num #%d || DATA: %s\n", myWindow[i].seq_num, myWindow[i].packet + HDR_LEN);
-      else
-         printf("\n");
+      perror("sendRange: fstat");
+      st.st_size = 0;
+   }
+   session->fileSize = st.st_size;
+
+   if (session->options & OPT_STRIPE) {
+      chunk = (st.st_size + session->stripes - 1) / session->stripes;
+      chunk = (chunk + STRIPE_ALIGN - 1) / STRIPE_ALIGN * STRIPE_ALIGN;
+
+      session->offset = (off_t)session->stripe * chunk;
+      if (session->offset > st.st_size)
+         session->offset = st.st_size;
+      session->end = session->offset + chunk;
+      if (session->end > st.st_size)
+         session->end = st.st_size;
+   }
+
+   if ((session->options & OPT_RESUME) && (size < 0 || size == st.st_size)
+      && resume >= session->offset && resume <= (session->end >= 0 ? session->end : st.st_size))
+   {
+      session->offset = resume;
    }
-   printf("***************\n\n");
 }
 
-void saveToWindow(struct packets *myWindow, int windowSize, u_char * packet)
+/*****
+ * OPT_COMPRESS: points from at the next buf_size bytes (or what is left)
+ * of the current frame and returns how many. Once a frame has all gone
+ * the next block of the file, up to the stripe's end, is read and
+ * compressed (compress.c). A frame's last packet can be short, so packets
+ * never straddle frames. Returns 0 at the end and -1 if pread() failed.
+ ****/
+int nextFrame(Session * session, int buf_size, u_char ** from)
 {
-   int32_t seq;
-   int32_t zero = (int32_t)0;
-   int index = 0, i = 0;
-   
-   memcpy(&seq, packet, 4);
-   seq = ntohl(seq);
-
-   for(i = 0; i < windowSize; i++)
-   {
-      if (myWindow[i].seq_num == zero)
-      {
-         memcpy(&(myWindow[i].seq_num), &seq, 4);
-         memcpy((myWindow[i].packet), packet, HDR_LEN + MAX_PAYLOAD);
-         return;
-      } // or save to window if seq num is old 
+   struct compressor * zip = &session->zip;
+   int want = COMPRESS_BLOCK;
+   int len;
+
+   if (zip->pos == zip->len) {
+      if (session->end >= 0 && session->end - session->offset < want)
+         want = session->end - session->offset;
+      if ((len = pread(session->fd, blockBuffer(zip), want, session->offset)) <= 0)
+         return len;
+      session->offset += len;
+      compressBlock(zip, len);
    }
+
+   len = zip->len - zip->pos;
+   if (len > buf_size)
+      len = buf_size;
+   *from = zip->frame + zip->pos;
+   zip->pos += len;
+
+   return len;
 }
 
-int itemsInWindow(struct packets * myWindow, int windowSize)
+/*****
+ * OPT_DELTA: points from at the next buf_size bytes (or what is left) of
+ * ops, reading the file on as makeDelta() scans it (delta.c). Returns 0 at
+ * the end and -1 if pread() failed.
+ ****/
+int nextDelta(Session * session, int buf_size, u_char ** from)
 {
-   int count = 0;
-   int i;
-   int32_t zero = (int32_t)0;
+   struct deltaSender * delta = &session->delta;
+   u_char * space;
+   int want;
+   int len;
 
-   for (i = 0; i < windowSize; i++) 
+   while (delta->outPos == delta->outLen)
    {
-      if (myWindow[i].seq_num != zero) 
-         count++;
+      if ((len = makeDelta(delta, buf_size)) == 0)
+         return 0;
+      if (len > 0)
+         break;
+
+      space = deltaSpace(delta, &want);
+      if ((len = pread(session->fd, space, want, session->offset)) < 0)
+         return -1;
+      session->offset += len;
+      deltaRead(delta, len);
    }
 
-   return count;
+   len = delta->outLen - delta->outPos;
+   if (len > buf_size)
+      len = buf_size;
+   *from = delta->out + delta->outPos;
+   delta->outPos += len;
+
+   return len;
 }
 
 /*****
- * Funciton to remove packet from a window. (Packet was Acknowledged)
+ * SIG_WAIT: takes every signature page waiting on the socket and answers
+ * each with a RR for the first page still missing, so the client resends
+ * from there. A setup packet means the client did not get the reply (a
+ * corrupt one still tells it where this session is), so it goes again.
+ * Anything else is dropped. Returns SEND_DATA once the whole signature is
+ * in.
  ****/
-void delFromWindow(struct packets * myWindow, int windowSize, int seq_num)
+int recvSignature(Session * session)
 {
-   int i = 0;
+   Connection * client = &session->client;
+   struct deltaSender * delta = &session->delta;
+   int size = MAX_HDR_LEN + session->buffSize;
+   u_char page[size > HDR_LEN + DEFAULT_PAYLOAD ? size : HDR_LEN + DEFAULT_PAYLOAD];
+   u_char pkt[MAX_HDR_LEN + 4];
+   int hdr_len = hdrLen(session->options);
+   int32_t recv_len;
+   int32_t seq;
+   int pkt_len;
 
-   for(i = 0; i < windowSize; i++)
+   while (delta->missing < delta->pages && ackReady(session))
    {
-      if (myWindow[i].seq_num <= seq_num) 
+      recv_len = safeRecv(client->sk_num, page, sizeof(page), client);
+      if (recv_len > HDR_LEN && page[6] == 1 && crcCheck(page, recv_len) == 0) {
+         safeSend(session->reply, session->replyLen, client);
+         continue;
+      }
+      if (recv_len < hdr_len || checkPkt(page, recv_len, session->options) == 1
+         || page[6] != SIG_FLAG)
       {
-         myWindow[i].seq_num = (int32_t)0;
-         memset(myWindow[i].packet, 0, HDR_LEN + MAX_PAYLOAD);
+         continue;
       }
+
+      session->lastAck = nowUsec();
+      addTimer(session->wheel, &session->idle, session->lastAck + LONG_TIME * 1000000ULL);
+
+      memcpy(&seq, page, 4);
+      if (takePage(delta, ntohl(seq), page + hdr_len, recv_len - hdr_len) < 0)
+         continue;
+
+      seq = htonl(delta->missing);
+      pkt_len = fillPkt(pkt, 0, RR, (char *)&seq, 4, session->options);
+      safeSend(pkt, pkt_len, client);
    }
+
+   if (delta->missing < delta->pages)
+      return SIG_WAIT;
+
+   free(session->reply);
+   session->reply = NULL;
+   return SEND_DATA;
 }
 
-int checkArgs(int argc, char *argv[])
+/*****
+ * Copies the file name out of a setup packet of len bytes into file
+ * (FILE_LEN bytes), always leaving it NUL terminated.
+ ****/
+void getFileName(u_char * pkt, int len, char * file)
 {
-	// Checks args and returns port number
-	int portNumber = 0;
+   int nameLen = len - HDR_LEN - 4;
 
-	if (argc > 3 || argc == 1)
-	{
-		fprintf(stderr, "Usage %s err-percent [optional port number]\n", argv[0]);
-		exit(-1);
-	}
-	
-   if (atoi(argv[1]) < 0 || atoi(argv[1]) >= 1)
-	{
-		printf("Error rate needs to be between 0 and less than 1 and is %s\n", argv[1]);
-      exit(-1);
-	}
+   if (nameLen < 0)
+      nameLen = 0;
+   if (nameLen > FILE_LEN - 1)
+      nameLen = FILE_LEN - 1;
 
-   if (argc == 3)
-   {
-      portNumber = atoi(argv[2]);
-   }
-	
-	return portNumber;
+   memset(file, 0, FILE_LEN);
+   memcpy(file, pkt + HDR_LEN + 4, nameLen);
 }
 
-
+/*****
+ * Answers a setup packet. The payload per packet is what the client asked
+ * for, cut down to MAX_PAYLOAD and to what the path MTU carries in one
+ * datagram (pathMtu()). The reply is name, options, the payload size, for
+ * a stripe or a resume (OPT_STRIPE, OPT_RESUME) where the data starts and
+ * the file's size, and then
+ * zeros up to a full data packet's length, so it is also the probe:
+ * if the path cannot carry packets that big the client hears nothing, and
+ * its retry asks for less (PROBE_TRIES) or finds the MTU the kernel has
+ * learned from the ICMP error since.
+ ****/
+int setupResponse(Session * session, u_char *pkt, int len)
+{
+   Connection * client = &session->client;
+   uint8_t flag;
+   char file[FILE_LEN];
+   uint16_t payload;
+   uint64_t range;
+   int64_t resume = 0;
+   int64_t resumeSize = -1;
+   uint32_t blockSize;
+   uint32_t blocks;
+   int send_len;
+   int reply_len;
+   int returnVal = DONE;
+ 
+   // Save filename 
+   getFileName(pkt, len, file);
+
+   // keep only the options this server understands, SACK needs selective repeat
+   session->options = getOptions(pkt, len, HDR_LEN + 4) & (OPT_SELECTIVE | OPT_CRC32C
+      | OPT_SACK | OPT_STRIPE | OPT_RESUME | OPT_COMPRESS | OPT_DELTA);
+   if (!(session->options & OPT_SELECTIVE))
+      session->options &= ~OPT_SACK;
+   // a delta is of the whole file, as it is
+   if (session->fd < 0 || (session->options & (OPT_STRIPE | OPT_COMPRESS)))
+      session->options &= ~OPT_DELTA;
+   if ((session->options & OPT_STRIPE) && (session->fd < 0
+      || getStripe(pkt, len, HDR_LEN + 4, &session->stripe, &session->stripes) < 0))
+   {
+      session->options &= ~OPT_STRIPE;
+   }
+   if ((session->options & OPT_RESUME) && (session->fd < 0
+      || getResume(pkt, len, HDR_LEN + 4, &resume, &resumeSize) < 0))
+   {
+      session->options &= ~OPT_RESUME;
+   }
+
+   memcpy(&session->windowSize, pkt + HDR_LEN, 2);
+   memcpy(&session->buffSize, pkt + HDR_LEN + 2, 2);
+ 
+   if ((client->sk_num = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+   {
+      perror("filename, open client socket");
+      exit(-1);
+   }
+   
+
+   session->windowSize = (int16_t)ntohs(session->windowSize);
+   session->buffSize = ntohs(session->buffSize);
+
+   // nothing is built for a window that is not there or too big to
+   // hold, the client is turned away like a missing file
+   if (session->windowSize < 1 || session->windowSize > MAX_WINDOW)
+      printf("Window of %d packets is not between 1 and %d\n", session->windowSize, MAX_WINDOW);
+   session->asked = session->buffSize;
+
+   if (session->buffSize > MAX_PAYLOAD)
+      session->buffSize = MAX_PAYLOAD;
+   if (session->buffSize == 0)
+      session->buffSize = DEFAULT_PAYLOAD;
+   session->mtu = pathMtu(client);
+   if (session->mtu > 0 && session->buffSize > session->mtu - IP_UDP_LEN - hdrLen(session->options))
+      session->buffSize = session->mtu - IP_UDP_LEN - hdrLen(session->options);
+
+   // the signature comes in pages of whole sums, one to a data packet
+   if ((session->options & OPT_DELTA) && (getDelta(pkt, len, HDR_LEN + 4, &blockSize, &blocks) < 0
+      || initDeltaSender(&session->delta, blockSize, blocks, session->buffSize) < 0))
+   {
+      session->options &= ~OPT_DELTA;
+   }
+
+   int padded = hdrLen(session->options) + session->buffSize - HDR_LEN;
+   char reply[FILE_LEN + 3 + 16 + padded];
+   u_char send[HDR_LEN + sizeof(reply)];
+ 
+   if (session->windowSize < 1 || session->windowSize > MAX_WINDOW) {
+      flag = 8; // turned away
+   } else if( access( file, F_OK ) != -1 ) { 
+      flag = 2; // file exists 
+      returnVal = SEND_DATA;
+      sendRange(session, resume, resumeSize);
+   } else {
+      flag = 8; // file doesn't exist
+   }
+
+   // echo the file name and the options that were accepted, then say how
+   // big the data packets will be and pad the reply out to that
+   reply_len = strlen(file) + 1;
+   memcpy(reply, file, reply_len);
+   reply[reply_len++] = session->options;
+   payload = htons(session->buffSize);
+   memcpy(reply + reply_len, &payload, 2);
+   reply_len += 2;
+   // and for a stripe or a resume, where it starts and how big the file is
+   if (session->options & (OPT_STRIPE | OPT_RESUME)) {
+      range = htobe64(session->offset);
+      memcpy(reply + reply_len, &range, 8);
+      range = htobe64(session->fileSize);
+      memcpy(reply + reply_len + 8, &range, 8);
+      reply_len += 16;
+   }
+   if (reply_len < padded) {
+      memset(reply + reply_len, 0, padded - reply_len);
+      reply_len = padded;
+   }
+
+   // the reply itself still uses in_cksum, the client can't know yet
+   send_len = fillPkt(send, 1, flag, reply, reply_len, 0);
+   
+   safeSend(send, send_len, client);
+
+   // kept until the client acks (or its signature is in), in case the
+   // reply is lost and it asks again
+   if (returnVal == SEND_DATA) {
+      if ((session->reply = malloc(send_len)) == NULL)
+      {
+         perror("setupResponse: malloc");
+         exit(-1);
+      }
+      memcpy(session->reply, send, send_len);
+      session->replyLen = send_len;
+   }
+
+   return returnVal;
+}
+
+/*****
+ * Checks, without blocking, whether an RR or SREJ is waiting on the socket.
+ ****/
+int ackReady(Session * session)
+{
+   return poll_call(session->client.sk_num, 0) == 1;
+}
+
+/*****
+ * -p cc: paces at the rate the congestion controller wants, turned from
+ * packets into bytes at this session's full packet size.
+ ****/
+void updatePace(Session * session)
+{
+   if (args.paceCc)
+   {
+      setPaceRate(&session->pace, ccRate(&session->cc, session->rtt.srtt)
+         * (hdrLen(session->options) + session->buffSize));
+   }
+}
+
+/*****
+ * A packet's retransmit timer ran out. As with a single RTO restarted on
+ * every ACK, a packet only times out once nothing has been heard for an
+ * RTO as well: in selective repeat the packets after a hole stay unacked
+ * until the SREJ'd resend fills it. Otherwise the timer is pushed back.
+ * A packet that did time out goes on the session's expired list.
+ ****/
+void packetExpired(struct timer * timer)
+{
+   Session * session = timer->data;
+   struct packets * slot = (struct packets *)((char *)timer - offsetof(struct packets, timer));
+   uint64_t due = session->lastAck + rttTimeout(&session->rtt);
+
+   if (due > nowUsec()) {
+      addTimer(session->wheel, timer, due);
+      return;
+   }
+
+   pushExpired(session, slot);
+   session->expired++;
+   if (session->loop != NULL)
+      queueSession(session->loop, session);
+}
+
+/*****
+ * The expired list holds the slots whose timers ran out, in the order they
+ * did, until they are resent, acked or SACKed, so a timeout only looks at
+ * those and not the whole window. As on the wheel, pprevExpired points at
+ * whatever points at the slot and it comes off in O(1).
+ ****/
+void pushExpired(Session * session, struct packets * slot)
+{
+   if (slot->pprevExpired != NULL)
+      return;
+
+   slot->nextExpired = NULL;
+   slot->pprevExpired = session->expiredTail;
+   *session->expiredTail = slot;
+   session->expiredTail = &slot->nextExpired;
+}
+
+void dropExpired(Session * session, struct packets * slot)
+{
+   if (slot->pprevExpired == NULL)
+      return;
+
+   *slot->pprevExpired = slot->nextExpired;
+   if (slot->nextExpired != NULL)
+      slot->nextExpired->pprevExpired = slot->pprevExpired;
+   else
+      session->expiredTail = slot->pprevExpired;
+   slot->nextExpired = NULL;
+   slot->pprevExpired = NULL;
+}
+
+// Nothing has been heard from the client for LONG_TIME seconds
+void idleExpired(struct timer * timer)
+{
+   Session * session = timer->data;
+
+   session->timedOut = 1;
+   if (session->loop != NULL)
+      queueSession(session->loop, session);
+}
+
+// PACE_WAIT: the next pacing slot has come
+void paceExpired(struct timer * timer)
+{
+   Session * session = timer->data;
+
+   session->paced = 1;
+   if (session->loop != NULL)
+      queueSession(session->loop, session);
+}
+
+/*****
+ * Before a session waits: a PACE_WAIT needs its wakeup armed for the next
+ * pacing slot. A WINDOW_WAIT is ended by its packets' own timers.
+ ****/
+void wakeLater(Session * session)
+{
+   int64_t delay;
+
+   if (session->state != PACE_WAIT || timerPending(&session->wake))
+      return;
+
+   delay = paceDelay(&session->pace, nowUsec());
+   addTimer(session->wheel, &session->wake, nowUsec() + (delay > 0 ? delay : 0));
+}
+
+// Returns 1 if one of the session's timers fired and it has not run since
+int sessionDue(Session * session)
+{
+   return session->timedOut || session->paced
+      || (session->state == WINDOW_WAIT && session->expired > 0);
+}
+
+/*****
+ * Finishes a WINDOW_WAIT or PACE_WAIT if the socket is readable or one of
+ * the session's timers has fired, takes signature pages in SIG_WAIT, and gives up on a client that has not
+ * been heard from for LONG_TIME seconds. Returns the state to carry on in,
+ * the same one if the session is still waiting.
+ ****/
+int wakeSession(Session * session, int readable)
+{
+   if (session->timedOut)
+   {
+      printf("Nothing heard for %d seconds. other side is down\n", LONG_TIME);
+      return DONE;
+   }
+
+   if (session->batch.refused)
+      return stepSession(session);
+
+   // an earlier event in the same batch may have read the ACK already,
+   // and recvAck() would block on the empty socket
+   if (readable && !ackReady(session))
+      readable = 0;
+
+   if (session->state == WINDOW_WAIT)
+   {
+      if (!readable && session->expired == 0)
+         return WINDOW_WAIT;
+
+      return windowWait(session, readable);
+   }
+
+   if (session->state == SIG_WAIT)
+      return readable ? recvSignature(session) : SIG_WAIT;
+
+   if (session->state == PACE_WAIT)
+   {
+      if (!readable && !session->paced)
+         return PACE_WAIT;
+
+      delTimer(session->wheel, &session->wake);
+      session->paced = 0;
+      return SEND_DATA;
+   }
+
+   return session->state;
+}
+
+/*****
+ * Runs one step of the transfer state machine. WINDOW_WAIT and DONE are
+ * left to the caller since they depend on how the session is being driven.
+ ****/
+int stepSession(Session * session)
+{
+   // the client's port has closed, so it is gone for good
+   if (session->batch.refused)
+   {
+      printf("Client is gone, its port is closed\n");
+      return DONE;
+   }
+
+   switch (session->state)
+   {
+      case SEND_DATA: // Open window
+         return sendData(session);
+      case RECV_ACK:
+         return recvAck(session);
+      case WINDOW_CLOSED:
+         return windowClosed(session);
+      default:
+         return DONE;
+   }
+}
+
+/***** 
+ * This sendData() method used to read file contents into a buffer to send to the client.
+ * Some of the code below was adapted from Professor Smith's solution for Stop
+ * and Wait Protocol
+ ****/
+int sendData(Session * session)
+{
+   int buf_size = session->buffSize;
+   int window_size = session->windowSize;
+   int cwnd = ccWindow(&session->cc);
+   int returnVal = SEND_DATA;
+   int len_read = 0;
+   int want;
+   int items = itemsInWindow(&session->myWindow);
+   u_char data[buf_size + 1];
+   u_char pkt[MAX_HDR_LEN + buf_size];
+   int pkt_len = 0;
+   u_char * payload = NULL;
+   u_char * from;
+   uint32_t sum = 0;
+   struct packets * slot;
+   
+   if (ackReady(session)) {
+      session->windowCount--;
+      return RECV_ACK;
+   }
+
+   // *****
+   // Anything a resend left for later goes before new data, and only as
+   // much as the congestion window has room for. It adds nothing to the
+   // window, so a full one does not hold it back
+   // *****
+
+   if (session->resendNext < session->myWindow.base)
+      session->resendNext = session->myWindow.base;
+
+   if (session->resendNext < session->resendEnd && (session->options & OPT_SELECTIVE))
+      return resendExpired(session);
+
+   if (session->resendNext < session->resendEnd) {
+      while (session->resendNext < session->resendEnd
+         && session->resendNext < session->myWindow.base + cwnd
+         && paceDelay(&session->pace, nowUsec()) == 0)
+      {
+         resendRR(session, session->resendNext++);
+      }
+
+      flushSend(&session->batch);
+      if (session->resendNext == session->resendEnd)
+         return SEND_DATA;
+      return session->resendNext < session->myWindow.base + cwnd ? PACE_WAIT : WINDOW_CLOSED;
+   }
+
+   // *****
+   // if window is closed wait for ack before continuing!!!
+   // *****
+
+   if (session->windowCount == window_size) {
+      session->windowCount--; // once window is open, reduce the count and send more data
+      return WINDOW_CLOSED;
+   }
+
+   // a full window is no loss, rcopy may be holding back a delayed RR (and
+   // with SACK the scoreboard finds the holes), so wait for it or the RTO
+   if (items == window_size)
+      return WINDOW_CLOSED;
+
+   // *****
+   // Window is currently open, fill all of it and send it as one burst
+   // (or as much as pacing lets out now)
+   // *****
+
+   while (returnVal == SEND_DATA && itemsInWindow(&session->myWindow) < window_size
+      && itemsInWindow(&session->myWindow) < cwnd && session->windowCount < window_size
+      && paceDelay(&session->pace, nowUsec()) == 0)
+   {
+      // a stripe stops at its end rather than the file's
+      want = buf_size;
+      if (session->end >= 0 && session->end - session->offset < want)
+         want = session->end - session->offset;
+
+      from = data;
+      if (session->map != NULL) {
+         // zero-copy: the payload stays in the mapping
+         len_read = session->mapLen - session->offset;
+         if (len_read > want)
+            len_read = want;
+         payload = session->map + session->offset;
+         session->offset += len_read;
+      } else if (session->zip.frame != NULL) {
+         // compressed: the next piece of the current frame
+         len_read = nextFrame(session, buf_size, &from);
+      } else if (session->options & OPT_DELTA) {
+         // only what the client's old copy lacks
+         len_read = nextDelta(session, buf_size, &from);
+      } else if (session->cache.data != NULL) {
+         // out of the packet cache, already summed
+         len_read = nextCached(&session->cache, session->fd, &session->offset, session->end,
+            &from, &sum);
+      } else {
+         len_read = pread(session->fd, data, (size_t)want, session->offset);
+         if (len_read > 0)
+            session->offset += len_read;
+      }
+
+      switch(len_read)
+      {
+         case -1: // error with pread() system call
+            perror("sendData: read error");
+            returnVal = DONE;
+            break;
+         case 0: // no bytes read in system call (end of file)
+            pkt_len = fillPkt(pkt, session->seq_num, EOF_FLAG, data, 0, session->options);
+            returnVal = WINDOW_CLOSED;                
+            break;
+         default: // something read
+            if (session->map != NULL)
+               pkt_len = fillHdr(pkt, session->seq_num, DATA_FLAG, payload, len_read, session->options);
+            else if (session->cache.data != NULL)
+               pkt_len = fillSummed(pkt, session->seq_num, DATA_FLAG, from, len_read,
+                  session->options, sum, cachedShift(&session->cache, len_read));
+            else
+               pkt_len = fillPkt(pkt, session->seq_num, DATA_FLAG, from, len_read, session->options);
+            returnVal = SEND_DATA;
+            session->seq_num++;
+            break;
+      }
+
+      if (returnVal == DONE)
+         break;
+
+      // the window slot stays put until it is RR'd, so send straight from it
+      slot = saveToWindow(&session->myWindow, pkt, pkt_len, len_read > 0 ? payload : NULL);
+      queueSlot(session, slot);
+      session->windowCount++;
+   }
+
+   flushSend(&session->batch);
+    
+   // *****
+   // Continually check for RRs and SREJs
+   // *****
+   if (returnVal != DONE && ackReady(session)) {
+      session->windowCount--;
+      return RECV_ACK;
+   }
+
+   // the congestion window is full, wait for it to open (a full window
+   // is left to the windowCount check above)
+   if (returnVal == SEND_DATA && cwnd < window_size
+      && itemsInWindow(&session->myWindow) >= cwnd)
+      return WINDOW_CLOSED;
+
+   // there is room in the window but the next pacing slot is still to come
+   if (returnVal == SEND_DATA && itemsInWindow(&session->myWindow) < window_size
+      && session->windowCount < window_size && paceDelay(&session->pace, nowUsec()) > 0)
+   {
+      session->pace.waits++;
+      return PACE_WAIT;
+   }
+
+   return returnVal;
+}
+
+int recvAck(Session * session)
+{
+   Connection * client = &session->client;
+   int32_t recv_len = 0;
+   int recvFlag = 0;
+   int32_t srej;
+   int32_t rr;
+   u_char ack[MAX_HDR_LEN + DEFAULT_PAYLOAD];
+   int hdr_len = hdrLen(session->options);
+   int newly;
+   int64_t sample;
+   uint64_t now;
+   struct packets * acked;
+
+   recv_len = safeRecv(client->sk_num, ack, MAX_HDR_LEN + DEFAULT_PAYLOAD, client);
+
+   // the setup again, from a client that got data before the reply
+   if (session->reply != NULL && recv_len > HDR_LEN && ack[6] == 1 && crcCheck(ack, recv_len) == 0) {
+      safeSend(session->reply, session->replyLen, client);
+      return WINDOW_CLOSED;
+   }
+
+   if (checkPkt(ack, recv_len, session->options) == 1) {
+      return WINDOW_CLOSED; // Wait on ACK
+   }
+
+   // an ack means the client has the reply
+   free(session->reply);
+   session->reply = NULL;
+
+   // the client is still there, put off giving up on it
+   session->lastAck = nowUsec();
+   addTimer(session->wheel, &session->idle, session->lastAck + LONG_TIME * 1000000ULL);
+
+   recvFlag = ack[6];
+
+   if (recv_len < hdr_len + 4) {
+      return WINDOW_CLOSED; // too short to carry a sequence number
+   }
+
+   if (recvFlag == RR) {
+      memcpy(&rr, ack + hdr_len, 4);
+      rr = ntohl(rr);
+
+      // time the newest packet this RR covers, unless it was resent (Karn)
+      // or SACK'd earlier, when it was already timed
+      acked = getFromWindow(&session->myWindow, rr - 1);
+      now = nowUsec();
+      sample = 0;
+      if (acked != NULL && acked->resent == 0 && !acked->sacked)
+         rttSample(&session->rtt, sample = now - acked->sent);
+      else if (acked != NULL)
+         rttProgress(&session->rtt);
+
+      if (acked != NULL) {
+         newly = rr - session->myWindow.base;
+         ccAck(&session->cc, newly, sample, acked->sent, acked->delivered, now);
+         if (acked->sent > session->rackSent)
+            session->rackSent = acked->sent;
+      }
+
+      releaseWindow(session, rr - 1);
+
+      // a coalesced RR covers more than the one packet it is counted for
+      if (session->windowCount > itemsInWindow(&session->myWindow))
+         session->windowCount = itemsInWindow(&session->myWindow);
+
+      // a RR without a map says nothing is held, which counts too
+      if (session->options & OPT_SACK)
+         recvSack(session, rr, ack + hdr_len + 4, recv_len - hdr_len - 4, now);
+
+      updatePace(session);
+   } else if (recvFlag == SREJ && (session->options & OPT_SELECTIVE)) {
+      // selective repeat: the client holds everything else, so only the
+      // missing packet goes out again. A SREJ is not a cumulative ACK here
+      // since the client may report a gap above one it is still missing.
+      memcpy(&srej, ack + hdr_len, 4);
+      srej = ntohl(srej);
+      ccLoss(&session->cc, srej, session->myWindow.next);
+      updatePace(session);
+      resendRR(session, srej);
+      flushSend(&session->batch);
+   } else if (recvFlag == SREJ) {
+      memcpy(&srej, ack + hdr_len, 4); // seq num we want to resend
+      srej = ntohl(srej);
+      releaseWindow(session, srej - 1);
+      ccLoss(&session->cc, srej, session->myWindow.next);
+      updatePace(session);
+
+      // the client SREJs a hole at most once a round trip, but an older
+      // rcopy SREJs every packet after a loss, so a SREJ repeated within a
+      // round trip does not resend the window again
+      now = nowUsec();
+      if (srej != session->srejSeq || now - session->srejAt > session->rtt.srtt) {
+         session->srejSeq = srej;
+         session->srejAt = now;
+         session->windowCount = 0;
+         resendBuff(session);
+      }
+      return WINDOW_CLOSED; // resend buffer and close window
+   } else if (recvFlag == SIG_FLAG) {
+      // a page resent before the RR saying the signature was all in got there
+      return WINDOW_CLOSED;
+   } else if (recvFlag == EOF_ACK) {
+      return DONE;
+   } else {
+      return DONE;
+   }
+
+   return SEND_DATA;
+}
+
+/*****
+ * Releases every packet up to and including seq_num (a cumulative RR),
+ * stops their retransmit timers and takes them off the expired list.
+ ****/
+void releaseWindow(Session * session, int32_t seq_num)
+{
+   struct window * myWindow = &session->myWindow;
+   struct packets * slot;
+   int32_t seq;
+
+   for (seq = myWindow->base; seq <= seq_num && seq < myWindow->next; seq++)
+   {
+      if ((slot = getFromWindow(myWindow, seq)) != NULL) {
+         delTimer(session->wheel, &slot->timer);
+         dropExpired(session, slot);
+      }
+   }
+
+   delFromWindow(myWindow, seq_num);
+}
+ 
+/*****
+ * SACK: map has a bit for every packet above rr that the client already
+ * holds (sackMap() in reorder.c). The ones it did not hold at the last RR
+ * are marked so a resend skips them, and their timers stopped.
+ * Any hole that was sent before one of them, by more than a quarter of an
+ * RTT of reordering, is taken as lost and resent now. That includes a
+ * resend that was lost itself, which no SREJ would report again. The
+ * scoreboard keeps this to what is new in each RR: the packets not looked
+ * at yet are gone through in the order they were sent, and stop at the
+ * first one too recent to be lost; the holes resent are rechecked in the
+ * order of their resends.
+ ****/
+void recvSack(Session * session, int32_t rr, u_char * map, int len, uint64_t now)
+{
+   struct window * myWindow = &session->myWindow;
+   struct scoreboard * board = &session->board;
+   struct packets * slot;
+   uint64_t newest = 0;
+   int64_t reorder = session->rtt.srtt / 4;
+   int32_t seq;
+   int holes;
+   int lost = 0;
+   int i;
+
+   len = newlySacked(board, rr, map, len);
+
+   for (i = 0; i < len * 8; i++) {
+      if (map[i / 8] == 0) {
+         i |= 7; // nothing new in this byte's 8 packets
+         continue;
+      }
+      if (!(map[i / 8] & (0x80 >> (i % 8))))
+         continue;
+
+      seq = rr + 1 + i;
+      if (seq > board->top)
+         board->top = seq;
+      if ((slot = getFromWindow(myWindow, seq)) == NULL || slot->sacked)
+         continue;
+
+      slot->sacked = 1;
+      delTimer(session->wheel, &slot->timer);
+      dropExpired(session, slot);
+      session->sacked++;
+      if (slot->resent == 0 && slot->sent > newest)
+         newest = slot->sent;
+      if (slot->sent > session->rackSent)
+         session->rackSent = slot->sent;
+   }
+
+   if (newest > 0)
+      rttSample(&session->rtt, now - newest);
+
+   // holes resent before, lost again if something sent after the resend
+   // has made it. Each is looked at once per pass, it goes to the back
+   // when it is resent again.
+   for (holes = board->count; holes > 0; holes--) {
+      seq = firstSackHole(board)->seq_num;
+      slot = getFromWindow(myWindow, seq);
+      if (slot != NULL && !slot->sacked && slot->sent != firstSackHole(board)->sent) {
+         // resent since by its timer or a SREJ, so it belongs further back
+         popSackHole(board);
+         pushSackHole(board, seq, slot->sent);
+         continue;
+      }
+      if (slot != NULL && !slot->sacked && slot->sent + reorder >= session->rackSent)
+         break;
+
+      popSackHole(board);
+      if (slot == NULL || slot->sacked)
+         continue; // RR'd or held since
+
+      ccLoss(&session->cc, seq, myWindow->next);
+      resendRR(session, seq);
+      pushSackHole(board, seq, slot->sent);
+      session->sackResent++;
+      lost++;
+   }
+
+   // then the packets no RR has got past yet, below the highest one held
+   if (board->next < myWindow->base)
+      board->next = myWindow->base;
+
+   for (; board->next < board->top; board->next++) {
+      seq = board->next;
+      if ((slot = getFromWindow(myWindow, seq)) == NULL || slot->sacked)
+         continue;
+
+      if (slot->sent + reorder >= session->rackSent) {
+         // too recent to be lost yet, and so is everything sent after it.
+         // One that was resent (timed out, SREJ'd) is left to the holes
+         if (slot->resent == 0 || pushSackHole(board, seq, slot->sent) < 0)
+            break;
+         continue;
+      }
+
+      ccLoss(&session->cc, seq, myWindow->next);
+      resendRR(session, seq);
+      pushSackHole(board, seq, slot->sent);
+      session->sackResent++;
+      lost++;
+   }
+
+   if (lost > 0)
+      flushSend(&session->batch);
+}
+
+/*****
+ * The window is closed. Moves to WINDOW_WAIT where the caller waits for an
+ * ACK or for one of the packets' retransmit timers (the session's idle
+ * timer gives up on the client).
+ ****/
+int windowClosed(Session * session)
+{
+   if (itemsInWindow(&session->myWindow) == 0)
+      return SEND_DATA;
+
+   // the rest of a resend goes out now or once pacing allows: resendBuff()
+   // may have stopped early for an ACK, and the packets it left behind may
+   // have no timers running to bring the session back
+   if (session->resendNext < session->myWindow.base)
+      session->resendNext = session->myWindow.base;
+
+   if (session->resendNext < session->resendEnd && resendReady(session))
+   {
+      if (paceDelay(&session->pace, nowUsec()) == 0)
+         return SEND_DATA;
+      session->pace.waits++;
+      return PACE_WAIT;
+   }
+
+   return WINDOW_WAIT;
+}
+
+/*****
+ * Finishes a WINDOW_WAIT. ready is 1 if an ACK arrived and 0 if a packet's
+ * timer ran out, in which case the RTO backs off and the window is resent:
+ * all of it in Go-Back-N, only the packets that timed out in selective
+ * repeat. A timer whose packet has been acked since it fired is ignored.
+ ****/
+int windowWait(Session * session, int ready)
+{
+   if (!ready)
+   {
+      session->expired = 0;
+      if (session->expiredList == NULL)
+         return WINDOW_CLOSED;
+
+      rttBackoff(&session->rtt);
+      ccTimeout(&session->cc, session->myWindow.next);
+      updatePace(session);
+      session->windowCount = 0;
+      resendBuff(session);
+      return WINDOW_CLOSED;
+   }
+
+   return RECV_ACK;
+}
+
+/*****
+ * Function to Resend the packets in the buffer, oldest first, or in
+ * selective repeat only the expired ones (resendExpired()). The resend
+ * goes out in batches and stops early if an RR shows up between batches.
+ * Only as many as the congestion window and pacing allow go now; sendData()
+ * sends the rest ahead of new data as RRs open the window or slots come up.
+ ****/
+int resendBuff(Session * session)
+{
+   struct window * myWindow = &session->myWindow;
+   int32_t limit = myWindow->base + ccWindow(&session->cc);
+
+   if (itemsInWindow(myWindow) == 0) // if we do not have anything in out window
+      return SEND_DATA;
+
+   session->resendNext = myWindow->base;
+   session->resendEnd = myWindow->next;
+
+   if (session->options & OPT_SELECTIVE)
+      return resendExpired(session);
+
+   while (session->resendNext < session->resendEnd && session->resendNext < limit
+      && paceDelay(&session->pace, nowUsec()) == 0)
+   {
+      resendRR(session, session->resendNext++);
+
+      // a full batch just went out
+      if (session->batch.count == 0 && ackReady(session)) {
+         return RECV_ACK;
+      }
+   }
+
+   flushSend(&session->batch);
+
+   if (ackReady(session)) {
+      return RECV_ACK;
+   }
+
+   if (session->resendNext < session->resendEnd && session->resendNext < limit) {
+      session->pace.waits++;
+      return PACE_WAIT;
+   }
+
+   return WINDOW_CLOSED;
+}
+
+/*****
+ * Queues the saved packet for seq_num to be resent. Returns seq_num, or 0
+ * if that packet is no longer in the window or the client holds it (SACK).
+ ****/
+int32_t resendRR(Session * session, int32_t seq_num)
+{
+   struct packets * slot = getFromWindow(&session->myWindow, seq_num);
+
+   if (slot == NULL || slot->sacked)
+      return 0;
+
+   slot->resent++;
+   queueSlot(session, slot);
+
+   return seq_num;
+}
+
+/*****
+ * resendBuff() in selective repeat, where the client holds the packets
+ * that arrived: resends only those on the expired list, oldest first, as
+ * far as the congestion window and pacing allow, stopping early for an RR
+ * between batches. The packets beyond the congestion window stay on the
+ * list for sendData(), which keeps new data back until the list is empty
+ * and the resend is over. Returns the state to carry on in.
+ ****/
+int resendExpired(Session * session)
+{
+   int32_t limit = session->myWindow.base + ccWindow(&session->cc);
+   struct packets * slot;
+   struct packets * next;
+
+   for (slot = session->expiredList; slot != NULL; slot = next)
+   {
+      next = slot->nextExpired;
+      if (slot->seq_num >= limit)
+         continue;
+
+      if (paceDelay(&session->pace, nowUsec()) > 0) {
+         flushSend(&session->batch);
+         session->pace.waits++;
+         return PACE_WAIT;
+      }
+
+      resendRR(session, slot->seq_num); // which takes it off the list
+
+      // a full batch just went out
+      if (session->batch.count == 0 && ackReady(session))
+         return RECV_ACK;
+   }
+
+   flushSend(&session->batch);
+
+   if (session->expiredList == NULL) {
+      session->resendNext = session->resendEnd;
+      return SEND_DATA;
+   }
+
+   return ackReady(session) ? RECV_ACK : WINDOW_CLOSED;
+}
+
+// A resend has packets left that the congestion window has room for now
+int resendReady(Session * session)
+{
+   int32_t limit = session->myWindow.base + ccWindow(&session->cc);
+   struct packets * slot;
+
+   if (!(session->options & OPT_SELECTIVE))
+      return session->resendNext < limit;
+
+   for (slot = session->expiredList; slot != NULL; slot = slot->nextExpired)
+      if (slot->seq_num < limit)
+         return 1;
+
+   return 0;
+}
+
+/*****
+ * Queues a window slot to be sent, arms its retransmit timer (taking it
+ * off the expired list) and stamps it for the RTT and delivery rate
+ * samples. A zero-copy slot goes out as two pieces, its header and the
+ * payload still sitting in the mapped file. The slot takes the next pacing
+ * slot; with SO_TXTIME that is when it leaves, otherwise it leaves now.
+ ****/
+void queueSlot(Session * session, struct packets * slot)
+{
+   int hdr_len = hdrLen(session->options);
+   uint64_t now = nowUsec();
+   uint64_t at = paceSend(&session->pace, now, slot->len);
+
+   slot->sent = session->batch.txtime ? at : now;
+   slot->delivered = session->cc.delivered;
+   slot->timer.fire = packetExpired;
+   slot->timer.data = session;
+   dropExpired(session, slot);
+   addTimer(session->wheel, &slot->timer, slot->sent + rttTimeout(&session->rtt));
+   session->batch.sendAt = at * 1000;
+
+   if (slot->payload != NULL)
+      queueSendv(&session->batch, slot->packet, hdr_len, slot->payload, slot->len - hdr_len);
+   else
+      queueSend(&session->batch, slot->packet, slot->len);
+}
+
+void printClientIP(struct sockaddr_in6 * client)
+{
+	char ipString[INET6_ADDRSTRLEN];
+
+	inet_ntop(AF_INET6, &client->sin6_addr, ipString, sizeof(ipString));
+	printf("Client info - IP: %s Port: %d ", ipString, ntohs(client->sin6_port));
+	
+}
+
+/*****
+ * Builds a packet carrying len bytes of data. Only the header and those len
+ * bytes are sent, so the total length is returned for the send call. The
+ * data is summed as it is copied in, so it is only read once. With
+ * OPT_CRC32C in options the packet carries a CRC32C instead (hdrLen()).
+ ****/
+int fillPkt(u_char *pkt, uint32_t seq, uint8_t flag, char *data, int len, uint8_t options)
+{
+   unsigned int sum;
+   unsigned short cksum = 0;
+   uint32_t seq_num = htonl(seq);
+   uint32_t crc;
+
+   // store sequence number in network order
+   memcpy(pkt, &seq_num, 4);
+
+   // store fake (0-value) checksum 
+   memcpy(pkt + 4, &cksum, 2);
+
+   // store flag
+   pkt[6] = flag;
+
+   if (options & OPT_CRC32C) {
+      crc = crc32c(0, pkt, HDR_LEN);
+      crc = htonl(crc32cCopy(crc, pkt + HDR_LEN + CRC_LEN, data, len));
+      memcpy(pkt + HDR_LEN, &crc, CRC_LEN);
+      return HDR_LEN + CRC_LEN + len;
+   }
+
+   // store data and calculate the checksum in the same pass
+   sum = in_cksum_add(0, pkt, HDR_LEN, 0);
+   sum = in_cksum_copy(sum, pkt + HDR_LEN, data, len, HDR_LEN);
+   cksum = in_cksum_fold(sum);
+   memcpy(pkt + 4, &cksum, 2);
+
+   return HDR_LEN + len;
+}
+
+/*****
+ * fillPkt() for a payload that is not copied into pkt. Only the header is
+ * built; the checksum covers the header and the payload where it lies.
+ ****/
+int fillHdr(u_char *pkt, uint32_t seq, uint8_t flag, u_char *payload, int len, uint8_t options)
+{
+   unsigned int sum;
+   unsigned short cksum = 0;
+   uint32_t seq_num = htonl(seq);
+   uint32_t crc;
+
+   memcpy(pkt, &seq_num, 4);
+   memcpy(pkt + 4, &cksum, 2);
+   pkt[6] = flag;
+
+   if (options & OPT_CRC32C) {
+      crc = crc32c(0, pkt, HDR_LEN);
+      crc = htonl(crc32c(crc, payload, len));
+      memcpy(pkt + HDR_LEN, &crc, CRC_LEN);
+      return HDR_LEN + CRC_LEN + len;
+   }
+
+   sum = in_cksum_add(0, pkt, HDR_LEN, 0);
+   sum = in_cksum_add(sum, payload, len, HDR_LEN);
+   cksum = in_cksum_fold(sum);
+   memcpy(pkt + 4, &cksum, 2);
+
+   return HDR_LEN + len;
+}
+
+/*****
+ * fillPkt() for a payload whose sum is already known (the packet cache):
+ * the payload is only copied, and its sum (a CRC32C of it alone, or its
+ * in_cksum_add() at the payload's offset) joined to the header's. shift is
+ * crc32cShift(len).
+ ****/
+int fillSummed(u_char *pkt, uint32_t seq, uint8_t flag, u_char *data, int len, uint8_t options,
+   uint32_t sum, uint32_t shift)
+{
+   unsigned short cksum = 0;
+   uint32_t seq_num = htonl(seq);
+   uint32_t crc;
+
+   memcpy(pkt, &seq_num, 4);
+   memcpy(pkt + 4, &cksum, 2);
+   pkt[6] = flag;
+
+   if (options & OPT_CRC32C) {
+      memcpy(pkt + HDR_LEN + CRC_LEN, data, len);
+      crc = htonl(crc32cCombine(crc32c(0, pkt, HDR_LEN), sum, shift));
+      memcpy(pkt + HDR_LEN, &crc, CRC_LEN);
+      return HDR_LEN + CRC_LEN + len;
+   }
+
+   memcpy(pkt + HDR_LEN, data, len);
+   cksum = in_cksum_fold(in_cksum_add(0, pkt, HDR_LEN, 0) + sum);
+   memcpy(pkt + 4, &cksum, 2);
+
+   return HDR_LEN + len;
+}
+
+void usage(char * name)
+{
+   fprintf(stderr, "Usage %s err-percent [optional port number] [-e] [-t threads] [-b batch] [-m ms] [-M ms] [-z] [-c cc] [-p rate] [-k] [-g] [-C MB]\n", name);
+   fprintf(stderr, "  -e  serve every client from one epoll event loop\n");
+   fprintf(stderr, "  -t  run that many event loops on SO_REUSEPORT sockets (0 = one per core)\n");
+   fprintf(stderr, "  -b  packets per sendmmsg call, 1 to %d (default %d)\n", BATCH_MAX, BATCH_MAX);
+   fprintf(stderr, "  -m  minimum retransmit timeout in ms (default %g)\n", RTO_MIN_DEFAULT / 1000.0);
+   fprintf(stderr, "  -M  maximum retransmit timeout in ms (default %g)\n", RTO_MAX_DEFAULT / 1000.0);
+   fprintf(stderr, "  -z  zero-copy: mmap files and send payloads straight from the mapping\n");
+   fprintf(stderr, "  -c  congestion control, ");
+   printCcNames();
+   fprintf(stderr, " (default fixed, the whole window)\n");
+   fprintf(stderr, "  -p  pace each client at rate Mbit/s, or at its congestion controller's rate with cc\n");
+   fprintf(stderr, "  -k  with -p, stamp packets with SO_TXTIME so the fq qdisc paces them\n");
+   fprintf(stderr, "  -g  no UDP GSO, hand the kernel every datagram on its own\n");
+   fprintf(stderr, "  -C  keep up to MB of files' packets, summed, in a cache every client shares\n");
+   exit(-1);
+}
+
+void checkArgs(int argc, char *argv[], struct serverArgs * args)
+{
+	// Checks args and fills in the port number, error rate and server mode
+   int opt;
+
+   memset(args, 0, sizeof(struct serverArgs));
+   args->mode = FORK_MODE;
+   args->batchSize = BATCH_MAX;
+   args->rtoMin = RTO_MIN_DEFAULT;
+   args->rtoMax = RTO_MAX_DEFAULT;
+
+   while ((opt = getopt(argc, argv, "et:b:m:M:zc:p:kgC:")) != -1)
+   {
+      switch (opt)
+      {
+         case 'e':
+            args->mode = EVENT_MODE;
+            break;
+         case 't':
+            args->mode = THREAD_MODE;
+            args->numThreads = atoi(optarg);
+            break;
+         case 'b':
+            args->batchSize = atoi(optarg);
+            break;
+         case 'm':
+            args->rtoMin = atof(optarg) * 1000;
+            break;
+         case 'M':
+            args->rtoMax = atof(optarg) * 1000;
+            break;
+         case 'z':
+            args->zeroCopy = 1;
+            break;
+         case 'c':
+            if ((args->cc = findCc(optarg)) == NULL)
+               usage(argv[0]);
+            break;
+         case 'p':
+            if (strcmp(optarg, "cc") == 0)
+               args->paceCc = 1;
+            else if ((args->paceRate = atof(optarg) / 8) <= 0) // Mbit/s to bytes/usec
+               usage(argv[0]);
+            break;
+         case 'k':
+            args->kernelPace = 1;
+            break;
+         case 'g':
+            args->noGso = 1;
+            break;
+         case 'C':
+            if (atof(optarg) <= 0)
+               usage(argv[0]);
+            args->cacheBytes = atof(optarg) * 1024 * 1024;
+            break;
+         default:
+            usage(argv[0]);
+            break;
+      }
+   }
+
+	if (argc - optind > 2 || argc - optind < 1)
+	{
+		usage(argv[0]);
+	}
+	
+   if (atoi(argv[optind]) < 0 || atoi(argv[optind]) >= 1)
+	{
+		printf("Error rate needs to be between 0 and less than 1 and is %s\n", argv[optind]);
+      exit(-1);
+	}
+
+   args->errorRate = atof(argv[optind]);
+
+   if (args->rtoMin < 1 || args->rtoMax < args->rtoMin)
+   {
+      printf("Need 0 < min RTO <= max RTO\n");
+      exit(-1);
+   }
+
+   if (argc - optind == 2)
+   {
+      args->portNumber = atoi(argv[optind + 1]);
+   }
+}
@@ -0,0 +1,226 @@
+// Checks cache.c with a cache of a few slots: hits, LRU eviction against a
+// model of it, changed files missing, the cached sums, and a dead holder
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "cache.h"
+#include "crc32c.h"
+#include "networks.h"
+#include "libcpe464/networks/checksum.h"
+
+#define SLOTS 3
+#define PAYLOAD 1400
+#define CHUNK ((CACHE_CHUNK / PAYLOAD) * PAYLOAD) // file bytes a reader loads at a time
+#define CHUNKS 8                                  // whole chunks in each test file
+#define FILE_BYTES (CHUNKS * CHUNK + 500)
+#define LOADS 2000                                // random loads checked against the model
+
+static int failures = 0;
+
+static void expect(int ok, char * what)
+{
+   printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+   if (!ok)
+      failures++;
+}
+
+// A test file and what it holds
+struct testFile {
+   FILE * file;
+   int fd;
+   u_char data[FILE_BYTES + 1000];
+   int len;
+};
+
+static struct testFile files[2];
+
+static void makeFile(struct testFile * f)
+{
+   int i;
+
+   for (i = 0; i < sizeof(f->data); i++)
+      f->data[i] = rand();
+   f->len = FILE_BYTES;
+
+   if ((f->file = tmpfile()) == NULL || fwrite(f->data, 1, f->len, f->file) != f->len
+      || fflush(f->file) != 0)
+   {
+      perror("cacheTest: tmpfile");
+      exit(1);
+   }
+   f->fd = fileno(f->file);
+}
+
+/*****
+ * Sends [offset, end) of a file through a fresh reader, as a session would,
+ * and checks every payload against the file and its sum against one made
+ * here: in_cksum_add() at the packet's payload offset, or crc32c(). Returns
+ * how many chunks hit, -1 if any payload or sum came back wrong.
+ ****/
+static int readRange(struct packetCache * cache, struct testFile * f, int check,
+   off_t offset, off_t end)
+{
+   struct cacheReader reader;
+   u_char * payload;
+   uint32_t sum;
+   uint32_t want;
+   int wrong = 0;
+   int len;
+
+   if (initCacheReader(&reader, cache, f->fd, PAYLOAD, check) < 0)
+      return -1;
+
+   while ((len = nextCached(&reader, f->fd, &offset, end, &payload, &sum)) > 0) {
+      want = check == CACHE_CRC32C ? crc32c(0, payload, len)
+         : in_cksum_add(0, payload, len, HDR_LEN);
+      if (sum != want || memcmp(payload, f->data + offset - len, len) != 0)
+         wrong++;
+   }
+
+   freeCacheReader(&reader);
+   return len < 0 || wrong > 0 ? -1 : (int)reader.hits;
+}
+
+// Loads whole chunk n of a file on its own; 1 if it hit, 0 if not, -1 if wrong
+static int loadChunk(struct packetCache * cache, struct testFile * f, int n)
+{
+   return readRange(cache, f, CACHE_CKSUM, (off_t)n * CHUNK, (off_t)(n + 1) * CHUNK);
+}
+
+static void hits(struct packetCache * cache)
+{
+   struct timespec times[2] = { { 0, UTIME_OMIT }, { 1000000000, 0 } };
+   struct testFile * f = &files[0];
+   int n;
+
+   expect(readRange(cache, f, CACHE_CKSUM, 0, 2 * CHUNK) == 0, "a first read misses, and its sums are right");
+   expect(readRange(cache, f, CACHE_CKSUM, 0, 2 * CHUNK) == 2, "a re-read hits, and its sums are right");
+   expect(readRange(cache, f, CACHE_CRC32C, 0, 2 * CHUNK) == 0, "CRC32C sums are cached apart from in_cksum ones");
+   expect(readRange(cache, f, CACHE_CRC32C, 0, CHUNK) == 1, "and hit in turn, right too");
+
+   // touching the file changes its mtime
+   loadChunk(cache, f, 0);
+   futimens(f->fd, times);
+   expect(loadChunk(cache, f, 0) == 0, "a file with a new mtime misses");
+   expect(loadChunk(cache, f, 0) == 1, "and hits once read again");
+
+   n = write(f->fd, f->data + f->len, 100);
+   f->len += n;
+   futimens(f->fd, times);
+   expect(n == 100 && loadChunk(cache, f, 0) == 0, "a file with a new size but the same mtime misses");
+
+   // a reader starting mid chunk, so its last chunk is a short one
+   expect(readRange(cache, f, CACHE_CKSUM, f->len - CHUNK - 700, -1) == 0, "a read to the EOF from mid chunk misses");
+   expect(readRange(cache, f, CACHE_CKSUM, f->len - CHUNK - 700, -1) == 2, "and hits, the short last chunk too");
+}
+
+/*****
+ * The chunks (file * CHUNKS + chunk) an LRU cache of SLOTS would hold are
+ * tracked by hand, most recently used first, starting from what lru()
+ * leaves; a load must hit exactly when the model holds it. Two files of
+ * CHUNKS over a few buckets chain their keys, so slots come out of the
+ * middle of chains as well as the ends.
+ ****/
+static int lruMatches(struct packetCache * cache)
+{
+   int model[SLOTS] = { CHUNKS + 1, CHUNKS + 2, CHUNKS + 0 };
+   int held = SLOTS;
+   int i, id, at, hit;
+   uint64_t evictions = cache->evictions;
+   int evicted = 0;
+
+   for (i = 0; i < LOADS; i++)
+   {
+      id = rand() % (2 * CHUNKS);
+      for (at = 0; at < held && model[at] != id; at++)
+         ;
+
+      hit = loadChunk(cache, &files[id / CHUNKS], id % CHUNKS);
+      if (hit != (at < held))
+         return 0;
+
+      if (at == held) {
+         if (held < SLOTS)
+            held++;
+         else
+            evicted++;
+         at = held - 1;
+      }
+      memmove(model + 1, model, at * sizeof(int));
+      model[0] = id;
+   }
+
+   return cache->evictions - evictions == evicted;
+}
+
+static void lru(struct packetCache * cache)
+{
+   struct testFile * f = &files[1];
+
+   expect(loadChunk(cache, f, 0) == 0 && loadChunk(cache, f, 1) == 0 && loadChunk(cache, f, 2) == 0,
+      "three chunks fill the three slots");
+   expect(loadChunk(cache, f, 0) == 1, "the oldest is used again");
+   expect(loadChunk(cache, f, 3) == 0 && loadChunk(cache, f, 0) == 1 && loadChunk(cache, f, 2) == 1,
+      "a fourth evicts the least recently used one, not the oldest loaded");
+   expect(loadChunk(cache, f, 1) == 0, "which misses");
+   expect(cache->used == SLOTS, "every slot is in use");
+   expect(lruMatches(cache), "random loads over two files hit and evict as an LRU of three slots does");
+}
+
+/*****
+ * A child that dies holding the lock, as a forked server child might.
+ * The next lock sees EOWNERDEAD and empties the cache rather than hanging
+ * on it or trusting lists that may be half changed.
+ ****/
+static void deadHolder(struct packetCache * cache)
+{
+   struct testFile * f = &files[1];
+   int status;
+   pid_t pid;
+
+   loadChunk(cache, f, 5);
+   expect(loadChunk(cache, f, 5) == 1, "a chunk is cached before the child dies");
+
+   fflush(stdout);
+   if ((pid = fork()) == 0) {
+      pthread_mutex_lock(&cache->lock);
+      _exit(0);
+   }
+   waitpid(pid, &status, 0);
+
+   alarm(10); // a lock that was not made robust hangs here
+   expect(loadChunk(cache, f, 5) == 0 && cache->used == 1, "after a holder dies the cache starts empty");
+   expect(loadChunk(cache, f, 5) == 1, "and works as before");
+}
+
+int main(void)
+{
+   size_t slot = CACHE_CHUNK + CACHE_PACKETS_MAX * sizeof(uint32_t) + sizeof(struct cacheEntry)
+      + 2 * sizeof(int32_t);
+   struct packetCache * cache;
+
+   srand(464);
+   alarm(10); // a hash chain left looping hangs findSlot()
+   makeFile(&files[0]);
+   makeFile(&files[1]);
+
+   expect(newPacketCache(slot / 2) == NULL, "a budget short of one slot makes no cache");
+   cache = newPacketCache(SLOTS * slot + 4096);
+   if (cache == NULL || cache->slots != SLOTS) {
+      expect(0, "a budget of three slots makes a cache of three");
+      return 1;
+   }
+
+   hits(cache);
+   lru(cache);
+   deadHolder(cache);
+
+   return failures > 0;
+}
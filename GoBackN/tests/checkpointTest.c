@@ -0,0 +1,104 @@
+// Checks that rcopy -c only trusts a checkpoint its output file backs up
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "checkpoint.h"
+
+#define REMOTE "remote.bin"
+#define OFFSET 2000000
+
+static int failures = 0;
+
+static void expect(int ok, char * what)
+{
+   printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+   if (!ok)
+      failures++;
+}
+
+// Leaves a checkpoint at OFFSET for REMOTE next to local, as a save would
+static void writeCheckpoint(char * local)
+{
+   struct checkpoint ckpt;
+   int fd;
+
+   initCheckpoint(&ckpt, local, REMOTE, 0, 1);
+   ckpt.size = 2 * OFFSET;
+   // only synced, so any file will do
+   if ((fd = open(ckpt.path, O_CREAT | O_WRONLY, 0600)) < 0
+      || saveCheckpoint(&ckpt, fd, OFFSET) < 0)
+   {
+      perror("writeCheckpoint");
+      exit(1);
+   }
+   close(fd);
+}
+
+// Makes local size bytes long, or removes it for size < 0
+static void makeOutput(char * local, off_t size)
+{
+   int fd;
+
+   unlink(local);
+   if (size < 0)
+      return;
+
+   if ((fd = open(local, O_CREAT | O_WRONLY, 0600)) < 0 || ftruncate(fd, size) < 0)
+   {
+      perror("makeOutput");
+      exit(1);
+   }
+   close(fd);
+}
+
+static int loads(char * local)
+{
+   struct checkpoint ckpt;
+   int found;
+
+   initCheckpoint(&ckpt, local, REMOTE, 0, 1);
+   found = loadCheckpoint(&ckpt) == 0;
+   // a checkpoint that is not used must not leave an offset behind
+   if (!found && (ckpt.offset != 0 || ckpt.size != -1))
+      return -1;
+   return found;
+}
+
+int main(void)
+{
+   char dir[] = "/tmp/ckptTestXXXXXX";
+   char local[64];
+   struct checkpoint ckpt;
+
+   if (mkdtemp(dir) == NULL)
+   {
+      perror("mkdtemp");
+      return 1;
+   }
+   snprintf(local, sizeof(local), "%s/out.bin", dir);
+
+   writeCheckpoint(local);
+
+   makeOutput(local, -1);
+   expect(loads(local) == 0, "checkpoint without its output file is ignored");
+
+   makeOutput(local, OFFSET - 1);
+   expect(loads(local) == 0, "checkpoint past the end of its output file is ignored");
+
+   makeOutput(local, OFFSET);
+   expect(loads(local) == 1, "checkpoint backed by its output file is used");
+
+   initCheckpoint(&ckpt, local, "other.bin", 0, 1);
+   expect(loadCheckpoint(&ckpt) < 0, "checkpoint for another remote file is ignored");
+
+   initCheckpoint(&ckpt, local, REMOTE, 0, 1);
+   removeCheckpoint(&ckpt);
+   makeOutput(local, -1);
+   rmdir(dir);
+
+   return failures > 0;
+}
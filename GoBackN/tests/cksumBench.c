@@ -0,0 +1,98 @@
+// Times in_cksum per call for each version, against the library's original
+// loop, on an ack, a full packet (also at an odd address) and a jumbo packet
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "libcpe464/networks/checksum.h"
+
+#define CALLS 200000
+
+static char * versions[] = { "original", "scalar16", "scalar64", "sse2", "avx2" };
+static int lengths[] = { 11, 1407, -1407, 9007 }; // negative: one byte past alignment
+
+// in_cksum as libcpe464 had it
+static unsigned short original(unsigned short * addr, int len)
+{
+   int sum = 0;
+   u_short answer = 0;
+   u_short * w = addr;
+   int nleft = len;
+
+   while (nleft > 1) {
+      sum += *w++;
+      nleft -= 2;
+   }
+   if (nleft == 1) {
+      *(u_char *)(&answer) = *(u_char *)w;
+      sum += answer;
+   }
+
+   sum = (sum >> 16) + (sum & 0xffff);
+   sum += (sum >> 16);
+   answer = ~sum;
+   return answer;
+}
+
+static double nowNsec(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Prints ns per call for one version, in a process of its own since the
+// version is picked on the first checksum
+static void timeVersion(char * version)
+{
+   static u_char buf[9007 + 64];
+   volatile unsigned short sink = 0;
+   unsigned short * addr;
+   double start;
+   int orig = strcmp(version, "original") == 0;
+   int i, n, len;
+
+   setenv("CPE464_CKSUM", version, 1);
+   for (i = 0; i < sizeof(buf); i++)
+      buf[i] = rand();
+
+   printf("%-9s", version);
+   for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+      len = abs(lengths[i]);
+      addr = (unsigned short *)(buf + (lengths[i] < 0));
+
+      start = nowNsec();
+      for (n = 0; n < CALLS; n++)
+         sink += orig ? original(addr, len) : in_cksum(addr, len);
+      printf(" %9.1f", (nowNsec() - start) / CALLS);
+   }
+   printf("\n");
+}
+
+int main(void)
+{
+   int i;
+   pid_t pid;
+
+   printf("ns per call\n%-9s", "");
+   for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+      printf(" %8d%s", abs(lengths[i]), lengths[i] < 0 ? "u" : " ");
+   printf("\n");
+
+   for (i = 0; i < sizeof(versions) / sizeof(versions[0]); i++) {
+      fflush(stdout);
+      if ((pid = fork()) == 0) {
+         timeVersion(versions[i]);
+         exit(0);
+      }
+      waitpid(pid, NULL, 0);
+   }
+
+   return 0;
+}
@@ -0,0 +1,115 @@
+// Checks every in_cksum version against the library's original loop, on
+// random buffers of odd and even lengths at unaligned addresses
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "libcpe464/networks/checksum.h"
+
+#define BUFFERS 20000
+#define MAX_LEN 9100 // a jumbo packet, and short of where the original's int sum overflows
+
+static char * versions[] = { "scalar16", "scalar64", "sse2", "avx2" };
+
+// in_cksum as libcpe464 had it
+static unsigned short original(unsigned short * addr, int len)
+{
+   int sum = 0;
+   u_short answer = 0;
+   u_short * w = addr;
+   int nleft = len;
+
+   while (nleft > 1) {
+      sum += *w++;
+      nleft -= 2;
+   }
+   if (nleft == 1) {
+      *(u_char *)(&answer) = *(u_char *)w;
+      sum += answer;
+   }
+
+   sum = (sum >> 16) + (sum & 0xffff);
+   sum += (sum >> 16);
+   answer = ~sum;
+   return answer;
+}
+
+// Fills len bytes with random data, or now and then all 0s or all 0xff
+static void fill(u_char * buf, int len)
+{
+   int kind = rand() % 8;
+   int i;
+
+   for (i = 0; i < len; i++)
+      buf[i] = kind == 0 ? 0 : kind == 1 ? 0xff : rand();
+}
+
+/*****
+ * Runs the checks with the version CPE464_CKSUM picks, which must be set
+ * before the first checksum. Whole buffers go through in_cksum, and the
+ * same buffers split in two at a random point through in_cksum_add and
+ * in_cksum_copy, as the gathered and copied packets are. Returns how many
+ * buffers gave a different sum.
+ ****/
+static int check(char * version)
+{
+   static u_char buf[MAX_LEN + 64];
+   static u_char copy[MAX_LEN + 64];
+   unsigned short want;
+   unsigned int sum;
+   int wrong = 0;
+   int n, len, offset, split;
+
+   setenv("CPE464_CKSUM", version, 1);
+   srand(464);
+
+   for (n = 0; n < BUFFERS; n++) {
+      len = rand() % (MAX_LEN + 1);
+      offset = rand() % 64;
+      fill(buf + offset, len);
+      want = original((unsigned short *)(buf + offset), len);
+
+      if (in_cksum((unsigned short *)(buf + offset), len) != want)
+         wrong++;
+
+      split = len > 0 ? rand() % len : 0;
+      sum = in_cksum_add(0, buf + offset, split, 0);
+      sum = in_cksum_add(sum, buf + offset + split, len - split, split);
+      if (in_cksum_fold(sum) != want)
+         wrong++;
+
+      sum = in_cksum_copy(0, copy + offset, buf + offset, split, 0);
+      sum = in_cksum_copy(sum, copy + offset + split, buf + offset + split, len - split, split);
+      if (in_cksum_fold(sum) != want || memcmp(copy + offset, buf + offset, len) != 0)
+         wrong++;
+   }
+
+   return wrong;
+}
+
+int main(void)
+{
+   int failures = 0;
+   int status;
+   int i;
+   pid_t pid;
+
+   // the version is picked once per process, so each gets its own
+   for (i = 0; i < sizeof(versions) / sizeof(versions[0]); i++) {
+      fflush(stdout);
+      if ((pid = fork()) == 0)
+         exit(check(versions[i]) > 0);
+
+      waitpid(pid, &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+         failures++;
+      printf("%s: %s matches the original on %d buffers\n",
+         WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "ok  " : "FAIL", versions[i], BUFFERS);
+   }
+
+   return failures > 0;
+}
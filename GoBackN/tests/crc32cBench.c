@@ -0,0 +1,75 @@
+// Times the two integrity checks a connection can negotiate, in_cksum and
+// CRC32C (SSE4.2 and table), on 1400 and 9000 byte payloads
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "crc32c.h"
+#include "libcpe464/networks/checksum.h"
+
+#define CALLS 200000
+
+static int lengths[] = { 1400, 9000 };
+
+static double nowNsec(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Prints ns per payload and GB/s, in a process of its own so CRC32C can
+// be forced to the table before the first CRC
+static void timeCheck(char * name, char * force)
+{
+   static u_char buf[9000];
+   volatile uint32_t sink = 0;
+   double start, ns;
+   int cksum = strcmp(name, "in_cksum") == 0;
+   int i, n;
+
+   if (force != NULL)
+      setenv("CRC32C", force, 1);
+   for (i = 0; i < sizeof(buf); i++)
+      buf[i] = rand();
+
+   printf("%-14s", name);
+   for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+      start = nowNsec();
+      for (n = 0; n < CALLS; n++)
+         sink += cksum ? in_cksum((unsigned short *)buf, lengths[i]) : crc32c(0, buf, lengths[i]);
+      ns = (nowNsec() - start) / CALLS;
+      printf(" %8.1f (%4.1f GB/s)", ns, lengths[i] / ns);
+   }
+   printf("\n");
+}
+
+int main(void)
+{
+   char * names[] = { "in_cksum", "crc32c", "crc32c table" };
+   char * forces[] = { NULL, NULL, "table" };
+   int i;
+   pid_t pid;
+
+   printf("ns per payload\n%-14s", "");
+   for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+      printf(" %8d B           ", lengths[i]);
+   printf("\n");
+
+   for (i = 0; i < 3; i++) {
+      fflush(stdout);
+      if ((pid = fork()) == 0) {
+         timeCheck(names[i], forces[i]);
+         exit(0);
+      }
+      waitpid(pid, NULL, 0);
+   }
+
+   return 0;
+}
@@ -0,0 +1,115 @@
+// Checks crc32c.c, with the SSE4.2 instruction and with the table, against
+// a bit at a time CRC32C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "crc32c.h"
+
+#define BUFFERS 5000
+#define MAX_LEN 9100
+
+static int failures = 0;
+
+static void expect(int ok, char * what)
+{
+   printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+   if (!ok)
+      failures++;
+}
+
+// CRC32C one bit at a time, reflected, polynomial 0x82f63b78
+static uint32_t reference(const u_char * buf, int len)
+{
+   uint32_t crc = 0xffffffff;
+   int i, bit;
+
+   for (i = 0; i < len; i++) {
+      crc ^= buf[i];
+      for (bit = 0; bit < 8; bit++)
+         crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+   }
+
+   return ~crc;
+}
+
+/*****
+ * Random buffers at unaligned addresses, each checked whole, chained in
+ * two pieces, copied with crc32cCopy() and joined with crc32cCombine().
+ * Returns how many gave a wrong CRC.
+ ****/
+static int randomBuffers(void)
+{
+   static u_char buf[MAX_LEN + 64];
+   static u_char copy[MAX_LEN + 64];
+   u_char * p;
+   uint32_t want;
+   uint32_t crc;
+   int wrong = 0;
+   int n, i, len, split;
+
+   srand(464);
+   for (n = 0; n < BUFFERS; n++) {
+      len = rand() % (MAX_LEN + 1);
+      p = buf + rand() % 64;
+      for (i = 0; i < len; i++)
+         p[i] = rand();
+      want = reference(p, len);
+      split = len > 0 ? rand() % len : 0;
+
+      if (crc32c(0, p, len) != want)
+         wrong++;
+      if (crc32c(crc32c(0, p, split), p + split, len - split) != want)
+         wrong++;
+
+      crc = crc32cCopy(0, copy + (p - buf), p, split);
+      crc = crc32cCopy(crc, copy + (p - buf) + split, p + split, len - split);
+      if (crc != want || memcmp(copy + (p - buf), p, len) != 0)
+         wrong++;
+
+      crc = crc32cCombine(crc32c(0, p, split), crc32c(0, p + split, len - split),
+         crc32cShift(len - split));
+      if (crc != want)
+         wrong++;
+   }
+
+   return wrong;
+}
+
+// The checks for the version CRC32C picks, in a process of its own since
+// the version is picked on the first CRC
+static int check(char * force)
+{
+   if (force != NULL)
+      setenv("CRC32C", force, 1);
+   else
+      unsetenv("CRC32C");
+
+   return crc32c(0, "123456789", 9) != 0xe3069283 || randomBuffers() > 0;
+}
+
+int main(void)
+{
+   int status;
+   pid_t pid;
+
+   expect(reference((u_char *)"123456789", 9) == 0xe3069283, "the reference gives the check value");
+
+   fflush(stdout);
+   if ((pid = fork()) == 0)
+      exit(check(NULL));
+   waitpid(pid, &status, 0);
+   expect(WIFEXITED(status) && WEXITSTATUS(status) == 0, "crc32c as picked for this CPU matches the reference");
+
+   fflush(stdout);
+   if ((pid = fork()) == 0)
+      exit(check("table"));
+   waitpid(pid, &status, 0);
+   expect(WIFEXITED(status) && WEXITSTATUS(status) == 0, "crc32c with CRC32C=table matches the reference");
+
+   return failures > 0;
+}
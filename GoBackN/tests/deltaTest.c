@@ -0,0 +1,277 @@
+// Checks delta.c end to end: an old copy's signature, the ops the server
+// makes from the new file against it, and the file rcopy rebuilds from them
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "delta.h"
+#include "writer.h"
+
+#define PAYLOAD 1400
+#define OLD_LEN (1024 * 1024)  // 1024 blocks of 1024 bytes
+#define BIG_LEN (6 * 1024 * 1024) // past DELTA_FLUSH, blocks of 4096
+#define ODD_READ 777           // reads shorter than a block, so windows straddle them
+
+static int failures = 0;
+
+static void expect(int ok, char * what)
+{
+   printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+   if (!ok)
+      failures++;
+}
+
+// What the sender made of the last transfer()
+static uint64_t copied, literal, copies, literals;
+
+static void fillRandom(u_char * buf, int len)
+{
+   int i;
+
+   for (i = 0; i < len; i++)
+      buf[i] = rand();
+}
+
+// A file holding len bytes of data, open for reading
+static FILE * fileOf(u_char * data, int len)
+{
+   FILE * file = tmpfile();
+
+   if (file == NULL || fwrite(data, 1, len, file) != len || fflush(file) != 0) {
+      perror("deltaTest: tmpfile");
+      exit(1);
+   }
+   return file;
+}
+
+/*****
+ * Cuts the ops into pieces of feedLen bytes, as packets do, and takes them
+ * into a fresh file. Returns 1 if every piece was taken, no op was left
+ * part way and the file came out as want.
+ ****/
+static int rebuild(int basis, struct signature * sig, u_char * ops, int opsLen,
+   int feedLen, u_char * want, int wantLen)
+{
+   static u_char back[BIG_LEN + 1];
+   struct deltaReceiver delta;
+   struct writer out;
+   FILE * file = tmpfile();
+   int chunk;
+   int ok = 1;
+
+   initDeltaReceiver(&delta, basis, sig->blockSize, sig->blocks);
+   initWriter(&out, fileno(file), 0, WRITE_BUF);
+
+   for (; opsLen > 0 && ok; ops += chunk, opsLen -= chunk) {
+      chunk = opsLen < feedLen ? opsLen : feedLen;
+      ok = takeDelta(&delta, ops, chunk, &out) == 0;
+   }
+
+   ok = ok && flushWriter(&out) == 0 && deltaDone(&delta)
+      && pread(fileno(file), back, sizeof(back), 0) == wantLen
+      && memcmp(back, want, wantLen) == 0;
+
+   freeWriter(&out);
+   fclose(file);
+   return ok;
+}
+
+/*****
+ * The whole exchange: the old copy's signature goes over a page at a
+ * time, last page first, then the new file is scanned readLen bytes at a
+ * time and the ops, cut into PAYLOAD byte packets as nextDelta() does,
+ * rebuild it from the old copy. Returns 1 if it came out right.
+ ****/
+static int transfer(u_char * old, int oldLen, u_char * new, int newLen, int readLen, int feedLen)
+{
+   static u_char ops[2 * BIG_LEN];
+   u_char page[PAYLOAD];
+   struct signature sig;
+   struct deltaSender delta;
+   FILE * basis = fileOf(old, oldLen);
+   int offset = 0;
+   int opsLen = 0;
+   int len, want, i;
+   int ok = 1;
+
+   if (buildSignature(&sig, fileno(basis)) < 0
+      || initDeltaSender(&delta, sig.blockSize, sig.blocks, PAYLOAD) < 0)
+   {
+      fclose(basis);
+      return 0;
+   }
+
+   for (i = signaturePages(&sig, delta.perPage) - 1; i >= 0; i--) {
+      len = signaturePage(&sig, i, delta.perPage, page);
+      ok = ok && takePage(&delta, i, page, len) == 0;
+   }
+   ok = ok && delta.have == delta.pages && delta.missing == delta.pages;
+
+   while (ok && (len = makeDelta(&delta, PAYLOAD)) != 0)
+   {
+      if (len == DELTA_MORE) {
+         u_char * space = deltaSpace(&delta, &want);
+
+         len = newLen - offset;
+         if (len > want)
+            len = want;
+         if (len > readLen)
+            len = readLen;
+         memcpy(space, new + offset, len);
+         offset += len;
+         deltaRead(&delta, len);
+         continue;
+      }
+
+      // a packet's worth at a time, the rest stays for the next one
+      len = delta.outLen - delta.outPos;
+      if (len > PAYLOAD)
+         len = PAYLOAD;
+      memcpy(ops + opsLen, delta.out + delta.outPos, len);
+      opsLen += len;
+      delta.outPos += len;
+   }
+
+   copied = delta.copied;
+   literal = delta.literal;
+   copies = delta.copies;
+   literals = delta.literals;
+
+   ok = ok && copied + literal == newLen
+      && rebuild(fileno(basis), &sig, ops, opsLen, feedLen, new, newLen);
+
+   freeDeltaSender(&delta);
+   freeSignature(&sig);
+   fclose(basis);
+   return ok;
+}
+
+// Both ways through the scan: reads as big as deltaSpace() allows, and
+// short ones fed in odd pieces so windows and op headers straddle them
+static int bothWays(u_char * old, int oldLen, u_char * new, int newLen)
+{
+   return transfer(old, oldLen, new, newLen, BIG_LEN, PAYLOAD)
+      && transfer(old, oldLen, new, newLen, ODD_READ, 7);
+}
+
+static void changes(void)
+{
+   static u_char old[OLD_LEN + 4096];
+   static u_char new[OLD_LEN + 4 * DELTA_LITERAL_MAX];
+   int blocks = OLD_LEN / 1024;
+
+   fillRandom(old, sizeof(old));
+
+   expect(bothWays(old, OLD_LEN, old, OLD_LEN) && literal == 0, "an identical file is all COPYs");
+   expect(copies == 1, "consecutive blocks coalesce into one COPY");
+
+   memcpy(new, old, OLD_LEN);
+   new[300 * 1024 + 10] ^= 0xff;
+   new[700 * 1024 + 1023] ^= 0xff;
+   expect(bothWays(old, OLD_LEN, new, OLD_LEN) && literal == 2 * 1024 && copies == 3,
+      "an edited file sends only the two blocks that changed");
+
+   memcpy(new, old, 5000);
+   fillRandom(new + 5000, 100);
+   memcpy(new + 5100, old + 5000, OLD_LEN - 5000);
+   expect(bothWays(old, OLD_LEN, new, OLD_LEN + 100) && literal == 1024 + 100 && copied == (blocks - 1) * 1024,
+      "an insert that shifts the blocks out of line is found again");
+   expect(copies == 2, "and the blocks after it coalesce again");
+
+   expect(bothWays(old, OLD_LEN, old, OLD_LEN - 500) && literal == 1024 - 500,
+      "a truncated file sends its last part block as a literal");
+
+   memcpy(new, old, OLD_LEN);
+   fillRandom(new + OLD_LEN, 3000);
+   expect(bothWays(old, OLD_LEN, new, OLD_LEN + 3000) && literal == 3000 && copies == 1,
+      "an appended file sends only what was added");
+
+   expect(bothWays(old, OLD_LEN + 1000, old, OLD_LEN + 1000) && literal == 1000,
+      "an old copy's sub-block tail is not in the signature, so it goes as a literal");
+
+   memcpy(new, old, OLD_LEN);
+   new[OLD_LEN - 1] ^= 0xff;
+   expect(bothWays(old, OLD_LEN, new, OLD_LEN) && literal == 1024 && copies == 1,
+      "a changed last block, its window ending at the EOF, goes as a literal");
+
+   fillRandom(new, 3 * DELTA_LITERAL_MAX + 100);
+   expect(bothWays(old, OLD_LEN, new, 3 * DELTA_LITERAL_MAX + 100) && copied == 0 && literals == 4,
+      "new data is cut into literals of at most DELTA_LITERAL_MAX");
+}
+
+static void flushes(void)
+{
+   static u_char big[BIG_LEN];
+
+   fillRandom(big, BIG_LEN);
+   expect(transfer(big, BIG_LEN, big, BIG_LEN, BIG_LEN, PAYLOAD) && literal == 0 && copies == 2,
+      "a COPY run is cut where DELTA_FLUSH sends the ops so far");
+}
+
+// Feeds one hand made op to a receiver whose signature had blocks 1024
+// byte blocks, over an old copy with more than that, so only the
+// receiver's own bounds can turn a COPY down
+static int takeOp(int type, uint32_t first, uint32_t second, int blocks)
+{
+   static u_char zeros[8 * 1024];
+   struct deltaReceiver delta;
+   struct writer out;
+   FILE * basis = fileOf(zeros, sizeof(zeros));
+   FILE * file = tmpfile();
+   u_char op[DELTA_OP_LEN];
+   int result;
+
+   op[0] = type;
+   first = htonl(first);
+   second = htonl(second);
+   memcpy(op + 1, &first, 4);
+   memcpy(op + 5, &second, 4);
+
+   initDeltaReceiver(&delta, fileno(basis), 1024, blocks);
+   initWriter(&out, fileno(file), 0, WRITE_BUF);
+   result = takeDelta(&delta, op, type == DELTA_COPY ? DELTA_OP_LEN : 5, &out);
+   freeWriter(&out);
+   fclose(file);
+   fclose(basis);
+
+   return result;
+}
+
+static void badOps(void)
+{
+   struct deltaSender delta;
+   u_char page[PAYLOAD];
+
+   expect(takeOp(DELTA_COPY, 0, 4, 4) == 0, "a COPY of every block is taken");
+   expect(takeOp(DELTA_COPY, 4, 1, 4) == -1, "a COPY starting past the blocks is turned down");
+   expect(takeOp(DELTA_COPY, 2, 3, 4) == -1, "a COPY running past the blocks is turned down");
+   expect(takeOp(DELTA_COPY, 1, 0, 4) == -1, "a COPY of no blocks is turned down");
+   expect(takeOp(DELTA_LITERAL, 0, 0, 4) == -1, "a LITERAL of 0 bytes is turned down");
+   expect(takeOp(DELTA_LITERAL, DELTA_LITERAL_MAX + 1, 0, 4) == -1, "a LITERAL past DELTA_LITERAL_MAX is turned down");
+   expect(takeOp(3, 0, 0, 4) == -1, "an op of no known type is turned down");
+
+   expect(initDeltaSender(&delta, 3000, 10, PAYLOAD) == -1, "a block size that is not a power of two is turned down");
+   expect(initDeltaSender(&delta, 1024, 0, PAYLOAD) == -1, "a signature of no blocks is turned down");
+
+   memset(page, 0, sizeof(page));
+   initDeltaSender(&delta, 1024, 200, PAYLOAD);
+   expect(takePage(&delta, 0, page, 10) == -1, "a page of the wrong length is turned down");
+   expect(takePage(&delta, 2, page, DELTA_SUM_LEN) == -1, "a page past the signature is turned down");
+   expect(takePage(&delta, 1, page, (200 - delta.perPage) * DELTA_SUM_LEN) == 0
+      && takePage(&delta, 1, page, (200 - delta.perPage) * DELTA_SUM_LEN) == 0
+      && delta.have == 1 && delta.missing == 0, "a page that comes twice counts once");
+   freeDeltaSender(&delta);
+}
+
+int main(void)
+{
+   srand(464);
+   changes();
+   flushes();
+   badOps();
+
+   return failures > 0;
+}
@@ -0,0 +1,193 @@
+// Packets a second the server's send paths get out: one safeSend() per
+// datagram, sendmmsg() batches, and sendmmsg() batches with UDP GSO
+//
+// gsoBench                   sender and receiver over loopback
+// gsoBench recv PORT         only the receiver, e.g. in the far netns of a veth pair
+// gsoBench send HOST PORT    only the sender, to a receiver started as above
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include "networks.h"
+
+#define PACKETS 500000
+#define PACKET 1411 // a 1400 byte payload with the CRC32C header
+#define IDLE_MS 500 // the receiver stops once nothing has come for this long
+
+enum { PLAIN, BATCHED, GSO };
+static char * paths[] = { "safeSend", "sendmmsg", "sendmmsg+GSO" };
+
+static double nowSec(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Counts the datagrams that arrive until the sender has been quiet for
+// IDLE_MS, waiting up to firstMs (-1: for good) for the first of them
+static long drain(int sk, int firstMs)
+{
+   static u_char bufs[BATCH_MAX][PACKET];
+   struct mmsghdr msgs[BATCH_MAX];
+   struct iovec iov[BATCH_MAX];
+   struct pollfd pfd = { sk, POLLIN, 0 };
+   long count = 0;
+   int i, n;
+
+   memset(msgs, 0, sizeof(msgs));
+   for (i = 0; i < BATCH_MAX; i++) {
+      iov[i].iov_base = bufs[i];
+      iov[i].iov_len = PACKET;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+   }
+
+   while (poll(&pfd, 1, count == 0 ? firstMs : IDLE_MS) > 0)
+      if ((n = recvmmsg(sk, msgs, BATCH_MAX, MSG_DONTWAIT, NULL)) > 0)
+         count += n;
+
+   return count;
+}
+
+// A socket bound to port (0: any) with as big a receive buffer as it gets
+static int receiver(int port)
+{
+   struct sockaddr_in local;
+   int size = 64 << 20;
+   int sk;
+
+   memset(&local, 0, sizeof(local));
+   local.sin_family = AF_INET;
+   local.sin_addr.s_addr = INADDR_ANY;
+   local.sin_port = htons(port);
+
+   if ((sk = socket(AF_INET, SOCK_DGRAM, 0)) < 0
+      || (bind)(sk, (struct sockaddr *)&local, sizeof(local)) < 0)
+   {
+      perror("gsoBench, receiver");
+      exit(1);
+   }
+
+   setsockopt(sk, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+   return sk;
+}
+
+// Sends PACKETS datagrams down one path and returns how long it took
+static double sendAll(Connection * connection, int path)
+{
+   static struct sendBatch batch;
+   u_char packet[PACKET];
+   double start;
+   int i;
+
+   memset(packet, 0xa5, PACKET);
+   initSendBatch(&batch, connection, BATCH_MAX, 0);
+   if (path == GSO && !enableGso(&batch))
+      return -1;
+
+   start = nowSec();
+   for (i = 0; i < PACKETS; i++) {
+      if (path == PLAIN)
+         safeSend(packet, PACKET, connection);
+      else
+         queueSend(&batch, packet, PACKET);
+   }
+   flushSend(&batch);
+
+   return nowSec() - start;
+}
+
+static void report(int path, double secs, long received)
+{
+   if (secs < 0)
+      printf("%-14s no UDP_SEGMENT in this kernel\n", paths[path]);
+   else if (received < 0)
+      printf("%-14s %8.0f kpps\n", paths[path], PACKETS / secs / 1000);
+   else
+      printf("%-14s %8.0f kpps, %ld of %d arrived\n", paths[path], PACKETS / secs / 1000, received, PACKETS);
+}
+
+static int connectTo(char * host, int port, Connection * connection)
+{
+   if (udp_client_setup(host, port, connection) < 0
+      || connect(connection->sk_num, (struct sockaddr *)&connection->remote, connection->len) < 0)
+   {
+      perror("gsoBench, connect");
+      return -1;
+   }
+   return 0;
+}
+
+int main(int argc, char * argv[])
+{
+   Connection connection;
+   struct sockaddr_in local;
+   socklen_t len = sizeof(local);
+   long received;
+   double secs;
+   int fds[2];
+   int path, sk;
+   pid_t pid;
+
+   if (argc == 3 && strcmp(argv[1], "recv") == 0) {
+      sk = receiver(atoi(argv[2]));
+      for (path = PLAIN; path <= GSO; path++)
+         printf("%-14s %ld arrived\n", paths[path], drain(sk, -1));
+      return 0;
+   }
+
+   if (argc == 4 && strcmp(argv[1], "send") == 0) {
+      if (connectTo(argv[2], atoi(argv[3]), &connection) < 0)
+         return 1;
+      for (path = PLAIN; path <= GSO; path++) {
+         report(path, sendAll(&connection, path), -1);
+         sleep(2 * IDLE_MS / 1000 + 1); // let the receiver see the end of this path
+      }
+      return 0;
+   }
+
+   if (argc != 1) {
+      printf("usage: %s [recv port | send host port]\n", argv[0]);
+      return 2;
+   }
+
+   for (path = PLAIN; path <= GSO; path++) {
+      sk = receiver(0);
+      getsockname(sk, (struct sockaddr *)&local, &len);
+      fflush(stdout);
+      if (pipe(fds) < 0 || (pid = fork()) < 0) {
+         perror("gsoBench");
+         return 1;
+      }
+
+      if (pid == 0) {
+         received = drain(sk, 10 * IDLE_MS);
+         write(fds[1], &received, sizeof(received));
+         exit(0);
+      }
+
+      close(sk);
+      if (connectTo("localhost", ntohs(local.sin_port), &connection) < 0)
+         return 1;
+      secs = sendAll(&connection, path);
+      close(connection.sk_num);
+
+      if (read(fds[0], &received, sizeof(received)) != sizeof(received))
+         received = -1;
+      waitpid(pid, NULL, 0);
+      close(fds[0]);
+      close(fds[1]);
+      report(path, secs, received);
+   }
+
+   return 0;
+}
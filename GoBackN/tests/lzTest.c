@@ -0,0 +1,267 @@
+// Checks lz.c's block codec and compress.c's framing: round trips, the
+// stored and untried blocks, and that malformed blocks and frames fail
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "lz.h"
+#include "compress.h"
+#include "writer.h"
+
+#define GUARD 64 // bytes past cap that must come out untouched
+#define PACKET 1400
+#define BLOCKS 23  // blocks in the framed file, the last of them short
+
+static int failures = 0;
+
+static void expect(int ok, char * what)
+{
+   printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+   if (!ok)
+      failures++;
+}
+
+// Words picked at random, so the text repeats like a log file does
+static void fillText(u_char * buf, int len)
+{
+   static char * words[] = { "the ", "packet ", "window ", "server ", "ack ",
+      "sent ", "of ", "seq ", "timeout\n", "rcopy ", "and ", "1400 " };
+   int i = 0;
+   char * w;
+
+   while (i < len)
+      for (w = words[rand() % 12]; *w != '\0' && i < len; w++)
+         buf[i++] = *w;
+}
+
+static void fillRandom(u_char * buf, int len)
+{
+   int i;
+
+   for (i = 0; i < len; i++)
+      buf[i] = rand();
+}
+
+/*****
+ * Compresses len bytes and decompresses them again into exactly len bytes
+ * of room. Returns 1 if the two match and nothing past the room was
+ * written.
+ ****/
+static int roundTrip(u_char * src, int len)
+{
+   static u_char packed[COMPRESS_BLOCK + COMPRESS_BLOCK / 255 + 16];
+   static u_char out[COMPRESS_BLOCK + GUARD];
+   int n, i;
+
+   if ((n = lzCompress(src, len, packed, sizeof(packed))) <= 0)
+      return 0;
+
+   memset(out, 0xcc, len + GUARD);
+   if (lzDecompress(packed, n, out, len) != len || memcmp(out, src, len) != 0)
+      return 0;
+   for (i = len; i < len + GUARD; i++)
+      if (out[i] != 0xcc)
+         return 0;
+
+   return 1;
+}
+
+// Decompresses a hand made block into cap bytes of room and returns 1 if
+// it was turned down without writing past cap
+static int rejected(u_char * block, int len, int cap)
+{
+   u_char out[64 + GUARD];
+   int i;
+
+   memset(out, 0xcc, sizeof(out));
+   if (lzDecompress(block, len, out, cap) != -1)
+      return 0;
+   for (i = cap; i < sizeof(out); i++)
+      if (out[i] != 0xcc)
+         return 0;
+
+   return 1;
+}
+
+static void codec(void)
+{
+   static u_char buf[COMPRESS_BLOCK];
+   static u_char packed[COMPRESS_BLOCK];
+   u_char lit[] = { 0x50, 'a', 'b', 'c', 'd', 'e' };
+   u_char offsetZero[] = { 0x10, 'a', 0, 0, 0x10, 'b' };
+   u_char offsetPast[] = { 0x10, 'a', 2, 0, 0x10, 'b' };
+   u_char longMatch[] = { 0x1f, 'a', 1, 0, 40, 0x10, 'b' };
+   u_char lengthRun[] = { 0xf0, 255, 255 };
+   u_char matchRun[] = { 0x1f, 'a', 1, 0, 255 };
+   u_char shortOffset[] = { 0x10, 'a', 1 };
+   int i, ok;
+
+   fillRandom(buf, 5000);
+   expect(roundTrip(buf, 5000), "random data round trips");
+   fillText(buf, 5000);
+   expect(roundTrip(buf, 5000), "text round trips");
+   memset(buf, 0, 5000);
+   expect(roundTrip(buf, 5000), "all zeros round trip");
+   expect(lzCompress(buf, 5000, packed, sizeof(packed)) < 100, "all zeros shrink to a few overlapping matches");
+
+   for (ok = 1, i = 0; i <= LZ_MATCH_LIMIT + 1; i++) {
+      fillText(buf, i);
+      ok &= roundTrip(buf, i);
+   }
+   expect(ok, "blocks of 0 to LZ_MATCH_LIMIT + 1 bytes round trip");
+
+   fillText(buf, COMPRESS_BLOCK);
+   expect(roundTrip(buf, COMPRESS_BLOCK), "a full COMPRESS_BLOCK of text round trips");
+   fillRandom(buf, COMPRESS_BLOCK);
+   expect(roundTrip(buf, COMPRESS_BLOCK), "a full COMPRESS_BLOCK of random data round trips");
+   expect(lzCompress(buf, COMPRESS_BLOCK, packed, COMPRESS_BLOCK - COMPRESS_BLOCK / COMPRESS_SAVING) == 0,
+      "random data does not fit a cap below its length");
+
+   expect(lzDecompress(lit, sizeof(lit), buf, 5) == 5 && memcmp(buf, "abcde", 5) == 0,
+      "a block of only literals decompresses");
+   expect(rejected(offsetZero, sizeof(offsetZero), 64), "an offset of 0 is turned down");
+   expect(rejected(offsetPast, sizeof(offsetPast), 64), "an offset before the start of the output is turned down");
+   expect(rejected(lit, sizeof(lit), 4), "a literal longer than cap is turned down");
+   expect(rejected(longMatch, sizeof(longMatch), 32), "a match longer than cap is turned down");
+   expect(rejected(lengthRun, sizeof(lengthRun), 64), "a literal length that runs past the end is turned down");
+   expect(rejected(matchRun, sizeof(matchRun), 64), "a match length that runs past the end is turned down");
+   expect(rejected(shortOffset, sizeof(shortOffset), 64), "an offset cut short by the end is turned down");
+}
+
+/*****
+ * Feeds frames to takeFrames() in packet sized pieces, as rcopy does, and
+ * returns what it did.
+ ****/
+static int feed(struct decompressor * unzip, u_char * data, int len, struct writer * out)
+{
+   int chunk;
+
+   for (; len > 0; data += chunk, len -= chunk) {
+      chunk = len < PACKET ? len : PACKET;
+      if (takeFrames(unzip, data, chunk, out) < 0)
+         return -1;
+   }
+
+   return 0;
+}
+
+// Compresses one block of len bytes from src and returns its frame's length
+static int nextFrame(struct compressor * zip, u_char * src, int len, u_char * stream)
+{
+   memcpy(blockBuffer(zip), src, len);
+   compressBlock(zip, len);
+   memcpy(stream, zip->frame, zip->len);
+   return zip->len;
+}
+
+/*****
+ * Blocks of text and of random data, and a short last block, framed by
+ * compressBlock() and taken back by takeFrames() into a file. Random
+ * blocks are stored, and after each miss more blocks are stored untried:
+ * one, then two, four and so on, running on into the text after them.
+ ****/
+static void framing(void)
+{
+   static u_char file[BLOCKS * COMPRESS_BLOCK];
+   static u_char stream[BLOCKS * (FRAME_HDR + COMPRESS_BLOCK)];
+   static u_char back[BLOCKS * COMPRESS_BLOCK];
+   struct compressor zip;
+   struct decompressor unzip;
+   struct writer out;
+   FILE * tmp = tmpfile();
+   int len = 0, size = 0;
+   int fileLen = (BLOCKS - 1) * COMPRESS_BLOCK + 1234;
+   int i;
+
+   fillText(file, 2 * COMPRESS_BLOCK);
+   fillRandom(file + 2 * COMPRESS_BLOCK, 16 * COMPRESS_BLOCK);
+   fillText(file + 18 * COMPRESS_BLOCK, fileLen - 18 * COMPRESS_BLOCK);
+
+   initCompressor(&zip);
+   for (i = 0; i < 2; i++, len += COMPRESS_BLOCK)
+      size += nextFrame(&zip, file + len, COMPRESS_BLOCK, stream + size);
+   expect(zip.stored == 0, "text blocks are compressed");
+
+   // miss, 1 untried, miss, 2 untried, miss, 4 untried, miss, 5 of 8 untried
+   for (i = 0; i < 16; i++, len += COMPRESS_BLOCK)
+      size += nextFrame(&zip, file + len, COMPRESS_BLOCK, stream + size);
+   expect(zip.stored == 16 && zip.untried == 12, "misses store the blocks after them untried, doubling each time");
+   expect(zip.skip == 3 && zip.backoff == 16, "the untried run goes on past the random data");
+
+   for (i = 0; i < 3; i++, len += COMPRESS_BLOCK)
+      size += nextFrame(&zip, file + len, COMPRESS_BLOCK, stream + size);
+   expect(zip.skip == 0 && zip.stored == 19 && zip.untried == 15, "text in the untried run is stored too");
+
+   size += nextFrame(&zip, file + len, COMPRESS_BLOCK, stream + size);
+   len += COMPRESS_BLOCK;
+   expect(zip.stored == 19 && zip.backoff == 1, "a block that compresses starts the count again");
+   size += nextFrame(&zip, file + len, fileLen - len, stream + size);
+   expect(zip.stored == 19 && zip.blocks == BLOCKS, "a short last block is compressed");
+
+   initDecompressor(&unzip);
+   initWriter(&out, fileno(tmp), 0, WRITE_BUF);
+   expect(feed(&unzip, stream, size, &out) == 0 && flushWriter(&out) == 0, "takeFrames takes every frame");
+   expect(framesDone(&unzip), "no frame is left part way at the end");
+   expect(pread(fileno(tmp), back, sizeof(back), 0) == fileLen && memcmp(back, file, fileLen) == 0,
+      "the file comes back as it was");
+   expect(unzip.blocks == BLOCKS && unzip.stored == 19 && unzip.frameBytes == zip.frameBytes,
+      "both sides count the same blocks and bytes");
+   expect(feed(&unzip, stream, FRAME_HDR + 1, &out) == 0 && !framesDone(&unzip),
+      "a frame cut short is still part way");
+
+   freeWriter(&out);
+   freeDecompressor(&unzip);
+   freeCompressor(&zip);
+   fclose(tmp);
+}
+
+// Feeds one frame with the given header and body to a fresh decompressor
+static int takeOne(uint32_t rawLen, uint32_t bodyLen, u_char * body, int len)
+{
+   static u_char frame[FRAME_HDR + COMPRESS_BLOCK];
+   struct decompressor unzip;
+   struct writer out;
+   FILE * tmp = tmpfile();
+   int result;
+
+   rawLen = htonl(rawLen);
+   bodyLen = htonl(bodyLen);
+   memcpy(frame, &rawLen, 4);
+   memcpy(frame + 4, &bodyLen, 4);
+   memcpy(frame + FRAME_HDR, body, len);
+
+   initDecompressor(&unzip);
+   initWriter(&out, fileno(tmp), 0, WRITE_BUF);
+   result = feed(&unzip, frame, FRAME_HDR + len, &out);
+   freeWriter(&out);
+   freeDecompressor(&unzip);
+   fclose(tmp);
+
+   return result;
+}
+
+static void badFrames(void)
+{
+   u_char body[] = { 0x50, 'a', 'b', 'c', 'd', 'e' };
+
+   expect(takeOne(5, sizeof(body), body, sizeof(body)) == -1, "a body as long as its block is turned down");
+   expect(takeOne(6, sizeof(body), body, sizeof(body)) == -1, "a body that decompresses short is turned down");
+   expect(takeOne(0, FRAME_STORED, body, 0) == -1, "an empty block is turned down");
+   expect(takeOne(COMPRESS_BLOCK + 1, 10, body, sizeof(body)) == -1, "a block past COMPRESS_BLOCK is turned down");
+   expect(takeOne(6, 0, body, 0) == -1, "an empty compressed body is turned down");
+   expect(takeOne(6, 5 | FRAME_STORED, body, 5) == -1, "a stored body of the wrong length is turned down");
+   expect(takeOne(6, 6 | FRAME_STORED, body, 6) == 0, "a stored body of the right length is taken");
+}
+
+int main(void)
+{
+   srand(464);
+   codec();
+   framing();
+   badFrames();
+
+   return failures > 0;
+}
@@ -0,0 +1,136 @@
+// Checks the SACK bitmaps: rcopy's kept one against the packets it holds,
+// and the server's scoreboard only passing on what is new in each RR
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reorder.h"
+#include "sack.h"
+
+#define WINDOW 16384
+#define PACKET 64
+
+static int failures = 0;
+
+static void expect(int ok, char * what)
+{
+   printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+   if (!ok)
+      failures++;
+}
+
+static int isSet(u_char * map, int bit)
+{
+   return (map[bit / 8] & (0x80 >> (bit % 8))) != 0;
+}
+
+// The map sackMap() should give, worked out from scratch
+static int expectedMap(struct reorder * reorder, int32_t expected, int32_t highest, u_char * map)
+{
+   int bits = highest - expected;
+   int i;
+
+   if (reorder->count == 0 || bits <= 0)
+      return 0;
+   if (bits > SACK_MAX * 8)
+      bits = SACK_MAX * 8;
+
+   memset(map, 0, SACK_MAX);
+   for (i = 0; i < bits; i++)
+      if (inReorder(reorder, expected + 1 + i))
+         map[i / 8] |= 0x80 >> (i % 8);
+
+   return (bits + 7) / 8;
+}
+
+/*****
+ * Runs packets into a reorder buffer the way rcopy does, most of them in
+ * order and some lost until later, and compares every map sackMap() gives
+ * with one built from scratch.
+ ****/
+static int reorderMatches(int32_t last, int lossPercent)
+{
+   struct reorder reorder;
+   u_char packet[PACKET] = {0};
+   u_char map[SACK_MAX];
+   u_char want[SACK_MAX];
+   int32_t expected = 1;
+   int32_t highest = 0;
+   int32_t next = 1;
+   int32_t seq;
+   int len;
+   int ok = 1;
+
+   initReorder(&reorder, WINDOW, PACKET);
+
+   while (expected <= last && ok) {
+      // a resend of the missing packet, or the next new one
+      if (next > expected + WINDOW - 1 || next > last || rand() % 100 < 2 * lossPercent)
+         seq = expected;
+      else
+         seq = next++;
+
+      if (rand() % 100 < lossPercent)
+         continue;
+
+      if (seq == expected) {
+         expected++;
+         while (reorder.count > 0 && takeFromReorder(&reorder, expected) != NULL)
+            expected++;
+      } else if (seq > expected) {
+         saveToReorder(&reorder, seq, packet, PACKET);
+      }
+      if (seq > highest)
+         highest = seq;
+
+      len = sackMap(&reorder, expected, highest, map);
+      ok = len == expectedMap(&reorder, expected, highest, want)
+         && memcmp(map, want, len) == 0;
+   }
+
+   freeReorder(&reorder);
+   return ok;
+}
+
+int main(void)
+{
+   struct scoreboard board;
+   u_char map[SACK_MAX];
+   int len;
+
+   srand(464);
+   expect(reorderMatches(200000, 0), "rcopy's SACK map in order");
+   expect(reorderMatches(200000, 5), "rcopy's SACK map at 5% loss");
+   expect(reorderMatches(200000, 30), "rcopy's SACK map at 30% loss");
+
+   memset(map, 0, sizeof(map));
+   map[0] = 0xa0;
+   shiftSack(map, 2, 2);
+   expect(map[0] == 0x80 && map[1] == 0, "shiftSack moves bits towards the start");
+   map[0] = 0x01;
+   map[1] = 0x80;
+   shiftSack(map, 2, 7);
+   expect(map[0] == 0xc0 && map[1] == 0, "shiftSack carries bits across bytes");
+
+   initScoreboard(&board, 64, 1);
+   memset(map, 0, sizeof(map));
+   map[0] = 0x50; // 3 and 5 held, for a RR of 1
+   len = newlySacked(&board, 1, map, 1);
+   expect(len == 1 && map[0] == 0x50, "the first RR's map is all new");
+
+   map[0] = 0xa0; // still 3 and 5, for a RR of 2
+   len = newlySacked(&board, 2, map, 1);
+   expect(len == 1 && map[0] == 0x00, "what was held before is not new");
+
+   map[0] = 0xb0; // 3, 5 and 6
+   len = newlySacked(&board, 2, map, 1);
+   expect(isSet(map, 3) && !isSet(map, 0) && !isSet(map, 2), "only the newly held packet is left");
+
+   map[0] = 0xf0; // an older RR, arriving late
+   len = newlySacked(&board, 1, map, 1);
+   expect(map[0] == 0xf0, "a RR older than the last is all new");
+   freeScoreboard(&board);
+
+   return failures > 0;
+}
@@ -0,0 +1,63 @@
+#!/bin/bash
+# Throughput of server -t N for N = 1, 2, 4 ... up to one thread per core,
+# with CLIENTS rcopy transfers of MB megabytes each running side by side
+
+if [ $# -lt 2 ]; then
+    echo "Usage: $0 SERVER RCOPY [CLIENTS] [MB]"
+    exit 2
+fi
+
+SERVER=$1
+RCOPY=$2
+CLIENTS=${3:-8}
+MB=${4:-16}
+WIN=1024
+SIZE=1400
+PORT=$((20000 + $$ % 20000))
+CORES=`nproc`
+DIR=`mktemp -d /tmp/threadBenchXXXXXX`
+
+trap 'kill $SERV_PID &> /dev/null; rm -rf $DIR; exit 1' SIGHUP SIGINT SIGTERM SIGQUIT
+
+head -c $((MB * 1048576)) /dev/urandom > $DIR/in
+
+THREADS=1
+LIST=
+while [ $THREADS -lt $CORES ]; do
+    LIST="$LIST $THREADS"
+    THREADS=$((THREADS * 2))
+done
+LIST="$LIST $CORES"
+
+printf "%8s %10s %8s\n" threads seconds MB/s
+RETVAL=0
+for THREADS in $LIST; do
+    PORT=$((PORT + 1))
+    $SERVER 0 $PORT -t $THREADS > /dev/null 2>&1 &
+    SERV_PID=$!
+    sleep 0.3
+
+    START=`date +%s.%N`
+    for i in `seq 1 $CLIENTS`; do
+        $RCOPY $DIR/out.$i $DIR/in $WIN $SIZE 0 localhost $PORT > /dev/null 2>&1 &
+    done
+    wait `jobs -p | grep -v "^$SERV_PID$"`
+    END=`date +%s.%N`
+
+    kill $SERV_PID &> /dev/null
+    wait $SERV_PID 2> /dev/null
+
+    for i in `seq 1 $CLIENTS`; do
+        if ! cmp -s $DIR/in $DIR/out.$i; then
+            echo "- transfer $i with $THREADS threads did not arrive whole"
+            RETVAL=1
+        fi
+        rm -f $DIR/out.$i
+    done
+
+    awk -v t=$THREADS -v s=$START -v e=$END -v mb=$((CLIENTS * MB)) \
+        'BEGIN { printf "%8d %10.2f %8.1f\n", t, e - s, mb / (e - s) }'
+done
+
+rm -rf $DIR
+exit $RETVAL
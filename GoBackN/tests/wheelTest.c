@@ -0,0 +1,131 @@
+// Checks wheel.c with random timers on every level: none fires before its
+// deadline or more than two ticks after it, and each armed one fires once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wheel.h"
+
+#define TIMERS 100000
+#define LATE (2 * WHEEL_TICK) // most a timer may fire after its deadline
+#define HOUR (3600ULL * 1000000)
+#define MAX_STEPS 1000000 // a wheel that loses timers would step for ever
+
+static int failures = 0;
+
+static void expect(int ok, char * what)
+{
+   printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+   if (!ok)
+      failures++;
+}
+
+static struct wheel wheel;
+static struct timer timers[TIMERS];
+static int armed[TIMERS];
+static uint64_t now;
+static int pending; // timers the test has armed and not seen fire or cancelled
+static int early, late, twice, fired;
+
+// A deadline from now: mostly on the lowest level, the rest spread over
+// the higher ones, and now and then past what the top ring reaches
+static uint64_t deadline(void)
+{
+   int kind = rand() % 16;
+
+   if (kind < 8)
+      return now + rand() % (WHEEL_TICK << WHEEL_BITS);
+   if (kind < 11)
+      return now + rand() % (WHEEL_TICK << (2 * WHEEL_BITS));
+   if (kind < 13)
+      return now + rand() % (WHEEL_TICK << (3 * WHEEL_BITS));
+   if (kind < 15)
+      return now + (uint64_t)rand() * rand() % (WHEEL_TICK * (1ULL << (4 * WHEEL_BITS)));
+   return now + 20 * HOUR + (uint64_t)rand() * rand() % (20 * HOUR);
+}
+
+static void arm(int i)
+{
+   addTimer(&wheel, &timers[i], deadline());
+   if (!armed[i])
+      pending++;
+   armed[i] = 1;
+}
+
+static void cancel(int i)
+{
+   delTimer(&wheel, &timers[i]);
+   if (armed[i])
+      pending--;
+   armed[i] = 0;
+}
+
+/*****
+ * Checks the timer fired on time, and now and then arms it again or
+ * cancels another, as the server's timers do from their callbacks.
+ ****/
+static void fire(struct timer * timer)
+{
+   int i = timer - timers;
+
+   if (!armed[i])
+      twice++;
+   else
+      pending--;
+   if (now < timer->expires)
+      early++;
+   if (now > timer->expires + LATE)
+      late++;
+   armed[i] = 0;
+   fired++;
+
+   if (rand() % 8 == 0)
+      arm(i);
+   if (rand() % 16 == 0)
+      cancel(rand() % TIMERS);
+}
+
+int main(void)
+{
+   uint64_t next;
+   int64_t delay;
+   int i, steps = 0, stale = 0;
+
+   srand(464);
+   now = 123456789;
+   initWheel(&wheel, now);
+   for (i = 0; i < TIMERS; i++) {
+      initTimer(&timers[i], fire, NULL);
+      arm(i);
+   }
+   for (i = 0; i < TIMERS; i += 3)
+      cancel(i);
+   expect(wheel.count == pending, "the wheel counts what is armed, less what was cancelled");
+
+   next = nextTimer(&wheel);
+   expect(runTimers(&wheel, next - 1) == 0, "nothing fires before nextTimer() says");
+
+   // step from deadline to deadline, as the server's loop does, moving
+   // timers now and then to check arming in between
+   while (steps < MAX_STEPS && (delay = timerDelay(&wheel, now)) >= 0) {
+      now += delay;
+      runTimers(&wheel, now);
+      steps++;
+
+      if (rand() % 4 == 0)
+         arm(rand() % TIMERS);
+      if (wheel.count != pending)
+         stale++;
+   }
+
+   expect(early == 0, "no timer fires before its deadline");
+   expect(late == 0, "no timer fires more than two ticks after its deadline");
+   expect(twice == 0, "no timer fires twice for one arming");
+   expect(stale == 0 && pending == 0, "the count kept up, and every armed timer fired or was cancelled");
+   expect(nextTimer(&wheel) == 0 && timerDelay(&wheel, now) == -1, "an empty wheel has no next timer");
+   expect(now > 20 * HOUR, "timers past the top ring fired too");
+   printf("      %d fired in %d steps, over %.1f hours\n", fired, steps, (double)now / HOUR);
+
+   return failures > 0;
+}
@@ -0,0 +1,74 @@
+// Times the send window's per-packet work as the window grows, which the
+// ring buffer in window.c should keep flat
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "window.h"
+
+#define PACKET 1407
+#define PACKETS 2000000
+
+static double nowNsec(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*****
+ * Keeps a window of windowSize packets full the way the server does: for
+ * every packet sent, look up one outstanding packet as a SREJ would, find
+ * the oldest, and release it with an RR. Returns ns per packet.
+ ****/
+static double perPacket(int windowSize)
+{
+   struct window window;
+   u_char packet[PACKET] = {0};
+   int32_t seq;
+   int32_t netSeq;
+   int found = 0;
+   double start;
+
+   if (initWindow(&window, windowSize, 1, PACKET) < 0)
+      exit(1);
+
+   for (seq = 1; seq <= windowSize; seq++) {
+      netSeq = htonl(seq);
+      memcpy(packet, &netSeq, 4);
+      saveToWindow(&window, packet, PACKET, NULL);
+   }
+
+   start = nowNsec();
+   for (; seq <= windowSize + PACKETS; seq++) {
+      found += getFromWindow(&window, window.base + seq % windowSize) != NULL;
+      found += oldestInWindow(&window) != NULL;
+      delFromWindow(&window, window.base);
+
+      netSeq = htonl(seq);
+      memcpy(packet, &netSeq, 4);
+      saveToWindow(&window, packet, PACKET, NULL);
+      found += itemsInWindow(&window) == windowSize;
+   }
+
+   if (found != 3 * PACKETS)
+      printf("window of %d lost track of its packets\n", windowSize);
+
+   freeWindow(&window);
+   return (nowNsec() - start) / PACKETS;
+}
+
+int main(void)
+{
+   int windowSize;
+
+   printf("%8s %12s\n", "window", "ns/packet");
+   for (windowSize = 16; windowSize <= 65536; windowSize *= 4)
+      printf("%8d %12.1f\n", windowSize, perPacket(windowSize));
+
+   return 0;
+}
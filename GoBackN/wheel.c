@@ -0,0 +1,250 @@
+// Hierarchical timer wheel for the server's per-packet and session timers
+
+#include <stdio.h>
+#include <string.h>
+
+#include "wheel.h"
+
+#define WHEEL_WORDS (WHEEL_SLOTS / 64)
+
+static void linkTimer(struct wheel * wheel, struct timer * timer);
+static void cascade(struct wheel * wheel);
+static int nextOccupied(uint64_t * bits, int from);
+
+void initWheel(struct wheel * wheel, uint64_t now)
+{
+   memset(wheel, 0, sizeof(struct wheel));
+   wheel->tick = now / WHEEL_TICK;
+}
+
+void initTimer(struct timer * timer, timerFn fire, void * data)
+{
+   memset(timer, 0, sizeof(struct timer));
+   timer->fire = fire;
+   timer->data = data;
+}
+
+// Arms the timer for expires (microseconds), moving it if it is armed
+void addTimer(struct wheel * wheel, struct timer * timer, uint64_t expires)
+{
+   delTimer(wheel, timer);
+   timer->expires = expires;
+   linkTimer(wheel, timer);
+   wheel->count++;
+}
+
+void delTimer(struct wheel * wheel, struct timer * timer)
+{
+   if (timer->pprev == NULL)
+      return;
+
+   *timer->pprev = timer->next;
+   if (timer->next != NULL)
+      timer->next->pprev = timer->pprev;
+   timer->next = NULL;
+   timer->pprev = NULL;
+   wheel->count--;
+
+   if (wheel->slots[timer->level][timer->slot] == NULL)
+      wheel->occupied[timer->level][timer->slot / 64] &= ~(1ULL << (timer->slot % 64));
+}
+
+int timerPending(struct timer * timer)
+{
+   return timer->pprev != NULL;
+}
+
+/*****
+ * Fires, oldest slot first, every timer whose deadline is at or before now
+ * and returns how many. A timer fires at most one tick after its deadline
+ * and never before it. A timer is disarmed before its function is called,
+ * which may arm it again or cancel others.
+ ****/
+int runTimers(struct wheel * wheel, uint64_t now)
+{
+   uint64_t target = now / WHEEL_TICK;
+   struct timer * list;
+   struct timer * timer;
+   int idx;
+   int skip;
+   int fired = 0;
+
+   while (wheel->tick <= target)
+   {
+      if (wheel->count == 0) {
+         wheel->tick = target + 1;
+         break;
+      }
+
+      idx = wheel->tick & WHEEL_MASK;
+      if (idx == 0)
+         cascade(wheel);
+
+      // jump to the next occupied slot, or to where the ring wraps
+      if (wheel->slots[0][idx] == NULL) {
+         skip = nextOccupied(wheel->occupied[0], idx) - idx;
+         if (wheel->tick + skip > target + 1)
+            skip = target + 1 - wheel->tick;
+         wheel->tick += skip;
+         continue;
+      }
+
+      list = wheel->slots[0][idx];
+      list->pprev = &list;
+      wheel->slots[0][idx] = NULL;
+      wheel->occupied[0][idx / 64] &= ~(1ULL << (idx % 64));
+      wheel->tick++;
+
+      while ((timer = list) != NULL)
+      {
+         list = timer->next;
+         if (list != NULL)
+            list->pprev = &list;
+         timer->next = NULL;
+         timer->pprev = NULL;
+         wheel->count--;
+         wheel->fired++;
+         fired++;
+         timer->fire(timer);
+      }
+   }
+
+   return fired;
+}
+
+/*****
+ * When the earliest timer is due, in microseconds, or 0 if none is armed.
+ * For a timer still on a higher level this is when its slot cascades,
+ * which may be before it is due; runTimers() then moves it down and the
+ * next call says when it really is.
+ ****/
+uint64_t nextTimer(struct wheel * wheel)
+{
+   uint64_t best = UINT64_MAX;
+   uint64_t first;
+   int shift;
+   int level;
+   int idx;
+   int slot;
+
+   if (wheel->count == 0)
+      return 0;
+
+   // the lowest ring, this time round or after it wraps
+   idx = wheel->tick & WHEEL_MASK;
+   if ((slot = nextOccupied(wheel->occupied[0], idx)) < WHEEL_SLOTS)
+      best = wheel->tick + (slot - idx);
+   else if ((slot = nextOccupied(wheel->occupied[0], 0)) < idx)
+      best = wheel->tick + (WHEEL_SLOTS - idx) + slot;
+
+   for (level = 1; level < WHEEL_LEVELS; level++)
+   {
+      // first cascade of this level at or after tick, and the slot it takes
+      shift = WHEEL_BITS * level;
+      first = (wheel->tick + (1ULL << shift) - 1) >> shift;
+      idx = first & WHEEL_MASK;
+
+      if ((slot = nextOccupied(wheel->occupied[level], idx)) == WHEEL_SLOTS) {
+         if ((slot = nextOccupied(wheel->occupied[level], 0)) == WHEEL_SLOTS)
+            continue;
+         slot += WHEEL_SLOTS; // once this level has wrapped
+      }
+
+      if (((first + (slot - idx)) << shift) < best)
+         best = (first + (slot - idx)) << shift;
+   }
+
+   return best * WHEEL_TICK;
+}
+
+// Microseconds from now until the earliest timer is due, -1 if none is armed
+int64_t timerDelay(struct wheel * wheel, uint64_t now)
+{
+   uint64_t next = nextTimer(wheel);
+
+   if (next == 0)
+      return -1;
+
+   return next > now ? next - now : 0;
+}
+
+/*****
+ * Puts an unlinked timer in the lowest level whose ring reaches its
+ * deadline, rounded up to a whole tick. Anything further out than the top
+ * ring reaches is parked at its far end.
+ ****/
+static void linkTimer(struct wheel * wheel, struct timer * timer)
+{
+   uint64_t at = (timer->expires + WHEEL_TICK - 1) / WHEEL_TICK;
+   uint64_t delta;
+   struct timer ** head;
+   int level = 0;
+   int slot;
+
+   if (at < wheel->tick)
+      at = wheel->tick;
+   delta = at - wheel->tick;
+
+   while (level < WHEEL_LEVELS - 1 && delta >> (WHEEL_BITS * (level + 1)) != 0)
+      level++;
+
+   if (delta >> (WHEEL_BITS * WHEEL_LEVELS) != 0)
+      at = wheel->tick + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+
+   slot = (at >> (WHEEL_BITS * level)) & WHEEL_MASK;
+   head = &wheel->slots[level][slot];
+
+   timer->next = *head;
+   if (*head != NULL)
+      (*head)->pprev = &timer->next;
+   *head = timer;
+   timer->pprev = head;
+   timer->level = level;
+   timer->slot = slot;
+   wheel->occupied[level][slot / 64] |= 1ULL << (slot % 64);
+}
+
+/*****
+ * The lowest ring has wrapped: moves the next level's current slot down,
+ * and carries on up while each level wraps too.
+ ****/
+static void cascade(struct wheel * wheel)
+{
+   struct timer * list;
+   struct timer * timer;
+   int level;
+   int slot;
+
+   for (level = 1; level < WHEEL_LEVELS; level++)
+   {
+      slot = (wheel->tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+      list = wheel->slots[level][slot];
+      wheel->slots[level][slot] = NULL;
+      wheel->occupied[level][slot / 64] &= ~(1ULL << (slot % 64));
+
+      while ((timer = list) != NULL)
+      {
+         list = timer->next;
+         linkTimer(wheel, timer);
+      }
+
+      if (slot != 0)
+         break;
+   }
+}
+
+// First occupied slot at or after from in one ring, WHEEL_SLOTS if none
+static int nextOccupied(uint64_t * bits, int from)
+{
+   int word = from / 64;
+   uint64_t w = bits[word] & (~0ULL << (from % 64));
+
+   while (w == 0)
+   {
+      if (++word == WHEEL_WORDS)
+         return WHEEL_SLOTS;
+      w = bits[word];
+   }
+
+   return word * 64 + __builtin_ctzll(w);
+}
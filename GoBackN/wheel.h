@@ -0,0 +1,60 @@
+// Hierarchical timer wheel for the server's per-packet and session timers
+
+#ifndef __WHEEL_H__
+#define __WHEEL_H__
+
+#include <stdint.h>
+
+#define WHEEL_TICK 16     // microseconds per slot at the lowest level
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4    // 16 us * 2^32, timers up to 19 hours out
+
+struct timer;
+typedef void (*timerFn)(struct timer * timer);
+
+/*****
+ * A timer is embedded in whatever it times (a window slot, a session) and
+ * linked into one wheel slot. pprev points at whatever points at it, so
+ * it is unlinked in O(1) without knowing its neighbours; it is NULL while
+ * the timer is not armed.
+ ****/
+struct timer {
+   struct timer * next;
+   struct timer ** pprev;
+   uint64_t expires; // microseconds
+   uint16_t level;
+   uint16_t slot;
+   timerFn fire;
+   void * data;
+};
+
+/*****
+ * WHEEL_LEVELS rings of WHEEL_SLOTS lists. A timer goes in the lowest
+ * level whose ring reaches its deadline, in the slot for its deadline at
+ * that level's resolution, so arming and cancelling are O(1) however many
+ * timers there are. Each time the lowest ring wraps, the next level's
+ * current slot is moved down a level (cascaded). tick is the next lowest
+ * level slot to be run; occupied has a bit for every non-empty slot so
+ * runTimers() skips empty ones and nextTimer() finds the next deadline
+ * without walking lists.
+ ****/
+struct wheel {
+   uint64_t tick;
+   uint64_t count; // armed timers
+   uint64_t fired;
+   struct timer * slots[WHEEL_LEVELS][WHEEL_SLOTS];
+   uint64_t occupied[WHEEL_LEVELS][WHEEL_SLOTS / 64];
+};
+
+void initWheel(struct wheel * wheel, uint64_t now);
+void initTimer(struct timer * timer, timerFn fire, void * data);
+void addTimer(struct wheel * wheel, struct timer * timer, uint64_t expires);
+void delTimer(struct wheel * wheel, struct timer * timer);
+int timerPending(struct timer * timer);
+int runTimers(struct wheel * wheel, uint64_t now);
+uint64_t nextTimer(struct wheel * wheel);
+int64_t timerDelay(struct wheel * wheel, uint64_t now);
+
+#endif
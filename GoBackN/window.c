@@ -0,0 +1,140 @@
+// Ring buffer send window for the Go-Back-N server
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "window.h"
+
+// packetLen is the longest packet a slot has to hold, header included.
+// Returns -1 if there is no memory for the slots
+int initWindow(struct window * window, int windowSize, int32_t start_seq, int packetLen)
+{
+   window->size = windowSize;
+   window->slotSize = PACKETS_SIZE(packetLen);
+   window->base = start_seq;
+   window->next = start_seq;
+
+   if ((window->slots = malloc((size_t)windowSize * window->slotSize)) == NULL)
+   {
+      perror("initWindow: malloc");
+      return -1;
+   }
+
+   memset(window->slots, 0, (size_t)windowSize * window->slotSize);
+   return 0;
+}
+
+static struct packets * windowSlot(struct window * window, int32_t seq_num)
+{
+   return (struct packets *)(window->slots + (size_t)(seq_num % window->size) * window->slotSize);
+}
+
+void freeWindow(struct window * window)
+{
+   free(window->slots);
+   window->slots = NULL;
+   window->size = 0;
+}
+
+/*****
+ * Saves a packet into the slot for its sequence number. Saving a sequence
+ * number that is already outstanding (the EOF packet is re-read with the
+ * same number) just overwrites its slot. Returns the slot used.
+ *
+ * If payload is not NULL only the header (however long the connection's
+ * is) is copied and the slot points at the payload, which must stay put
+ * until the packet is RR'd.
+ ****/
+struct packets * saveToWindow(struct window * window, u_char * packet, int len, u_char * payload)
+{
+   int32_t seq;
+   struct packets * slot;
+
+   memcpy(&seq, packet, 4);
+   seq = ntohl(seq);
+
+   if (itemsInWindow(window) == 0)
+   {
+      window->base = seq;
+      window->next = seq + 1;
+   }
+   else if (seq >= window->next)
+   {
+      window->next = seq + 1;
+   }
+
+   slot = windowSlot(window, seq);
+   slot->seq_num = seq;
+   slot->len = len;
+   slot->resent = 0;
+   slot->sacked = 0;
+   slot->payload = payload;
+   memcpy(slot->packet, packet, payload != NULL ? MAX_HDR_LEN : len);
+
+   return slot;
+}
+
+/*****
+ * Releases every packet up to and including seq_num (cumulative RR).
+ ****/
+void delFromWindow(struct window * window, int32_t seq_num)
+{
+   if (seq_num < window->base)
+      return;
+
+   if (seq_num >= window->next)
+      window->base = window->next;
+   else
+      window->base = seq_num + 1;
+}
+
+/*****
+ * Returns the saved packet for seq_num, or NULL if it is not outstanding.
+ ****/
+struct packets * getFromWindow(struct window * window, int32_t seq_num)
+{
+   struct packets * slot;
+
+   if (seq_num < window->base || seq_num >= window->next)
+      return NULL;
+
+   slot = windowSlot(window, seq_num);
+
+   return slot->seq_num == seq_num ? slot : NULL;
+}
+
+struct packets * oldestInWindow(struct window * window)
+{
+   return getFromWindow(window, window->base);
+}
+
+int itemsInWindow(struct window * window)
+{
+   return window->next - window->base;
+}
+
+/*****
+ * Function to check if the received sequence number is greater than any of
+ * the unacknowledged sequence numbers.
+ ****/
+int notExpected(struct window * window, int32_t seq_num)
+{
+   return itemsInWindow(window) != 0 && window->base < seq_num;
+}
+
+void printWindow(struct window * window)
+{
+   int32_t seq;
+   struct packets * slot;
+
+   printf("***************\nWindow:\n");
+   for (seq = window->base; seq < window->next; seq++)
+   {
+      slot = windowSlot(window, seq);
+      printf("%d: seq num #%d || LEN: %d\n", seq % window->size,
+         slot->seq_num, slot->len);
+   }
+   printf("***************\n\n");
+}
@@ -0,0 +1,33 @@
+// Sliding window used by the server to hold unacknowledged packets
+
+#ifndef __WINDOW_H__
+#define __WINDOW_H__
+
+#include "networks.h"
+
+/*****
+ * The window is a ring of windowSize slots indexed by seq_num % windowSize.
+ * Everything in [base, next) is outstanding (sent but not yet RR'd), so
+ * saving a packet, releasing on an RR, looking up a SREJ'd packet and
+ * finding the oldest unacknowledged packet are all O(1). Each slot has
+ * room for the longest packet the connection sends (slotSize bytes apart).
+ ****/
+struct window {
+   u_char * slots;
+   int32_t slotSize;
+   int32_t size;
+   int32_t base; // oldest unacknowledged sequence number
+   int32_t next; // one past the newest sequence number saved
+};
+
+int initWindow(struct window * window, int windowSize, int32_t start_seq, int packetLen);
+void freeWindow(struct window * window);
+struct packets * saveToWindow(struct window * window, u_char * packet, int len, u_char * payload);
+void delFromWindow(struct window * window, int32_t seq_num);
+struct packets * getFromWindow(struct window * window, int32_t seq_num);
+struct packets * oldestInWindow(struct window * window);
+int itemsInWindow(struct window * window);
+int notExpected(struct window * window, int32_t seq_num);
+void printWindow(struct window * window);
+
+#endif
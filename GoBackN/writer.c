@@ -0,0 +1,98 @@
+// Buffered output file writer used by rcopy
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "writer.h"
+
+void initWriter(struct writer * writer, int fd, off_t offset, int cap)
+{
+   memset(writer, 0, sizeof(struct writer));
+   writer->fd = fd;
+   writer->offset = offset;
+   writer->cap = cap;
+
+   if ((writer->buf = malloc(cap)) == NULL)
+   {
+      perror("initWriter: malloc");
+      exit(-1);
+   }
+}
+
+/*****
+ * Appends len bytes, writing the buffer out whenever it fills. Returns 0,
+ * or -1 if a write failed.
+ ****/
+int writeData(struct writer * writer, u_char * data, int len)
+{
+   int chunk;
+
+   while (len > 0)
+   {
+      chunk = writer->cap - writer->len;
+      if (chunk > len)
+         chunk = len;
+
+      memcpy(writer->buf + writer->len, data, chunk);
+      writer->len += chunk;
+      data += chunk;
+      len -= chunk;
+
+      if (writer->len == writer->cap && flushWriter(writer) < 0)
+         return -1;
+   }
+
+   return 0;
+}
+
+/*****
+ * Returns room for len (at most cap) contiguous bytes at the end of the
+ * buffer, flushing first if they do not fit, or NULL if that write failed.
+ * Nothing is added until commitData(), so the caller can fill the room and
+ * then change its mind.
+ ****/
+u_char * reserveData(struct writer * writer, int len)
+{
+   if (writer->cap - writer->len < len && flushWriter(writer) < 0)
+      return NULL;
+
+   return writer->buf + writer->len;
+}
+
+void commitData(struct writer * writer, int len)
+{
+   writer->len += len;
+}
+
+int flushWriter(struct writer * writer)
+{
+   int done = 0;
+   ssize_t ret;
+
+   while (done < writer->len)
+   {
+      if ((ret = pwrite(writer->fd, writer->buf + done, writer->len - done,
+         writer->offset + done)) < 0)
+      {
+         perror("flushWriter: pwrite");
+         return -1;
+      }
+
+      done += ret;
+      writer->writes++;
+   }
+
+   writer->offset += writer->len;
+   writer->bytes += writer->len;
+   writer->len = 0;
+
+   return 0;
+}
+
+void freeWriter(struct writer * writer)
+{
+   free(writer->buf);
+   writer->buf = NULL;
+}
@@ -0,0 +1,33 @@
+// Buffered output file writer used by rcopy
+
+#ifndef __WRITER_H__
+#define __WRITER_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define WRITE_BUF (256 * 1024) // bytes gathered before each write
+
+/*****
+ * Collects in-order payloads and writes them out in large pwrite() calls.
+ * offset is where the buffered bytes go in the file, so nothing depends on
+ * the descriptor's own file position.
+ ****/
+struct writer {
+   int fd;
+   off_t offset;
+   u_char * buf;
+   int len;
+   int cap;
+   uint64_t bytes;
+   uint64_t writes;
+};
+
+void initWriter(struct writer * writer, int fd, off_t offset, int cap);
+int writeData(struct writer * writer, u_char * data, int len);
+u_char * reserveData(struct writer * writer, int len);
+void commitData(struct writer * writer, int len);
+int flushWriter(struct writer * writer);
+void freeWriter(struct writer * writer);
+
+#endif